@@ -1,32 +1,87 @@
+#define _GNU_SOURCE  /* memfd_create */
 #include "tecnicofs-client-api.h"
+#include "../tecnicofs-ring.h"
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <stdio.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/random.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 
+/*
+ * Every thread talks to the server through a channel of its own, opened the first time it sends a
+ * request, so the state below is kept per thread. A thread's channel is closed when it exits.
+ */
+
+/* path to server socket, given to tfsMount */
+char server_path[sizeof(((struct sockaddr_un *) NULL)->sun_path)];
+
+/* closes the channel of a thread when it exits */
+pthread_key_t channel_key;
+pthread_once_t channel_key_once = PTHREAD_ONCE_INIT;
+
+/* if set, the thread has a channel */
+__thread int mounted = 0;
+
 /* holds server socket address */
-struct sockaddr_un server_socket;
+__thread struct sockaddr_un server_socket;
 
 /* size of server socket */
-socklen_t serv_len = sizeof(struct sockaddr_un);
+__thread socklen_t serv_len = sizeof(struct sockaddr_un);
 
 /* holds client socket file descriptor */
-int client_fd;
+__thread int client_fd;
 
 /* holds client socket path */
-char client_path[30] = "/tmp/";
+__thread char client_path[40];
 
 /* holds number of bytes sent */
-int c;
+__thread int c;
+
+/* if set, the client is connected to a server in connected mode and has no socket path */
+__thread int connected = 0;
+
+/* ring shared with the server, NULL if messages go through the socket */
+__thread tfsRing *ring = NULL;
+
+/* connection the ring was handed through, kept open while the ring is used */
+__thread int ring_fd;
+
+/* id of the last request sent, replies carry the id of the request they answer */
+__thread uint32_t request_id = 0;
+
+/* holds last message received from the server */
+__thread char reply_buffer[TFS_MAX_REPLY];
+
+/* requests sent without their replies, in the slot of their id */
+__thread tfsPending requests[TFS_MAX_IN_FLIGHT];
+
+/* number of requests waiting for their replies */
+__thread int in_flight = 0;
+
+/* bulk buffer shared with the server for large reads and writes, NULL until one is needed */
+__thread char *bulk = NULL;
+__thread size_t bulk_size = 0;
 
-/* holds server output. uses an array for simplicity */
-int output[1];
+/* connection the bulk buffers are handed through, -1 if there is none */
+__thread int bulk_fd = -1;
 
-/* holds line that is going to be sent to the server */
-char line[MAX_INPUT_SIZE];
+/* token the server knows the bulk buffer by */
+__thread uint64_t bulk_token;
+
+/* if set, the server doesn't take bulk buffers and large reads and writes go in messages */
+__thread int bulk_unavailable = 0;
+
+/* if set, a bulk read or write is waiting for its reply, so callbacks can't use the buffer */
+__thread int bulk_busy = 0;
 
 
 /*
@@ -50,125 +105,627 @@ int set_socket_address_unix(char *path, struct sockaddr_un *addr) {
 }
 
 
+static int receive_reply(int block);
+static int channel_open();
+
+
 /*
- * Sends message to tecnicofs server telling it to create a file/directory.
+ * Sends a message to the server.
  *
  * Input:
- *   - filename: file/directory path that is going to be created
- *   - nodeType: f, creates a file and d, creates a directory
+ *   - message: message that is going to be sent
+ *   - size: size of the message
  * Output:
- *   - SUCCESS or FAIL
+ *   - number of bytes sent or -1
  * */
-int tfsCreate(char *filename, char nodeType) {
+static int send_message(void *message, int size) {
+    if (ring != NULL) {
+        uint32_t tail = ring->sq_tail;
+
+        /* the server needs room for the reply of every message in the ring */
+        if (tail - ring->cq_head >= TFS_RING_ENTRIES) return -1;
+
+        tfsRingRequest *slot = &ring->sq[tail % TFS_RING_ENTRIES];
+        slot->len = size;
+        memcpy(slot->data, message, size);
+        __atomic_store_n(&ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+        tfs_ring_wake(&ring->sq_tail, &ring->server_waiting);
+        return size;
+    }
+
+    /* the server may be waiting for room to send replies to this client, which takes them while
+       its message can't be sent */
+    while (1) {
+        int flags = MSG_NOSIGNAL | (in_flight > 0 ? MSG_DONTWAIT : 0);
+        int sent = connected ? send(client_fd, message, size, flags) :
+                   sendto(client_fd, message, size, flags, (struct sockaddr *) &server_socket, serv_len);
+
+        if (sent != -1 || errno != EAGAIN || in_flight == 0) return sent;
+        receive_reply(1);
+    }
+}
+
+
+/*
+ * Receives a message from the server.
+ *
+ * Input:
+ *   - buffer: where the message is stored
+ *   - size: size of the buffer
+ *   - block: if not set, returns 0 instead of waiting when there is no message
+ * Output:
+ *   - number of bytes received, 0 or -1
+ * */
+static int receive_message(void *buffer, int size, int block) {
+    if (ring != NULL) {
+        uint32_t head = ring->cq_head;
+
+        while (__atomic_load_n(&ring->cq_tail, __ATOMIC_ACQUIRE) == head) {
+            if (! block) return 0;
+            if (tfs_ring_wait(&ring->cq_tail, head, &ring->client_waiting, ring->spin_us) == TFS_STATUS_FAIL) {
+                /* the server closes the connection of the ring when it goes away */
+                struct pollfd server_poll = {ring_fd, POLLIN, 0};
+                if (poll(&server_poll, 1, 0) != 0) return -1;
+            }
+        }
+
+        tfsRingReply *slot = &ring->cq[head % TFS_RING_ENTRIES];
+        int len = (int) slot->len < size ? (int) slot->len : size;
+        memcpy(buffer, slot->data, len);
+        __atomic_store_n(&ring->cq_head, head + 1, __ATOMIC_RELEASE);
+        return len;
+    }
+
+    int c = connected ? recv(client_fd, buffer, size, block ? 0 : MSG_DONTWAIT) :
+            recvfrom(client_fd, buffer, size, block ? 0 : MSG_DONTWAIT, (struct sockaddr *) &server_socket, &serv_len);
+
+    if (c == -1 && errno == EAGAIN && ! block) return 0;
+    if (c == 0 && connected) return -1;  /* the server closed the connection */
+    return c;
+}
 
-    /* clears memory and concatenates everything in a command before sending to the server */
-    bzero(line, MAX_INPUT_SIZE);
-    strcat(line, "c ");
-    strcat(line, filename);
-    strcat(line, " ");
-    strcat(line, &nodeType);
-    strcat(line, "\0");
 
-    /* send message to create and gets the number of bytes sent */
-    c = sendto(client_fd, line, strlen(line)+1, 0, (struct sockaddr *) &server_socket, serv_len);
+/*
+ * Gets the id of a new request.
+ *
+ * Output:
+ *   - the id, which is never 0
+ * */
+static uint32_t next_request_id() {
+    /* ids are also tickets, so they stay positive ints */
+    request_id = request_id == INT32_MAX ? 1 : request_id + 1;
+    return request_id;
+}
 
-    /* checks if an error occurred */
-    assert__(c >= 0, "Error: tfsCreate had an error and couldn't send message!\n")
 
-    /* gets message from the server */
-    recvfrom(client_fd, output, sizeof(output), 0, (struct sockaddr *) &server_socket, &serv_len);
+/*
+ * Encodes a request.
+ *
+ * Input:
+ *   - buffer: where the request is encoded, with room for TFS_MAX_REQUEST bytes
+ *   - opcode: operation the server is going to execute
+ *   - node_type: f or d for creates, 0 otherwise
+ *   - path_1: first path of the request
+ *   - path_2: second path of the request, or NULL
+ *   - id: id of the request
+ * Output:
+ *   - size of the request or TFS_STATUS_FAIL (if a path is too long)
+ * */
+static int encode_request(char *buffer, char opcode, char node_type, char *path_1, char *path_2, uint32_t id) {
+
+    char *paths[TFS_MAX_PATHS] = {path_1, path_2};
+    tfsRequestHeader header;
+    int offset = sizeof(tfsRequestHeader);
+
+    header.magic = TFS_MAGIC;
+    header.opcode = opcode;
+    header.node_type = node_type;
+    header.reserved = 0;
+    header.request_id = id;
+
+    /* paths go right after the header, without '\0' */
+    for (int i = 0; i < TFS_MAX_PATHS; i++) {
+        size_t path_len = paths[i] != NULL ? strlen(paths[i]) : 0;
+        if (path_len >= MAX_FILE_NAME) {
+            printf("Error: path %s is too long\n", paths[i]);
+            return TFS_STATUS_FAIL;
+        }
+        header.path_len[i] = path_len;
+        if (path_len > 0) memcpy(buffer + offset, paths[i], path_len);
+        offset += path_len;
+    }
+    memcpy(buffer, &header, sizeof(tfsRequestHeader));
+
+    return offset;
+}
+
 
-    return output[0];
+/*
+ * Completes the request a reply answers, running its callback or keeping its result until it is
+ * waited for. Replies to requests that are no longer waited for are ignored.
+ *
+ * Input:
+ *   - message: reply from the server, followed by the bytes read for reads, and by the cursor and
+ *              the bytes of the chunk for dumps
+ *   - size: size of the message
+ * */
+static void complete_request(char *message, int size) {
+
+    tfsReply reply;
+    memcpy(&reply, message, sizeof(tfsReply));
+
+    tfsPending *request = &requests[reply.request_id % TFS_MAX_IN_FLIGHT];
+
+    if (request->state != TFS_PENDING_IN_FLIGHT || request->id != reply.request_id) return;
+    in_flight--;
+
+    /* lookups give the inumber they found, reads, writes and dumps the number of bytes */
+    if ((request->opcode == TFS_OP_LOOKUP || request->opcode == TFS_OP_READ || request->opcode == TFS_OP_WRITE ||
+         request->opcode == TFS_OP_DUMP) && reply.status == TFS_STATUS_SUCCESS) request->result = reply.inumber;
+    else request->result = reply.status;
+
+    /* the chunk of a dump comes after its cursor */
+    if (request->opcode == TFS_OP_DUMP && request->result != TFS_STATUS_FAIL) {
+        tfsDumpReply dump_reply;
+
+        if (size < (int) (sizeof(tfsReply) + sizeof(tfsDumpReply))) request->result = TFS_STATUS_FAIL;
+        else {
+            memcpy(&dump_reply, message + sizeof(tfsReply), sizeof(tfsDumpReply));
+            *request->cursor = dump_reply.cursor;
+            message += sizeof(tfsDumpReply);
+            size -= sizeof(tfsDumpReply);
+        }
+    }
+
+    /* the bytes of a bulk read or dump are already in the bulk buffer */
+    if ((request->opcode == TFS_OP_READ || request->opcode == TFS_OP_DUMP) && request->data != NULL &&
+        request->result != TFS_STATUS_FAIL) {
+        int available = size - (int) sizeof(tfsReply);
+        if (request->result > available) request->result = available;
+        memcpy(request->data, message + sizeof(tfsReply), request->result);
+    }
+
+    if (request->callback != NULL) {
+        /* the slot is released first, so that the callback can send other requests */
+        request->state = TFS_PENDING_FREE;
+        request->callback(request->id, request->result, request->arg);
+    } else request->state = TFS_PENDING_DONE;
 }
 
 
 /*
- * Sends message to tecnicofs server telling it to delete a file/directory.
+ * Receives a message from the server, completing the request it answers if it is a reply to a
+ * single request.
  *
  * Input:
- *   - path: file path that is going to be deleted
+ *   - block: if not set, returns 0 instead of waiting when there is no message
  * Output:
- *   - SUCCESS or FAIL
+ *   - number of bytes received, stored in reply_buffer, or 0
  * */
-int tfsDelete(char *path) {
+static int receive_reply(int block) {
 
-    /* clears memory and concatenates everything in a command before sending to the server */
-    bzero(line, MAX_INPUT_SIZE);
-    strcat(line, "d ");
-    strcat(line, path);
-    strcat(line, "\0");
+    c = receive_message(reply_buffer, sizeof(reply_buffer), block);
+    assert__(c >= 0, "Error: couldn't receive message from the server!\n")
 
-    /* send message to create and gets the number of bytes sent */
-    c = sendto(client_fd, line, strlen(line) + 1, 0, (struct sockaddr *) &server_socket, serv_len);
+    /* replies to batches carry the id of their batch, which no single request has */
+    if (c >= (int) sizeof(tfsReply)) complete_request(reply_buffer, c);
+
+    return c;
+}
+
+
+/*
+ * Waits until another request can be sent without its reply finding no room.
+ */
+static void wait_for_room() {
+    /* a ring has room for fewer replies than a socket */
+    int max_in_flight = ring != NULL ? TFS_RING_ENTRIES : TFS_MAX_IN_FLIGHT;
+
+    while (in_flight >= max_in_flight) receive_reply(1);
+}
+
+
+/*
+ * Sends a request to the tecnicofs server without waiting for its reply.
+ *
+ * Input:
+ *   - opcode: operation the server is going to execute
+ *   - node_type: f or d for creates, 0 otherwise
+ *   - path_1: first path of the request
+ *   - path_2: second path of the request, or NULL
+ *   - data_header: offset and length of reads, writes and truncates, or cursor and length of dumps,
+ *                  NULL for other opcodes
+ *   - data: bytes of a write, or where the bytes of a read are copied to
+ *   - callback: function called with the result, or NULL if the result is waited for with tfsWait
+ *   - arg: argument given to the callback
+ * Output:
+ *   - ticket of the request or TFS_STATUS_FAIL (if the request can't be sent)
+ * */
+static tfsTicket tfsSubmit(char opcode, char node_type, char *path_1, char *path_2, tfsDataHeader *data_header,
+                           char *data, tfsCallback callback, void *arg) {
+
+    /* callbacks run while the request is sent may send others */
+    char buffer[TFS_MAX_DATA_REQUEST];
+    tfsPending *request = NULL;
+
+    if (! mounted && channel_open() != EXIT_SUCCESS) return TFS_STATUS_FAIL;
+    wait_for_room();
+
+    /* the request takes the slot of its id, so ids whose slots are still held are skipped */
+    while (request == NULL) {
+        int done = 0;
+
+        for (int i = 0; i < TFS_MAX_IN_FLIGHT && request == NULL; i++) {
+            tfsPending *slot = &requests[next_request_id() % TFS_MAX_IN_FLIGHT];
+            if (slot->state == TFS_PENDING_FREE) request = slot;
+            else if (slot->state == TFS_PENDING_DONE) done++;
+        }
+
+        if (request == NULL && done == TFS_MAX_IN_FLIGHT) {
+            printf("Error: too many results that weren't waited for\n");
+            return TFS_STATUS_FAIL;
+        }
+        if (request == NULL) receive_reply(1);
+    }
+
+    int size = encode_request(buffer, opcode, node_type, path_1, path_2, request_id);
+    if (size == TFS_STATUS_FAIL) return TFS_STATUS_FAIL;
+
+    /* the data header goes after the path, followed by the bytes of a write that isn't bulk */
+    if (data_header != NULL) {
+        memcpy(buffer + size, data_header, sizeof(tfsDataHeader));
+        size += sizeof(tfsDataHeader);
+        if (opcode == TFS_OP_WRITE && ! (data_header->flags & TFS_DATA_BULK)) {
+            memcpy(buffer + size, data, data_header->length);
+            size += data_header->length;
+        }
+    }
+
+    /* the slot is held before sending, so requests sent by callbacks meanwhile don't take it */
+    request->id = request_id;
+    request->state = TFS_PENDING_IN_FLIGHT;
+    request->opcode = opcode;
+    request->callback = callback;
+    request->arg = arg;
+    request->data = data;
+    request->cursor = NULL;
+
+    /* send message and gets the number of bytes sent */
+    c = send_message(buffer, size);
 
     /* checks if an error occurred */
-    assert__(c >= 0, "Error: tfsDelete had an error and couldn't send message!\n")
+    assert__(c >= 0, "Error: tfsSubmit had an error and couldn't send message!\n")
+    in_flight++;
+
+    return request->id;
+}
 
-    /* gets message from the server */
-    recvfrom(client_fd, output, sizeof(output), 0, (struct sockaddr *) &server_socket, &serv_len);
 
-    return output[0];
+/*
+ * Waits for the result of a request sent without a callback.
+ *
+ * Input:
+ *   - ticket: ticket of the request
+ *   - result: where the result is stored, the same the blocking call would return
+ * Output:
+ *   - TFS_STATUS_SUCCESS or TFS_STATUS_FAIL (if there is no such request to wait for)
+ * */
+int tfsWait(tfsTicket ticket, int *result) {
+
+    if (ticket <= 0) return TFS_STATUS_FAIL;
+    tfsPending *request = &requests[ticket % TFS_MAX_IN_FLIGHT];
+
+    if (request->id != (uint32_t) ticket || request->state == TFS_PENDING_FREE || request->callback != NULL)
+        return TFS_STATUS_FAIL;
+
+    while (request->state == TFS_PENDING_IN_FLIGHT) receive_reply(1);
+
+    *result = request->result;
+    request->state = TFS_PENDING_FREE;
+    return TFS_STATUS_SUCCESS;
 }
 
 
 /*
- * Sends message to tecnicofs server telling it to move a file/directory.
+ * Takes the replies that already arrived, without waiting for others. Callbacks of the requests they
+ * complete are called.
+ *
+ * Output:
+ *   - number of requests still waiting for their replies
+ * */
+int tfsPoll() {
+    while (in_flight > 0 && receive_reply(0) > 0);
+    return in_flight;
+}
+
+
+/*
+ * Waits until every request sent has its reply.
+ *
+ * Output:
+ *   - TFS_STATUS_SUCCESS
+ * */
+int tfsWaitAll() {
+    while (in_flight > 0) receive_reply(1);
+    return TFS_STATUS_SUCCESS;
+}
+
+
+/*
+ * Sends message to tecnicofs server telling it to create a file/directory, without waiting for it.
+ *
+ * Input:
+ *   - filename: file/directory path that is going to be created
+ *   - nodeType: f, creates a file and d, creates a directory
+ *   - callback: function called with SUCCESS or FAIL, or NULL to wait for it with tfsWait
+ *   - arg: argument given to the callback
+ * Output:
+ *   - ticket of the request or TFS_STATUS_FAIL
+ * */
+tfsTicket tfsCreateAsync(char *filename, char nodeType, tfsCallback callback, void *arg) {
+    return tfsSubmit(TFS_OP_CREATE, nodeType, filename, NULL, NULL, NULL, callback, arg);
+}
+
+
+/*
+ * Sends message to tecnicofs server telling it to delete a file/directory, without waiting for it.
+ *
+ * Input:
+ *   - path: file path that is going to be deleted
+ *   - callback: function called with SUCCESS or FAIL, or NULL to wait for it with tfsWait
+ *   - arg: argument given to the callback
+ * Output:
+ *   - ticket of the request or TFS_STATUS_FAIL
+ * */
+tfsTicket tfsDeleteAsync(char *path, tfsCallback callback, void *arg) {
+    return tfsSubmit(TFS_OP_DELETE, 0, path, NULL, NULL, NULL, callback, arg);
+}
+
+
+/*
+ * Sends message to tecnicofs server telling it to move a file/directory, without waiting for it.
  *
  * Input:
  *   - from: file/directory that is going to be moved
  *   - to: new path for the input file/directory
+ *   - callback: function called with SUCCESS or FAIL, or NULL to wait for it with tfsWait
+ *   - arg: argument given to the callback
  * Output:
- *   - SUCCESS or FAIL
+ *   - ticket of the request or TFS_STATUS_FAIL
  * */
-int tfsMove(char *from, char *to) {
+tfsTicket tfsMoveAsync(char *from, char *to, tfsCallback callback, void *arg) {
+    return tfsSubmit(TFS_OP_MOVE, 0, from, to, NULL, NULL, callback, arg);
+}
 
-    /* clears memory and concatenates everything in a command before sending to the server */
-    bzero(line, MAX_INPUT_SIZE);
-    strcat(line, "m ");
-    strcat(line, from);
-    strcat(line, " ");
-    strcat(line, to);
-    strcat(line, "\0");
 
-    /* send message to create and gets the number of bytes sent */
-    c = sendto(client_fd, line, strlen(line) + 1, 0, (struct sockaddr *) &server_socket, serv_len);
+/*
+ * Sends message to tecnicofs server telling it to lookup a file/directory, without waiting for it.
+ *
+ * Input:
+ *   - path: file/directory that is going to be searched
+ *   - callback: function called with the inumber or FAIL, or NULL to wait for it with tfsWait
+ *   - arg: argument given to the callback
+ * Output:
+ *   - ticket of the request or TFS_STATUS_FAIL
+ * */
+tfsTicket tfsLookupAsync(char *path, tfsCallback callback, void *arg) {
+    return tfsSubmit(TFS_OP_LOOKUP, 0, path, NULL, NULL, NULL, callback, arg);
+}
+
 
-    /* checks if an error occurred */
-    assert__(c >= 0, "Error: tfsMove had an error and couldn't send message!\n")
+/*
+ * Sends message to tecnicofs server telling it to print it's tree, without waiting for it.
+ *
+ * Input:
+ *   - out_file: file where the contents will be written
+ *   - callback: function called with SUCCESS or FAIL, or NULL to wait for it with tfsWait
+ *   - arg: argument given to the callback
+ * Output:
+ *   - ticket of the request or TFS_STATUS_FAIL
+ * */
+tfsTicket tfsPrintAsync(char *out_file, tfsCallback callback, void *arg) {
+    return tfsSubmit(TFS_OP_PRINT, 0, out_file, NULL, NULL, NULL, callback, arg);
+}
 
-    /* gets message from the server */
-    recvfrom(client_fd, output, sizeof(output), 0, (struct sockaddr *) &server_socket, &serv_len);
 
-    return output[0];
+/*
+ * Sends a read, write or truncate to the tecnicofs server, without waiting for it.
+ *
+ * Input:
+ *   - opcode: TFS_OP_READ, TFS_OP_WRITE or TFS_OP_TRUNCATE
+ *   - path: path of the file
+ *   - offset: where the read or write starts, or the new size of the file
+ *   - data: bytes that are written, or where the bytes read are copied to (NULL if they are bulk)
+ *   - len: number of bytes, at most TFS_MAX_DATA unless they are bulk
+ *   - flags: TFS_DATA_BULK if the bytes are in the bulk buffer, 0 otherwise
+ *   - callback: function called with the result, or NULL to wait for it with tfsWait
+ *   - arg: argument given to the callback
+ * Output:
+ *   - ticket of the request or TFS_STATUS_FAIL
+ * */
+static tfsTicket submit_data(char opcode, char *path, size_t offset, char *data, size_t len, uint32_t flags,
+                             tfsCallback callback, void *arg) {
+    tfsDataHeader data_header;
+
+    if (len > TFS_MAX_DATA && ! (flags & TFS_DATA_BULK)) {
+        printf("Error: a single request carries at most %d bytes\n", TFS_MAX_DATA);
+        return TFS_STATUS_FAIL;
+    }
+
+    data_header.offset = offset;
+    data_header.length = len;
+    data_header.flags = flags;
+    data_header.bulk_token = flags & TFS_DATA_BULK ? bulk_token : 0;
+    return tfsSubmit(opcode, 0, path, NULL, &data_header, data, callback, arg);
 }
 
 
 /*
- * Sends message to tecnicofs server telling it to lookup a file/directory.
+ * Sends message to tecnicofs server telling it to write to a file, without waiting for it.
  *
  * Input:
- *   - path: file/directory that is going to be searched
+ *   - path: file that is written
+ *   - offset: where the write starts
+ *   - buffer: bytes that are written, which can be reused once this returns
+ *   - len: number of bytes, at most TFS_MAX_DATA
+ *   - callback: function called with the number of bytes written or FAIL, or NULL to wait for it
+ *               with tfsWait
+ *   - arg: argument given to the callback
+ * Output:
+ *   - ticket of the request or TFS_STATUS_FAIL
+ * */
+tfsTicket tfsWriteAsync(char *path, size_t offset, char *buffer, size_t len, tfsCallback callback, void *arg) {
+    return submit_data(TFS_OP_WRITE, path, offset, buffer, len, 0, callback, arg);
+}
+
+
+/*
+ * Sends message to tecnicofs server telling it to read from a file, without waiting for it.
+ *
+ * Input:
+ *   - path: file that is read
+ *   - offset: where the read starts
+ *   - buffer: where the bytes read are copied to, which must be kept until the read completes
+ *   - len: maximum number of bytes, at most TFS_MAX_DATA
+ *   - callback: function called with the number of bytes read or FAIL, or NULL to wait for it with
+ *               tfsWait
+ *   - arg: argument given to the callback
+ * Output:
+ *   - ticket of the request or TFS_STATUS_FAIL
+ * */
+tfsTicket tfsReadAsync(char *path, size_t offset, char *buffer, size_t len, tfsCallback callback, void *arg) {
+    return submit_data(TFS_OP_READ, path, offset, buffer, len, 0, callback, arg);
+}
+
+
+/*
+ * Sends message to tecnicofs server telling it to change the size of a file, without waiting for it.
+ *
+ * Input:
+ *   - path: file that is truncated
+ *   - size: new size of the file
+ *   - callback: function called with SUCCESS or FAIL, or NULL to wait for it with tfsWait
+ *   - arg: argument given to the callback
+ * Output:
+ *   - ticket of the request or TFS_STATUS_FAIL
+ * */
+tfsTicket tfsTruncateAsync(char *path, size_t size, tfsCallback callback, void *arg) {
+    return submit_data(TFS_OP_TRUNCATE, path, size, NULL, 0, 0, callback, arg);
+}
+
+
+/*
+ * Sends a dump to the tecnicofs server, without waiting for it.
+ *
+ * Input:
+ *   - cursor: cursor of the chunk, 0 to start a new listing. Gets the cursor of the next chunk, 0 if
+ *             this one ends the listing, and must be kept until the dump completes
+ *   - buffer: where the chunk is copied to (NULL if it is bulk)
+ *   - len: maximum number of bytes, at most TFS_MAX_DATA unless they are bulk
+ *   - flags: TFS_DATA_BULK if the chunk goes to the bulk buffer, 0 otherwise
+ *   - callback: function called with the number of bytes of the chunk or FAIL, or NULL to wait for
+ *               it with tfsWait
+ *   - arg: argument given to the callback
+ * Output:
+ *   - ticket of the request or TFS_STATUS_FAIL
+ * */
+static tfsTicket submit_dump(uint64_t *cursor, char *buffer, size_t len, uint32_t flags, tfsCallback callback,
+                             void *arg) {
+    tfsTicket ticket = submit_data(TFS_OP_DUMP, NULL, *cursor, buffer, len, flags, callback, arg);
+
+    /* the reply only arrives while the client waits for replies, after this */
+    if (ticket != TFS_STATUS_FAIL) requests[ticket % TFS_MAX_IN_FLIGHT].cursor = cursor;
+    return ticket;
+}
+
+
+/*
+ * Sends message to tecnicofs server asking for a chunk of a listing of its tree, without waiting
+ * for it.
+ *
+ * Input:
+ *   - cursor: cursor of the chunk, 0 to start a new listing. Gets the cursor of the next chunk, 0 if
+ *             this one ends the listing, and must be kept until the dump completes
+ *   - buffer: where the chunk is copied to, which must be kept until the dump completes
+ *   - len: maximum number of bytes, at most TFS_MAX_DATA
+ *   - callback: function called with the number of bytes of the chunk or FAIL, or NULL to wait for
+ *               it with tfsWait
+ *   - arg: argument given to the callback
+ * Output:
+ *   - ticket of the request or TFS_STATUS_FAIL
+ * */
+tfsTicket tfsDumpAsync(uint64_t *cursor, char *buffer, size_t len, tfsCallback callback, void *arg) {
+    return submit_dump(cursor, buffer, len, 0, callback, arg);
+}
+
+
+/*
+ * Waits for the result of a request.
+ *
+ * Input:
+ *   - ticket: ticket of the request, or TFS_STATUS_FAIL if it couldn't be sent
+ * Output:
+ *   - result of the request or TFS_STATUS_FAIL
+ * */
+static int wait_result(tfsTicket ticket) {
+    int result;
+
+    if (ticket == TFS_STATUS_FAIL || tfsWait(ticket, &result) == TFS_STATUS_FAIL) return TFS_STATUS_FAIL;
+    return result;
+}
+
+
+/*
+ * Sends message to tecnicofs server telling it to create a file/directory.
+ *
+ * Input:
+ *   - filename: file/directory path that is going to be created
+ *   - nodeType: f, creates a file and d, creates a directory
  * Output:
  *   - SUCCESS or FAIL
  * */
-int tfsLookup(char *path) {
+int tfsCreate(char *filename, char nodeType) {
+    return wait_result(tfsCreateAsync(filename, nodeType, NULL, NULL));
+}
 
-    /* clears memory and concatenates everything in a command before sending to the server */
-    bzero(line, MAX_INPUT_SIZE);
-    strcat(line, "l ");
-    strcat(line, path);
-    strcat(line, "\0");
 
-    /* send message to create and gets the number of bytes sent */
-    c = sendto(client_fd, line, strlen(line) + 1, 0, (struct sockaddr *) &server_socket, serv_len);
+/*
+ * Sends message to tecnicofs server telling it to delete a file/directory.
+ *
+ * Input:
+ *   - path: file path that is going to be deleted
+ * Output:
+ *   - SUCCESS or FAIL
+ * */
+int tfsDelete(char *path) {
+    return wait_result(tfsDeleteAsync(path, NULL, NULL));
+}
 
-    /* checks if an error occurred */
-    assert__(c >= 0, "Error: tfsLookup had an error and couldn't send message!\n")
 
-    /* gets message from the server */
-    recvfrom(client_fd, output, sizeof(output), 0, (struct sockaddr *) &server_socket, &serv_len);
+/*
+ * Sends message to tecnicofs server telling it to move a file/directory.
+ *
+ * Input:
+ *   - from: file/directory that is going to be moved
+ *   - to: new path for the input file/directory
+ * Output:
+ *   - SUCCESS or FAIL
+ * */
+int tfsMove(char *from, char *to) {
+    return wait_result(tfsMoveAsync(from, to, NULL, NULL));
+}
 
-    return output[0];
+
+/*
+ * Sends message to tecnicofs server telling it to lookup a file/directory.
+ *
+ * Input:
+ *   - path: file/directory that is going to be searched
+ * Output:
+ *   - inumber of the file/directory or TFS_STATUS_FAIL
+ * */
+int tfsLookup(char *path) {
+    return wait_result(tfsLookupAsync(path, NULL, NULL));
 }
 
 
@@ -181,52 +738,595 @@ int tfsLookup(char *path) {
  *   - SUCCESS or FAIL
  * */
 int tfsPrint(char* out_file) {
+    return wait_result(tfsPrintAsync(out_file, NULL, NULL));
+}
+
+
+/*
+ * Makes sure the calling thread has a bulk buffer of a given size, handing a new one to the server
+ * if the one it has is smaller.
+ *
+ * Input:
+ *   - size: number of bytes needed, at most TFS_BULK_MAX
+ * Output:
+ *   - TFS_STATUS_SUCCESS or TFS_STATUS_FAIL (if the server doesn't take bulk buffers)
+ * */
+static int bulk_reserve(size_t size) {
+
+    struct sockaddr_un bulk_addr;  /* where the server takes bulk buffers */
+    tfsBulkHandoff handoff;
+    size_t new_size = TFS_BULK_THRESHOLD;
+    int memfd, status;
+    struct iovec iov = {&handoff, sizeof(tfsBulkHandoff)};
+    union {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg = {0};
+
+    if (size <= bulk_size) return TFS_STATUS_SUCCESS;
+    if (bulk_unavailable || size > TFS_BULK_MAX || (! mounted && channel_open() != EXIT_SUCCESS))
+        return TFS_STATUS_FAIL;
+
+    /* the first buffer comes with the connection and the token. a server without them is not asked again */
+    if (bulk_fd == -1) {
+        if (strlen(server_path) + strlen(TFS_BULK_SUFFIX) >= sizeof(bulk_addr.sun_path)) goto unavailable;
+        set_socket_address_unix(server_path, &bulk_addr);
+        strcat(bulk_addr.sun_path, TFS_BULK_SUFFIX);
+
+        if ((bulk_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) == -1) goto unavailable;
+        if (connect(bulk_fd, (struct sockaddr *) &bulk_addr, sizeof(struct sockaddr_un)) != 0 ||
+            getrandom(&bulk_token, sizeof(uint64_t), 0) != sizeof(uint64_t) || bulk_token == 0) {
+            close(bulk_fd);
+            bulk_fd = -1;
+            goto unavailable;
+        }
+    }
+
+    /* buffers double, so a thread hands only a few of them */
+    while (new_size < size) new_size *= 2;
+
+    /* the server maps the buffer, so it is sealed against shrinking under it */
+    if ((memfd = memfd_create("tecnicofs-bulk", MFD_CLOEXEC | MFD_ALLOW_SEALING)) == -1) return TFS_STATUS_FAIL;
+    if (ftruncate(memfd, new_size) != 0 ||
+        fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) goto close_memfd;
+    char *shared = mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (shared == MAP_FAILED) goto close_memfd;
+
+    handoff.token = bulk_token;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+
+    if (sendmsg(bulk_fd, &msg, MSG_NOSIGNAL) != sizeof(tfsBulkHandoff) ||
+        recv(bulk_fd, &status, sizeof(int), 0) != sizeof(int) || status != TFS_STATUS_SUCCESS) {
+        munmap(shared, new_size);
+        goto close_memfd;
+    }
+
+    /* the server let go of the old buffer before answering */
+    close(memfd);
+    if (bulk != NULL) munmap(bulk, bulk_size);
+    bulk = shared;
+    bulk_size = new_size;
+    return TFS_STATUS_SUCCESS;
+
+close_memfd:
+    close(memfd);
+    return TFS_STATUS_FAIL;
+unavailable:
+    bulk_unavailable = 1;
+    return TFS_STATUS_FAIL;
+}
+
+
+/*
+ * Gives the bulk buffer of the calling thread, for reads and writes without copies: a tfsWrite from
+ * its beginning or a tfsRead into it, of at most size bytes, moves the bytes straight between the
+ * buffer and the server. The buffer is valid until a call with a larger size or tfsUnmount.
+ *
+ * Input:
+ *   - size: number of bytes needed, at most TFS_BULK_MAX
+ * Output:
+ *   - the buffer or NULL (if the server doesn't take bulk buffers)
+ * */
+char *tfsBulkBuffer(size_t size) {
+    if (bulk_busy || bulk_reserve(size) == TFS_STATUS_FAIL) return NULL;
+    return bulk;
+}
+
+
+/*
+ * Reads or writes a range of a file through the bulk buffer, in requests of at most TFS_BULK_MAX
+ * bytes. Bytes are only copied if the range isn't already in the buffer.
+ *
+ * Input:
+ *   - opcode: TFS_OP_READ or TFS_OP_WRITE
+ *   - path: path of the file
+ *   - offset: where the range starts
+ *   - buffer: bytes that are written, or where the bytes read are copied to
+ *   - len: size of the range
+ * Output:
+ *   - number of bytes read or written until the first request that failed or fell short, or
+ *     TFS_STATUS_FAIL (if the first one failed)
+ * */
+static long transfer_bulk(char opcode, char *path, size_t offset, char *buffer, size_t len) {
+
+    int in_place = buffer == bulk, failed = 0;
+    size_t done = 0;
+
+    bulk_busy = 1;
+    while (done < len) {
+        size_t chunk = len - done < TFS_BULK_MAX ? len - done : TFS_BULK_MAX;
+
+        if (opcode == TFS_OP_WRITE && ! in_place) memcpy(bulk, buffer + done, chunk);
+        int result = wait_result(submit_data(opcode, path, offset + done, NULL, chunk, TFS_DATA_BULK, NULL, NULL));
+        if (result == TFS_STATUS_FAIL) {
+            failed = 1;
+            break;
+        }
+        if (opcode == TFS_OP_READ && ! in_place) memcpy(buffer + done, bulk, result);
+
+        done += result;
+        if ((size_t) result < chunk) break;
+    }
+    bulk_busy = 0;
+
+    return failed && done == 0 ? TFS_STATUS_FAIL : (long) done;
+}
+
+
+/*
+ * Reads or writes a range of a file in requests of at most TFS_MAX_DATA bytes, with up to
+ * TFS_DATA_WINDOW of them in flight. Ranges of at least TFS_BULK_THRESHOLD bytes, or in the bulk
+ * buffer, go through the bulk buffer if the server takes it.
+ *
+ * Input:
+ *   - opcode: TFS_OP_READ or TFS_OP_WRITE
+ *   - path: path of the file
+ *   - offset: where the range starts
+ *   - buffer: bytes that are written, or where the bytes read are copied to
+ *   - len: size of the range
+ * Output:
+ *   - number of bytes read or written until the first request that failed or fell short, or
+ *     TFS_STATUS_FAIL (if the first one failed)
+ * */
+static long transfer(char opcode, char *path, size_t offset, char *buffer, size_t len) {
+
+    /* large ranges go through the bulk buffer, unless a bulk transfer is waiting under a callback */
+    if (buffer == bulk && bulk != NULL && len <= bulk_size && ! bulk_busy)
+        return transfer_bulk(opcode, path, offset, buffer, len);
+    if (len >= TFS_BULK_THRESHOLD && ! bulk_busy &&
+        bulk_reserve(len < TFS_BULK_MAX ? len : TFS_BULK_MAX) == TFS_STATUS_SUCCESS)
+        return transfer_bulk(opcode, path, offset, buffer, len);
+
+    tfsTicket tickets[TFS_DATA_WINDOW];
+    size_t lengths[TFS_DATA_WINDOW];
+    int first = 0, count = 0;  /* requests in flight, oldest first */
+    int stopped = 0, failed = 0;
+    size_t sent = 0;
+    long done = 0;
+
+    while ((sent < len && ! stopped) || count > 0) {
+        if (sent < len && ! stopped && count < TFS_DATA_WINDOW) {
+            size_t chunk = len - sent < TFS_MAX_DATA ? len - sent : TFS_MAX_DATA;
+            tfsTicket ticket = submit_data(opcode, path, offset + sent, buffer + sent, chunk, 0, NULL, NULL);
+
+            if (ticket == TFS_STATUS_FAIL) {
+                stopped = failed = 1;
+                continue;
+            }
+            tickets[(first + count) % TFS_DATA_WINDOW] = ticket;
+            lengths[(first + count) % TFS_DATA_WINDOW] = chunk;
+            count++;
+            sent += chunk;
+            continue;
+        }
+
+        int result = wait_result(tickets[first]);
+        size_t expected = lengths[first];
+        first = (first + 1) % TFS_DATA_WINDOW;
+        count--;
+
+        /* requests after one that failed or fell short (the end of the file) don't count */
+        if (stopped) continue;
+        if (result == TFS_STATUS_FAIL) stopped = failed = 1;
+        else {
+            done += result;
+            if ((size_t) result < expected) stopped = 1;
+        }
+    }
+
+    return failed && done == 0 ? TFS_STATUS_FAIL : done;
+}
+
+
+/*
+ * Sends message to tecnicofs server telling it to write to a file. Writes larger than TFS_MAX_DATA
+ * (or TFS_BULK_MAX, through the bulk buffer) are split in several requests, so other clients may
+ * see them partly done.
+ *
+ * Input:
+ *   - path: file that is written
+ *   - offset: where the write starts
+ *   - buffer: bytes that are written
+ *   - len: number of bytes
+ * Output:
+ *   - number of bytes written or TFS_STATUS_FAIL
+ * */
+long tfsWrite(char *path, size_t offset, char *buffer, size_t len) {
+    return transfer(TFS_OP_WRITE, path, offset, buffer, len);
+}
+
+
+/*
+ * Sends message to tecnicofs server telling it to read from a file.
+ *
+ * Input:
+ *   - path: file that is read
+ *   - offset: where the read starts
+ *   - buffer: where the bytes read are copied to
+ *   - len: maximum number of bytes
+ * Output:
+ *   - number of bytes read (less than len at the end of the file) or TFS_STATUS_FAIL
+ * */
+long tfsRead(char *path, size_t offset, char *buffer, size_t len) {
+    return transfer(TFS_OP_READ, path, offset, buffer, len);
+}
+
+
+/*
+ * Sends message to tecnicofs server telling it to change the size of a file.
+ *
+ * Input:
+ *   - path: file that is truncated
+ *   - size: new size of the file
+ * Output:
+ *   - SUCCESS or FAIL
+ * */
+int tfsTruncate(char *path, size_t size) {
+    return wait_result(tfsTruncateAsync(path, size, NULL, NULL));
+}
+
+
+/*
+ * Gets the next part of a listing of the tecnicofs tree, the same text a print writes to a file,
+ * without the server writing it anywhere. Each chunk is listed from the tree as it is when it is
+ * taken, so entries added or removed during the listing may or may not be in it. Parts of at
+ * least TFS_BULK_THRESHOLD bytes, or in the bulk buffer, go through the bulk buffer if the server
+ * takes it, and smaller ones in chunks of at most TFS_MAX_DATA bytes.
+ *
+ * Input:
+ *   - cursor: where the part starts, 0 to start a new listing. Gets where the next part starts, 0
+ *             once the listing ended
+ *   - buffer: where the part is copied to
+ *   - len: maximum number of bytes
+ * Output:
+ *   - number of bytes copied (less than len at the end of the listing) or TFS_STATUS_FAIL (if the
+ *     server dropped the listing, which has to be started again)
+ * */
+long tfsDump(uint64_t *cursor, char *buffer, size_t len) {
+
+    int in_place = buffer == bulk && bulk != NULL && len <= bulk_size && ! bulk_busy;
+    int use_bulk = in_place || (len >= TFS_BULK_THRESHOLD && ! bulk_busy &&
+                                bulk_reserve(len < TFS_BULK_MAX ? len : TFS_BULK_MAX) == TFS_STATUS_SUCCESS);
+    size_t done = 0;
+
+    if (len == 0) return 0;
+
+    if (use_bulk) bulk_busy = 1;
+    /* a cursor of 0 starts the listing only in the first chunk, after that it means it ended */
+    do {
+        size_t limit = use_bulk ? (bulk_size < TFS_BULK_MAX ? bulk_size : TFS_BULK_MAX) : TFS_MAX_DATA;
+        size_t chunk = len - done < limit ? len - done : limit;
+        int result;
+
+        if (use_bulk) {
+            result = wait_result(submit_dump(cursor, NULL, chunk, TFS_DATA_BULK, NULL, NULL));
+            if (result != TFS_STATUS_FAIL && ! in_place) memcpy(buffer + done, bulk, result);
+        } else result = wait_result(submit_dump(cursor, buffer + done, chunk, 0, NULL, NULL));
+
+        if (result == TFS_STATUS_FAIL) {
+            if (use_bulk) bulk_busy = 0;
+            return done > 0 ? (long) done : TFS_STATUS_FAIL;
+        }
+        done += result;
+    } while (done < len && *cursor != 0);
+    if (use_bulk) bulk_busy = 0;
+
+    return done;
+}
+
+
+/*
+ * Empties a batch.
+ *
+ * Input:
+ *   - batch: batch that is going to be emptied
+ * */
+void tfsBatchInit(tfsBatch *batch) {
+    batch->count = 0;
+    batch->size = sizeof(tfsBatchHeader);
+}
 
-    /* clears memory and concatenates everything in a command before sending to the server */
-    bzero(line, MAX_INPUT_SIZE);
-    strcat(line, "p ");
-    strcat(line, out_file);
-    strcat(line, "\0");
 
-    /* send message to create and gets the number of bytes sent */
-    c = sendto(client_fd, line, strlen(line) + 1, 0, (struct sockaddr *) &server_socket, serv_len);
+/*
+ * Sends every operation of a batch to the tecnicofs server in a single message and stores their
+ * results once the server replies. The batch is left empty, and if it can't be sent every one of
+ * its operations gets TFS_STATUS_FAIL as its result.
+ *
+ * Input:
+ *   - batch: batch that is going to be sent
+ * Output:
+ *   - number of operations that were executed, or TFS_STATUS_FAIL
+ * */
+int tfsBatchSubmit(tfsBatch *batch) {
+
+    tfsBatchHeader header;
+    tfsBatchReply reply_header;
+    tfsReply *replies = (tfsReply *) (reply_buffer + sizeof(tfsBatchReply));
+    int count = batch->count;
+
+    if (count == 0) return 0;
+    if (! mounted && channel_open() != EXIT_SUCCESS) {
+        for (int i = 0; i < count; i++)
+            if (batch->results[i] != NULL) *batch->results[i] = TFS_STATUS_FAIL;
+        tfsBatchInit(batch);
+        return TFS_STATUS_FAIL;
+    }
+    wait_for_room();
+
+    header.magic = TFS_BATCH_MAGIC;
+    header.reserved = 0;
+    header.count = count;
+    header.request_id = next_request_id();
+    memcpy(batch->buffer, &header, sizeof(tfsBatchHeader));
+
+    /* send message and gets the number of bytes sent */
+    c = send_message(batch->buffer, batch->size);
 
     /* checks if an error occurred */
-    assert__(c >= 0, "Error: tfsPrint had an error and couldn't send message!\n")
+    assert__(c >= 0, "Error: tfsBatchSubmit had an error and couldn't send message!\n")
+
+    /* gets message from the server. replies to asynchronous requests that come first complete them */
+    in_flight++;
+    do {
+        receive_reply(1);
+        memcpy(&reply_header, reply_buffer, sizeof(tfsBatchReply));
+    } while (c != (int) (sizeof(tfsBatchReply) + count * sizeof(tfsReply)) ||
+             reply_header.request_id != header.request_id);
+    in_flight--;
+
+    for (int i = 0; i < count; i++) {
+        if (batch->results[i] == NULL) continue;
+
+        /* lookups give the inumber they found, like tfsLookup */
+        if (batch->opcodes[i] == TFS_OP_LOOKUP && replies[i].status == TFS_STATUS_SUCCESS)
+            *batch->results[i] = replies[i].inumber;
+        else *batch->results[i] = replies[i].status;
+    }
+
+    tfsBatchInit(batch);
+    return count;
+}
 
-    /* gets message from the server */
-    recvfrom(client_fd, output, sizeof(output), 0, (struct sockaddr *) &server_socket, &serv_len);
 
-    return output[0];
+/*
+ * Adds an operation to a batch, sending the batch first if it is full.
+ *
+ * Input:
+ *   - batch: batch where the operation is added
+ *   - opcode: operation the server is going to execute
+ *   - node_type: f or d for creates, 0 otherwise
+ *   - path_1: first path of the operation
+ *   - path_2: second path of the operation, or NULL
+ *   - result: where the result of the operation is stored once the batch is sent, or NULL
+ * Output:
+ *   - TFS_STATUS_SUCCESS or TFS_STATUS_FAIL (if the operation can't be encoded, or the full batch
+ *     couldn't be sent)
+ * */
+static int tfsBatchAdd(tfsBatch *batch, char opcode, char node_type, char *path_1, char *path_2, int *result) {
+
+    if (batch->count == TFS_MAX_BATCH && tfsBatchSubmit(batch) == TFS_STATUS_FAIL)
+        return TFS_STATUS_FAIL;
+
+    int size = encode_request(batch->buffer + batch->size, opcode, node_type, path_1, path_2, batch->count);
+    if (size == TFS_STATUS_FAIL) return TFS_STATUS_FAIL;
+
+    batch->opcodes[batch->count] = opcode;
+    batch->results[batch->count] = result;
+    batch->count++;
+    batch->size += size;
+
+    return TFS_STATUS_SUCCESS;
+}
+
+
+/*
+ * Adds the creation of a file/directory to a batch.
+ *
+ * Input:
+ *   - batch: batch where the operation is added
+ *   - filename: file/directory path that is going to be created
+ *   - nodeType: f, creates a file and d, creates a directory
+ *   - result: where SUCCESS or FAIL is stored once the batch is sent, or NULL
+ * Output:
+ *   - TFS_STATUS_SUCCESS or TFS_STATUS_FAIL
+ * */
+int tfsBatchCreate(tfsBatch *batch, char *filename, char nodeType, int *result) {
+    return tfsBatchAdd(batch, TFS_OP_CREATE, nodeType, filename, NULL, result);
+}
+
+
+/*
+ * Adds the deletion of a file/directory to a batch.
+ *
+ * Input:
+ *   - batch: batch where the operation is added
+ *   - path: file path that is going to be deleted
+ *   - result: where SUCCESS or FAIL is stored once the batch is sent, or NULL
+ * Output:
+ *   - TFS_STATUS_SUCCESS or TFS_STATUS_FAIL
+ * */
+int tfsBatchDelete(tfsBatch *batch, char *path, int *result) {
+    return tfsBatchAdd(batch, TFS_OP_DELETE, 0, path, NULL, result);
+}
+
+
+/*
+ * Adds the move of a file/directory to a batch.
+ *
+ * Input:
+ *   - batch: batch where the operation is added
+ *   - from: file/directory that is going to be moved
+ *   - to: new path for the input file/directory
+ *   - result: where SUCCESS or FAIL is stored once the batch is sent, or NULL
+ * Output:
+ *   - TFS_STATUS_SUCCESS or TFS_STATUS_FAIL
+ * */
+int tfsBatchMove(tfsBatch *batch, char *from, char *to, int *result) {
+    return tfsBatchAdd(batch, TFS_OP_MOVE, 0, from, to, result);
+}
+
+
+/*
+ * Adds the lookup of a file/directory to a batch.
+ *
+ * Input:
+ *   - batch: batch where the operation is added
+ *   - path: file/directory that is going to be searched
+ *   - result: where the inumber or FAIL is stored once the batch is sent, or NULL
+ * Output:
+ *   - TFS_STATUS_SUCCESS or TFS_STATUS_FAIL
+ * */
+int tfsBatchLookup(tfsBatch *batch, char *path, int *result) {
+    return tfsBatchAdd(batch, TFS_OP_LOOKUP, 0, path, NULL, result);
+}
+
+
+/*
+ * Adds a print of the tree to a batch.
+ *
+ * Input:
+ *   - batch: batch where the operation is added
+ *   - out_file: file where the contents will be written
+ *   - result: where SUCCESS or FAIL is stored once the batch is sent, or NULL
+ * Output:
+ *   - TFS_STATUS_SUCCESS or TFS_STATUS_FAIL
+ * */
+int tfsBatchPrint(tfsBatch *batch, char *out_file, int *result) {
+    return tfsBatchAdd(batch, TFS_OP_PRINT, 0, out_file, NULL, result);
 }
 
 
 /*
- * Creates and allocates all the resources needed for client socket. Also registers server socket.
+ * Hands a shared memory ring to the server, if it takes them. Messages then go through the ring.
  *
  * Input:
  *   - server_socket_path: path to server socket
  * Output:
+ *   - TFS_STATUS_SUCCESS or TFS_STATUS_FAIL (if the server doesn't take the ring)
+ * */
+static int ring_mount(char *server_socket_path) {
+
+    struct sockaddr_un ring_addr;  /* where the server takes rings */
+    int memfd, status;
+    char byte = 0;
+    struct iovec iov = {&byte, 1};
+    union {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg = {0};
+
+    if (strlen(server_socket_path) + strlen(TFS_RING_SUFFIX) >= sizeof(ring_addr.sun_path)) return TFS_STATUS_FAIL;
+    set_socket_address_unix(server_socket_path, &ring_addr);
+    strcat(ring_addr.sun_path, TFS_RING_SUFFIX);
+
+    if ((ring_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) == -1) return TFS_STATUS_FAIL;
+    if (connect(ring_fd, (struct sockaddr *) &ring_addr, sizeof(struct sockaddr_un)) != 0) goto close_socket;
+
+    /* the ring lives in a memfd, which is sent to the server as a file descriptor. the server maps
+     * it, so it is sealed against shrinking under it */
+    if ((memfd = memfd_create("tecnicofs-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING)) == -1) goto close_socket;
+    if (ftruncate(memfd, sizeof(tfsRing)) != 0 ||
+        fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) goto close_memfd;
+    tfsRing *shared = mmap(NULL, sizeof(tfsRing), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (shared == MAP_FAILED) goto close_memfd;
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+
+    if (sendmsg(ring_fd, &msg, MSG_NOSIGNAL) != 1 || recv(ring_fd, &status, sizeof(int), 0) != sizeof(int) ||
+        status != TFS_STATUS_SUCCESS) {
+        munmap(shared, sizeof(tfsRing));
+        goto close_memfd;
+    }
+
+    close(memfd);
+    ring = shared;
+    return TFS_STATUS_SUCCESS;
+
+close_memfd:
+    close(memfd);
+close_socket:
+    close(ring_fd);
+    return TFS_STATUS_FAIL;
+}
+
+
+/*
+ * Creates and allocates all the resources needed for the client socket of the calling thread. Also
+ * registers server socket.
+ *
+ * Output:
  *   - EXIT_SUCCESS or error
  * */
-int tfsMount(char* server_socket_path) {
+static int channel_open() {
 
     int sock_fd;  /* client socket file descriptor */
 
-    /*Max Number threads is around 2^22*/
-    char pid[7];
+    /* a thread has a channel only after tfsMount gives the server */
+    if (server_path[0] == '\0') return EXIT_FAILURE;
+
+    /* sets client socket path as: /tmp/<pid>-<tid> */
+    sprintf(client_path, "/tmp/%d-%ld", getpid(), (long) syscall(SYS_gettid));
 
-    /* sets client socket path as: /tmp/<pid> */
-    sprintf(pid, "%d", getpid());
-    strcat(client_path, pid);
+    /* the channel is closed when the thread exits */
+    mounted = 1;
+    pthread_setspecific(channel_key, &mounted);
 
     /* gets server socket so that it can be used by other functions */
-    strcpy(server_socket.sun_path, server_socket_path);
+    strcpy(server_socket.sun_path, server_path);
     server_socket.sun_family = AF_UNIX;
 
     struct sockaddr_un client_addr;  /* client socket address */
     socklen_t addrlen;  /* size of client socket */
 
+    /* a server in connected mode listens on a seqpacket socket. connecting to a datagram one fails */
+    assert__((sock_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) != -1, "Error: couldn't create client socket!\n")
+    if (connect(sock_fd, (struct sockaddr *) &server_socket, sizeof(struct sockaddr_un)) == 0) {
+        connected = 1;
+        client_fd = sock_fd;
+        ring_mount(server_path);
+        return EXIT_SUCCESS;
+    }
+    assert__(errno == EPROTOTYPE, "Error: couldn't connect to server socket!\n")
+    close(sock_fd);
+
     /* creates client side socket */
     assert__((sock_fd = socket(AF_UNIX, SOCK_DGRAM, 0)) != -1, "Error: couldn't create client socket!\n")
 
@@ -241,24 +1341,101 @@ int tfsMount(char* server_socket_path) {
 
     client_fd = sock_fd;  /* saves file descriptor so that all functions can access it */
 
+    /* the socket stays as it is, but is only used if the server doesn't take a ring */
+    ring_mount(server_path);
+
     return EXIT_SUCCESS;
 }
 
 
 /*
- * Clears previously allocated resources for the client socket
- *
- * Output:
- *   - EXIT_SUCCESS or error
+ * Clears previously allocated resources for the client socket of the calling thread.
  * */
-int tfsUnmount() {
+static void channel_close() {
 
     /* clears previously allocated link */
-    unlink(client_path);
+    if (! connected) unlink(client_path);
+
+    /* the server lets go of the ring once its connection closes */
+    if (ring != NULL) {
+        munmap(ring, sizeof(tfsRing));
+        close(ring_fd);
+        ring = NULL;
+    }
+
+    /* and of the bulk buffer once its own does */
+    if (bulk != NULL) munmap(bulk, bulk_size);
+    if (bulk_fd != -1) close(bulk_fd);
+    bulk = NULL;
+    bulk_size = 0;
+    bulk_fd = -1;
+    bulk_unavailable = 0;
 
     /* shuts down, closes and frees resources associated with the client socket */
     assert__(shutdown(client_fd, SHUT_RDWR) == 0, "Error: tfsMount couldn't shutdown socket!\n")
     assert__(close(client_fd) == 0, "Error: tfsMount couldn't close socket!\n")
 
+    /* every request in flight is dropped with the socket */
+    memset(requests, 0, sizeof(requests));
+    in_flight = 0;
+    connected = 0;
+    mounted = 0;
+}
+
+
+/*
+ * Closes the channel of a thread that exits without tfsUnmount.
+ *
+ * Input:
+ *   - arg: value of the key, unused
+ * */
+static void channel_exit(void *arg) {
+    (void) arg;
+    if (mounted) channel_close();
+}
+
+
+/*
+ * Creates the key that closes channels of threads when they exit.
+ */
+static void channel_key_create() {
+    assert__(pthread_key_create(&channel_key, channel_exit) == 0, "Error: couldn't create channel key!\n")
+}
+
+
+/*
+ * Registers server socket and opens the channel of the calling thread. Other threads get theirs the
+ * first time they send a request.
+ *
+ * Input:
+ *   - server_socket_path: path to server socket
+ * Output:
+ *   - EXIT_SUCCESS or error
+ * */
+int tfsMount(char* server_socket_path) {
+
+    assert__(strlen(server_socket_path) < sizeof(server_path), "Error: server socket path is too long!\n")
+    strcpy(server_path, server_socket_path);
+    pthread_once(&channel_key_once, channel_key_create);
+
+    if (mounted) return EXIT_SUCCESS;
+    return channel_open();
+}
+
+
+/*
+ * Clears previously allocated resources for the client socket of the calling thread. Channels of
+ * other threads are closed when they exit.
+ *
+ * Output:
+ *   - EXIT_SUCCESS or error
+ * */
+int tfsUnmount() {
+
+    if (mounted) {
+        channel_close();
+        pthread_setspecific(channel_key, NULL);
+    }
+
     return EXIT_SUCCESS;
 }
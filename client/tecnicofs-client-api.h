@@ -1,14 +1,86 @@
 #ifndef API_H
 #define API_H
 
+#include <stddef.h>
 #include "../tecnicofs-api-constants.h"
+#include "../tecnicofs-protocol.h"
+
+/*
+ * Operations that are sent to the server in a single message. The results of the operations
+ * are only stored once the batch is sent.
+ */
+typedef struct tfsBatch {
+    int count;  /* number of operations in the batch */
+    int size;  /* bytes used in buffer */
+    char opcodes[TFS_MAX_BATCH];
+    int *results[TFS_MAX_BATCH];  /* where the result of each operation goes */
+    char buffer[TFS_MAX_BATCH_REQUEST];  /* batch header followed by the requests */
+} tfsBatch;
+
+/* requests that can wait for their replies at once */
+#define TFS_MAX_IN_FLIGHT 128
+
+/* requests of a large read or write that are in flight at once */
+#define TFS_DATA_WINDOW 16
+
+/* largest bulk buffer of a thread. bulk reads and writes larger than this are split */
+#define TFS_BULK_MAX (64 * 1024 * 1024)
+
+/* states of a request sent with the asynchronous API */
+#define TFS_PENDING_FREE 0
+#define TFS_PENDING_IN_FLIGHT 1
+#define TFS_PENDING_DONE 2  /* has its result, waiting for tfsWait */
+
+/* identifies a request sent with the asynchronous API */
+typedef int tfsTicket;
+
+/* called when a request completes, with the result the blocking call would have returned */
+typedef void (*tfsCallback)(tfsTicket ticket, int result, void *arg);
+
+/*
+ * Request sent with the asynchronous API.
+ */
+typedef struct tfsPending {
+    uint32_t id;
+    int state;
+    char opcode;
+    int result;
+    tfsCallback callback;
+    void *arg;
+    char *data;  /* where the bytes of a read or a dump are copied to */
+    uint64_t *cursor;  /* where the cursor of the next chunk of a dump is stored */
+} tfsPending;
 
 int tfsCreate(char *filename, char nodeType);
 int tfsDelete(char* path);
 int tfsLookup(char *path);
 int tfsMove(char *from, char *to);
 int tfsPrint(char* out_file);
+long tfsWrite(char *path, size_t offset, char *buffer, size_t len);
+long tfsRead(char *path, size_t offset, char *buffer, size_t len);
+int tfsTruncate(char *path, size_t size);
+long tfsDump(uint64_t *cursor, char *buffer, size_t len);
+char *tfsBulkBuffer(size_t size);
 int tfsMount(char* line);
 int tfsUnmount();
+void tfsBatchInit(tfsBatch *batch);
+int tfsBatchCreate(tfsBatch *batch, char *filename, char nodeType, int *result);
+int tfsBatchDelete(tfsBatch *batch, char *path, int *result);
+int tfsBatchLookup(tfsBatch *batch, char *path, int *result);
+int tfsBatchMove(tfsBatch *batch, char *from, char *to, int *result);
+int tfsBatchPrint(tfsBatch *batch, char *out_file, int *result);
+int tfsBatchSubmit(tfsBatch *batch);
+tfsTicket tfsCreateAsync(char *filename, char nodeType, tfsCallback callback, void *arg);
+tfsTicket tfsDeleteAsync(char *path, tfsCallback callback, void *arg);
+tfsTicket tfsLookupAsync(char *path, tfsCallback callback, void *arg);
+tfsTicket tfsMoveAsync(char *from, char *to, tfsCallback callback, void *arg);
+tfsTicket tfsPrintAsync(char *out_file, tfsCallback callback, void *arg);
+tfsTicket tfsWriteAsync(char *path, size_t offset, char *buffer, size_t len, tfsCallback callback, void *arg);
+tfsTicket tfsReadAsync(char *path, size_t offset, char *buffer, size_t len, tfsCallback callback, void *arg);
+tfsTicket tfsTruncateAsync(char *path, size_t size, tfsCallback callback, void *arg);
+tfsTicket tfsDumpAsync(uint64_t *cursor, char *buffer, size_t len, tfsCallback callback, void *arg);
+int tfsWait(tfsTicket ticket, int *result);
+int tfsPoll();
+int tfsWaitAll();
 
 #endif /* CLIENT_H */
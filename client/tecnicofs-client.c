@@ -1,5 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 #include "tecnicofs-client-api.h"
 #include "../tecnicofs-api-constants.h"
 
@@ -9,21 +11,35 @@ FILE* inputFile;
 /* Server socket path */
 char* serverName;
 
+/* Number of threads sending commands, each through its own channel */
+int numberThreads = 1;
+
+/* Lets one thread at a time read the input file */
+pthread_mutex_t inputLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Bytes of the tree listing asked from the server at once */
+#define DUMP_BUFFER_SIZE (1024 * 1024)
+
 
 static void displayUsage (const char* appName) {
-    printf("Usage: %s inputfile server_socket_name\n", appName);
+    printf("Usage: %s inputfile server_socket_name [numthreads]\n", appName);
     exit(EXIT_FAILURE);
 }
 
 
 static void parseArgs (long argc, char* const argv[]) {
-    if (argc != 3) {
+    if (argc != 3 && argc != 4) {
         fprintf(stderr, "Invalid format:\n");
         displayUsage(argv[0]);
     }
 
     serverName = argv[2];
 
+    if (argc == 4 && (numberThreads = atoi(argv[3])) <= 0) {
+        fprintf(stderr, "Invalid number of threads\n");
+        displayUsage(argv[0]);
+    }
+
     inputFile = fopen(argv[1], "r");
 
     if (inputFile== NULL) {
@@ -33,19 +49,148 @@ static void parseArgs (long argc, char* const argv[]) {
 }
 
 
+/*
+ * Command read from the input file, waiting in the batch for its result.
+ */
+typedef struct pending_t {
+    char op;
+    char arg1[MAX_INPUT_SIZE], arg2[MAX_INPUT_SIZE];
+    int res;
+} pending_t;
+
+/* commands in the batch of each thread, in the order they were read */
+__thread pending_t pending[TFS_MAX_BATCH];
+
+/* commands that are sent to the server together by each thread */
+__thread tfsBatch batch;
+
+
+/*
+ * Prints the result of a command.
+ */
+void printResult(pending_t *command) {
+    char *arg1 = command->arg1, *arg2 = command->arg2;
+    int res = command->res;
+
+    switch (command->op) {
+        case 'c':
+            if (arg2[0] == 'f') {
+                if (!res)
+                  printf("Created file: %s\n", arg1);
+                else
+                  printf("Unable to create file: %s\n", arg1);
+            } else {
+                if (!res)
+                  printf("Created directory: %s\n", arg1);
+                else
+                  printf("Unable to create directory: %s\n", arg1);
+            }
+            break;
+
+        case 'l':
+            if (res >= 0)
+                printf("Search: %s found\n", arg1);
+            else
+                printf("Search: %s not found\n", arg1);
+            break;
+
+        case 'd':
+            if (!res)
+              printf("Deleted: %s\n", arg1);
+            else
+              printf("Unable to delete: %s\n", arg1);
+            break;
+
+        case 'm':
+            if (!res)
+              printf("Moved: %s to %s\n", arg1, arg2);
+            else
+              printf("Unable to move: %s to %s\n", arg1, arg2);
+            break;
+
+        case 'p':
+            if (! res) printf("Printed tfs to %s\n", arg1);
+            else printf("Unable to print to %s\n", arg1);
+            break;
+
+        case 'P':
+            if (! res) printf("Dumped tfs to %s\n", arg1);
+            else printf("Unable to dump to %s\n", arg1);
+            break;
+    }
+}
+
+
+/*
+ * Sends the batch to the server and prints the result of each command in it.
+ */
+void flushBatch() {
+    int count = batch.count;
+
+    tfsBatchSubmit(&batch);
+
+    for (int i = 0; i < count; i++) printResult(&pending[i]);
+}
+
+
+/*
+ * Writes the listing of the tree the server streams to a file of the client.
+ *
+ * Input:
+ *   - path: path of the file
+ * Output:
+ *   - SUCCESS or FAIL
+ */
+int dumpTree(char *path) {
+    FILE *out = fopen(path, "w");
+    char *buffer = malloc(DUMP_BUFFER_SIZE);
+    uint64_t cursor = 0;
+    int res = 0;
+
+    if (out == NULL || buffer == NULL) res = -1;
+
+    /* the server keeps the listing of the tree as it was when it started until it is all taken */
+    while (res == 0) {
+        long size = tfsDump(&cursor, buffer, DUMP_BUFFER_SIZE);
+        if (size < 0 || fwrite(buffer, 1, size, out) != (size_t) size) res = -1;
+        if (cursor == 0) break;
+    }
+
+    if (out != NULL && fclose(out) != 0) res = -1;
+    free(buffer);
+    return res;
+}
+
+
 void errorParse(){
+    /* commands read before the invalid one still run */
+    flushBatch();
     fprintf(stderr, "Error: command invalid\n");
     exit(EXIT_FAILURE);
 }
 
 
+/*
+ * Reads the next line of the input file.
+ */
+char *readLine(char *line, int size) {
+    pthread_mutex_lock(&inputLock);
+    char *res = fgets(line, size, inputFile);
+    pthread_mutex_unlock(&inputLock);
+    return res;
+}
+
+
 void *processInput() {
     char line[MAX_INPUT_SIZE];
 
-    while (fgets(line, sizeof(line)/sizeof(char), inputFile)) {
+    tfsBatchInit(&batch);
+
+    /* with several threads, each runs the lines it reads, in the order it reads them */
+    while (readLine(line, sizeof(line)/sizeof(char))) {
         char op;
         char arg1[MAX_INPUT_SIZE], arg2[MAX_INPUT_SIZE];
-        int res;
+        int res = 0;
 
         int numTokens = sscanf(line, "%c %s %s", &op, arg1, arg2);
 
@@ -53,6 +198,14 @@ void *processInput() {
         if (numTokens < 1) {
             continue;
         }
+
+        /* the batch is sent once it is full, so results are printed in order */
+        if (batch.count == TFS_MAX_BATCH) flushBatch();
+        pending_t *command = &pending[batch.count];
+        command->op = op;
+        strcpy(command->arg1, arg1);
+        if (numTokens == 3) strcpy(command->arg2, arg2);
+
         switch (op) {
             case 'c':
                 if(numTokens != 3) {
@@ -61,20 +214,8 @@ void *processInput() {
                 }
                 switch (arg2[0]) {
 
-                    case 'f':
-                        res = tfsCreate(arg1, *arg2);
-                        if (!res)
-                          printf("Created file: %s\n", arg1);
-                        else
-                          printf("Unable to create file: %s\n", arg1);
-                        break;
-
-                    case 'd':
-                        res = tfsCreate(arg1, *arg2);
-                        if (!res)
-                          printf("Created directory: %s\n", arg1);
-                        else
-                          printf("Unable to create directory: %s\n", arg1);
+                    case 'f': case 'd':
+                        res = tfsBatchCreate(&batch, arg1, *arg2, &command->res);
                         break;
 
                     default:
@@ -85,37 +226,32 @@ void *processInput() {
             case 'l':
                 if(numTokens != 2)
                     errorParse();
-                res = tfsLookup(arg1);
-                if (res >= 0)
-                    printf("Search: %s found\n", arg1);
-                else
-                    printf("Search: %s not found\n", arg1);
+                res = tfsBatchLookup(&batch, arg1, &command->res);
                 break;
 
             case 'd':
                 if(numTokens != 2)
                     errorParse();
-                res = tfsDelete(arg1);
-                if (!res)
-                  printf("Deleted: %s\n", arg1);
-                else
-                  printf("Unable to delete: %s\n", arg1);
+                res = tfsBatchDelete(&batch, arg1, &command->res);
                 break;
 
             case 'm':
                 if(numTokens != 3)
                     errorParse();
-                res = tfsMove(arg1, arg2);
-                if (!res)
-                  printf("Moved: %s to %s\n", arg1, arg2);
-                else
-                  printf("Unable to move: %s to %s\n", arg1, arg2);
+                res = tfsBatchMove(&batch, arg1, arg2, &command->res);
                 break;
 
             case 'p':
-                res = tfsPrint(arg1);
-                if (! res) printf("Printed tfs to %s\n", arg1);
-                else printf("Unable to print to %s\n", arg1);
+                res = tfsBatchPrint(&batch, arg1, &command->res);
+                break;
+
+            case 'P':
+                if(numTokens != 2)
+                    errorParse();
+                /* the listing comes after the commands before it, and isn't part of the batch */
+                flushBatch();
+                command->res = dumpTree(arg1);
+                printResult(command);
                 break;
 
             case '#':
@@ -125,8 +261,15 @@ void *processInput() {
                 errorParse();
             }
         }
+
+        /* a command that couldn't be added to the batch fails right away, after the ones before it */
+        if (res != 0) {
+            command->res = res;
+            flushBatch();
+            printResult(command);
+        }
     }
-    fclose(inputFile);
+    flushBatch();
     return NULL;
 }
 
@@ -140,7 +283,19 @@ int main(int argc, char* argv[]) {
       exit(EXIT_FAILURE);
     }
 
-    processInput();
+    if (numberThreads == 1) processInput();
+    else {
+        pthread_t tid[numberThreads];
+
+        /* each thread opens its own channel with the first batch it sends */
+        for (int i = 0; i < numberThreads; i++)
+            if (pthread_create(&tid[i], NULL, processInput, NULL) != 0) {
+                fprintf(stderr, "Error: couldn't create thread\n");
+                exit(EXIT_FAILURE);
+            }
+        for (int i = 0; i < numberThreads; i++) pthread_join(tid[i], NULL);
+    }
+    fclose(inputFile);
 
     tfsUnmount();
 
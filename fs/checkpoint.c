@@ -0,0 +1,367 @@
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include "checkpoint.h"
+#include "snapshot.h"
+#include "wal.h"
+
+/*
+ * Checkpoints of the tree, so that the log doesn't have to be replayed from its start. A
+ * checkpoint is taken from a snapshot (see snapshot.c) while other threads keep changing the
+ * tree, and has every change whose record is before the offset of the log it keeps. Once it is
+ * durable, the log before that offset is discarded.
+ *
+ * Restarting reads the checkpoint at once and puts every i-node straight in the table with the
+ * inumber it had, without going through the paths of the tree.
+ */
+
+/* files of the checkpoint, NULL while there is no log */
+char *checkpoint_path = NULL, *temp_path = NULL;
+
+/* offset of the log the last checkpoint was taken at */
+uint64_t checkpoint_offset = 0;
+
+/* only one checkpoint is taken at a time */
+pthread_mutex_t checkpoint_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*
+ * Checkpoint being written.
+ */
+typedef struct checkpointWriter {
+    int fd;
+    char *buffer;  /* CHECKPOINT_BUFFER bytes waiting to be written */
+    size_t used;
+    checkpointHeader header;
+    int failed;
+} checkpointWriter;
+
+/*
+ * Checkpoint being read.
+ */
+typedef struct checkpointReader {
+    char *bytes;
+    size_t size;
+    size_t offset;
+    uint64_t nodes;  /* number of i-nodes loaded so far */
+    int failed;
+} checkpointReader;
+
+
+/*
+ * Writes the buffered bytes of a checkpoint to its file.
+ */
+static void writer_flush(checkpointWriter *writer) {
+    for (size_t written = 0; ! writer->failed && written < writer->used; ) {
+        ssize_t res = write(writer->fd, writer->buffer + written, writer->used - written);
+        if (res <= 0) writer->failed = 1;
+        else written += res;
+    }
+    writer->header.checksum = wal_checksum(writer->header.checksum, writer->buffer, writer->used);
+    writer->header.size += writer->used;
+    writer->used = 0;
+}
+
+
+/*
+ * Adds bytes to a checkpoint.
+ */
+static void put_bytes(checkpointWriter *writer, const char *bytes, size_t size) {
+    if (writer->used + size > CHECKPOINT_BUFFER) writer_flush(writer);
+    memcpy(writer->buffer + writer->used, bytes, size);
+    writer->used += size;
+}
+
+
+/*
+ * Adds a varint to a checkpoint.
+ */
+static void put_varint(checkpointWriter *writer, uint64_t value) {
+    char bytes[10];
+    size_t size = 0;
+
+    while (value >= 0x80) {
+        bytes[size++] = (char) (value | 0x80);
+        value >>= 7;
+    }
+    bytes[size++] = (char) value;
+    put_bytes(writer, bytes, size);
+}
+
+
+/*
+ * Adds the entries of a directory of the snapshot to a checkpoint, each one followed by the
+ * entries of its own directory.
+ * Input:
+ *  - writer: checkpoint being written
+ *  - dir: state of the directory in the snapshot
+ */
+static void put_entries(checkpointWriter *writer, snapshotNode *dir) {
+    const char *previous = "";
+
+    put_varint(writer, dir->n_entries);
+
+    for (int i = 0; i < dir->n_entries; i++) {
+        DirEntry *entry = &dir->entries[i];
+        snapshotNode *node = snapshot_node(entry->inumber);
+        size_t shared = 0, len = strlen(entry->name);
+        char node_type = node->nodeType;
+
+        while (previous[shared] != '\0' && previous[shared] == entry->name[shared]) shared++;
+
+        put_varint(writer, shared);
+        put_varint(writer, len - shared);
+        put_bytes(writer, entry->name + shared, len - shared);
+        put_varint(writer, entry->inumber);
+        put_bytes(writer, &node_type, 1);
+        writer->header.nodes++;
+
+        if (node->nodeType == T_DIRECTORY) put_entries(writer, node);
+        snapshot_node_free(node);
+        previous = entry->name;
+    }
+}
+
+
+/*
+ * Gets a varint of a checkpoint.
+ */
+static uint64_t get_varint(checkpointReader *reader) {
+    uint64_t value = 0;
+
+    for (int shift = 0; shift < 64 && reader->offset < reader->size; shift += 7) {
+        unsigned char byte = reader->bytes[reader->offset++];
+        value |= (uint64_t) (byte & 0x7f) << shift;
+        if (! (byte & 0x80)) return value;
+    }
+    reader->failed = 1;
+    return 0;
+}
+
+
+/*
+ * Loads the entries of a directory from a checkpoint, and the entries of every directory below it.
+ * Input:
+ *  - reader: checkpoint being read
+ *  - dir: entries of the directory, already in the table
+ *  - depth: number of directories above it
+ */
+static void load_entries(checkpointReader *reader, DirTable *dir, int depth) {
+    char name[MAX_FILE_NAME] = "";
+    size_t name_len = 0;
+    union Data data;
+
+    uint64_t count = get_varint(reader);
+    if (depth >= MAX_PATH_INODE_LENGTH || count > reader->size - reader->offset) reader->failed = 1;
+    else dir_table_reserve(dir, count);
+
+    for (uint64_t i = 0; ! reader->failed && i < count; i++) {
+        uint64_t shared = get_varint(reader), len = get_varint(reader);
+
+        if (reader->failed || shared > name_len || len >= MAX_FILE_NAME - shared ||
+            len > reader->size - reader->offset) {
+            reader->failed = 1;
+            return;
+        }
+        memcpy(name + shared, reader->bytes + reader->offset, len);
+        reader->offset += len;
+        name_len = shared + len;
+        name[name_len] = '\0';
+
+        uint64_t inumber = get_varint(reader);
+        if (reader->failed || inumber > INT32_MAX || reader->offset == reader->size) {
+            reader->failed = 1;
+            return;
+        }
+        type nType = (unsigned char) reader->bytes[reader->offset++];
+
+        if (name_len == 0 || inode_load(inumber, nType, &data) == FAIL || dir_table_add(dir, name, inumber) == FAIL) {
+            reader->failed = 1;
+            return;
+        }
+        reader->nodes++;
+
+        if (nType == T_DIRECTORY) load_entries(reader, data.dirEntries, depth + 1);
+    }
+}
+
+
+/*
+ * Builds the path of a file next to the log.
+ */
+static char *path_with_suffix(char *path, char *suffix) {
+    char *new_path = malloc(strlen(path) + strlen(suffix) + 1);
+    assert__(new_path != NULL, "Error: couldn't allocate a checkpoint path!\n")
+    strcpy(new_path, path);
+    strcat(new_path, suffix);
+    return new_path;
+}
+
+
+/*
+ * Loads the checkpoint of a log in the tree, which only has its root. Checkpoints can be taken
+ * from then on.
+ * Input:
+ *  - log_path: path of the log file
+ *  - log_id: where the identifier of the log the checkpoint was taken from is stored, 0 if there
+ *            is no checkpoint
+ *  - log_offset: where the offset of the log the checkpoint was taken at is stored
+ * Returns: SUCCESS or FAIL (if the checkpoint can't be read or is damaged)
+ */
+int checkpoint_load(char *log_path, uint64_t *log_id, uint64_t *log_offset) {
+    struct stat file_stat;
+    checkpointHeader header;
+    checkpointReader reader = {NULL, 0, 0, 1, 0};
+    union Data root;
+    type root_type;
+
+    checkpoint_path = path_with_suffix(log_path, CHECKPOINT_SUFFIX);
+    temp_path = path_with_suffix(checkpoint_path, CHECKPOINT_TEMP_SUFFIX);
+    *log_id = 0;
+    *log_offset = 0;
+
+    int fd = open(checkpoint_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return errno == ENOENT ? SUCCESS : FAIL;
+
+    /* the whole file is read with one read */
+    if (fstat(fd, &file_stat) != 0 || (size_t) file_stat.st_size < sizeof(checkpointHeader) ||
+        (reader.bytes = malloc(file_stat.st_size)) == NULL) {
+        close(fd);
+        return FAIL;
+    }
+    for (size_t done = 0; done < (size_t) file_stat.st_size; ) {
+        ssize_t res = read(fd, reader.bytes + done, file_stat.st_size - done);
+        if (res <= 0) {
+            close(fd);
+            free(reader.bytes);
+            return FAIL;
+        }
+        done += res;
+    }
+    close(fd);
+
+    memcpy(&header, reader.bytes, sizeof(checkpointHeader));
+    reader.offset = sizeof(checkpointHeader);
+    reader.size = file_stat.st_size;
+
+    if (header.magic != CHECKPOINT_MAGIC || header.version != CHECKPOINT_VERSION ||
+        header.size != reader.size - reader.offset ||
+        wal_checksum(WAL_CHECKSUM_INIT, reader.bytes + reader.offset, header.size) != header.checksum) {
+        fprintf(stderr, "Error: %s is not a tecnicofs checkpoint or is damaged!\n", checkpoint_path);
+        free(reader.bytes);
+        return FAIL;
+    }
+
+    inode_get(FS_ROOT, &root_type, &root);
+    load_entries(&reader, root.dirEntries, 0);
+    free(reader.bytes);
+
+    if (reader.failed || reader.offset != reader.size || reader.nodes != header.nodes) {
+        fprintf(stderr, "Error: %s doesn't hold a valid tree!\n", checkpoint_path);
+        return FAIL;
+    }
+    inode_table_loaded();
+
+    *log_id = header.log_id;
+    *log_offset = checkpoint_offset = header.log_offset;
+    return SUCCESS;
+}
+
+
+/*
+ * Keeps where the log ends when the snapshot is taken (see snapshot_take).
+ */
+static void keep_mark(void *offset) {
+    *(uint64_t *) offset = wal_mark();
+}
+
+
+/*
+ * Writes a checkpoint of the tree as it is now, while other threads keep changing it, and
+ * discards the records of the log it doesn't need anymore.
+ * Returns: SUCCESS or FAIL (if there is no log or the checkpoint couldn't be written)
+ */
+int checkpoint_take() {
+    checkpointWriter writer;
+    uint64_t offset;
+
+    assert__(pthread_mutex_lock(&checkpoint_lock) == 0, "Error: checkpoint_take failed to lock!\n")
+
+    /* nothing changed since the last one */
+    if (checkpoint_path == NULL || wal_id() == 0 || wal_mark() == checkpoint_offset) {
+        assert__(pthread_mutex_unlock(&checkpoint_lock) == 0, "Error: checkpoint_take failed to unlock!\n")
+        return checkpoint_path != NULL ? SUCCESS : FAIL;
+    }
+
+    memset(&writer, 0, sizeof(checkpointWriter));
+    writer.fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    writer.buffer = malloc(CHECKPOINT_BUFFER);
+    writer.failed = writer.fd == -1 || writer.buffer == NULL;
+
+    if (! writer.failed) {
+        writer.header.checksum = WAL_CHECKSUM_INIT;
+        writer.header.nodes = 1;
+
+        /* the header is written last, once the rest is known */
+        if (lseek(writer.fd, sizeof(checkpointHeader), SEEK_SET) == -1) writer.failed = 1;
+
+        snapshot_take(keep_mark, &offset);
+        snapshotNode *root = snapshot_node(FS_ROOT);
+        put_entries(&writer, root);
+        snapshot_node_free(root);
+        snapshot_release();
+        writer_flush(&writer);
+
+        writer.header.magic = CHECKPOINT_MAGIC;
+        writer.header.version = CHECKPOINT_VERSION;
+        writer.header.log_id = wal_id();
+        writer.header.log_offset = offset;
+        if (pwrite(writer.fd, &writer.header, sizeof(checkpointHeader), 0) != sizeof(checkpointHeader) ||
+            fdatasync(writer.fd) != 0)
+            writer.failed = 1;
+    }
+    if (writer.fd != -1) close(writer.fd);
+    free(writer.buffer);
+
+    if (! writer.failed) {
+        /* the log can't end before the checkpoint when the server restarts from it */
+        wal_sync(offset);
+
+        char *dir_path = strdup(checkpoint_path);
+        int dir_fd = dir_path != NULL ? open(dirname(dir_path), O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+
+        if (rename(temp_path, checkpoint_path) != 0 || dir_fd == -1 || fsync(dir_fd) != 0) writer.failed = 1;
+        if (dir_fd != -1) close(dir_fd);
+        free(dir_path);
+    }
+
+    if (writer.failed) {
+        fprintf(stderr, "Error: couldn't write checkpoint %s!\n", checkpoint_path);
+        unlink(temp_path);
+    } else {
+        checkpoint_offset = offset;
+        wal_discard(offset);
+    }
+
+    assert__(pthread_mutex_unlock(&checkpoint_lock) == 0, "Error: checkpoint_take failed to unlock!\n")
+    return writer.failed ? FAIL : SUCCESS;
+}
+
+
+/*
+ * Takes a last checkpoint, so that the next start doesn't replay the log. Nothing may change
+ * the tree meanwhile, and no checkpoints are taken afterwards.
+ */
+void checkpoint_close() {
+    checkpoint_take();
+
+    assert__(pthread_mutex_lock(&checkpoint_lock) == 0, "Error: checkpoint_close failed to lock!\n")
+    free(checkpoint_path);
+    free(temp_path);
+    checkpoint_path = temp_path = NULL;
+    checkpoint_offset = 0;
+    assert__(pthread_mutex_unlock(&checkpoint_lock) == 0, "Error: checkpoint_close failed to unlock!\n")
+}
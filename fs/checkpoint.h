@@ -0,0 +1,43 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include "state.h"
+
+/* first bytes of a checkpoint file, and version of its layout */
+#define CHECKPOINT_MAGIC 0x3174706b43736674ULL  /* "tfsCkpt1" */
+#define CHECKPOINT_VERSION 1
+
+/* the checkpoint of a log is kept next to it, in a file with the log path followed by this. it is
+ * written to another file first, followed by CHECKPOINT_TEMP_SUFFIX */
+#define CHECKPOINT_SUFFIX ".checkpoint"
+#define CHECKPOINT_TEMP_SUFFIX ".tmp"
+
+/* a checkpoint is written in pieces of this size */
+#define CHECKPOINT_BUFFER (1024 * 1024)
+
+
+/*
+ * Start of a checkpoint file. It is followed by the entries of the root directory: their count
+ * and then each entry, with the entries of a directory right after it. An entry is the length of
+ * the start its name shares with the entry before it in the same directory, the length and bytes
+ * of the rest of the name, its inumber and the type of its node. Counts, lengths and inumbers are
+ * varints (7 bits per byte, lowest first, the high bit set on every byte but the last).
+ */
+typedef struct checkpointHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t checksum;  /* of everything after the header (see wal_checksum) */
+    uint64_t log_id;  /* log the tree was taken from */
+    uint64_t log_offset;  /* where the records of the changes the checkpoint doesn't have start */
+    uint64_t size;  /* bytes after the header */
+    uint64_t nodes;  /* number of i-nodes, the root included */
+} checkpointHeader;
+
+
+int checkpoint_load(char *log_path, uint64_t *log_id, uint64_t *log_offset);
+int checkpoint_take();
+void checkpoint_close();
+
+
+#endif /* CHECKPOINT_H */
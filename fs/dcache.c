@@ -0,0 +1,239 @@
+#include <string.h>
+#include <stdlib.h>
+#include "dcache.h"
+
+
+/* cached entries. an entry can only be in the slot its hash points to */
+dcacheEntry *dcache_entries;
+
+/* entry i is protected by lock i % DCACHE_LOCKS */
+pthread_mutex_t dcache_locks[DCACHE_LOCKS];
+
+/* cached full paths, in the same way as the entries but with their own locks */
+dcachePath *dcache_paths;
+pthread_mutex_t dcache_path_locks[DCACHE_LOCKS];
+
+/* changes every time a directory is moved. cached entries stay valid, but a path that is resolved
+ * while it changes may have mixed the old and new places of the directory, and cached full paths
+ * may no longer lead where they did */
+unsigned int rename_generation = 0;
+
+
+/*
+ * Initializes the dentry cache.
+ */
+void dcache_init() {
+    dcache_entries = calloc(DCACHE_SIZE, sizeof(dcacheEntry));
+    dcache_paths = calloc(DCACHE_SIZE, sizeof(dcachePath));
+    assert__(dcache_entries != NULL && dcache_paths != NULL, "Error: couldn't allocate the dentry cache!\n")
+
+    for (int i = 0; i < DCACHE_SIZE; i++) {
+        dcache_entries[i].inumber = FAIL;
+        dcache_paths[i].inumber = FAIL;
+    }
+    for (int i = 0; i < DCACHE_LOCKS; i++) {
+        assert__(pthread_mutex_init(&dcache_locks[i], NULL) == 0, "Error: couldn't init dentry cache lock!\n")
+        assert__(pthread_mutex_init(&dcache_path_locks[i], NULL) == 0, "Error: couldn't init dentry cache lock!\n")
+    }
+}
+
+
+/*
+ * Releases the dentry cache.
+ */
+void dcache_destroy() {
+    for (int i = 0; i < DCACHE_LOCKS; i++) {
+        pthread_mutex_destroy(&dcache_locks[i]);
+        pthread_mutex_destroy(&dcache_path_locks[i]);
+    }
+    free(dcache_entries);
+    free(dcache_paths);
+    dcache_entries = NULL;
+    dcache_paths = NULL;
+}
+
+
+/*
+ * Gets the current rename generation. Must be read before a path is resolved, so that a
+ * directory moved meanwhile makes the resolution fail.
+ */
+unsigned int dcache_rename_generation() {
+    return __atomic_load_n(&rename_generation, __ATOMIC_ACQUIRE);
+}
+
+
+/*
+ * Tells paths being resolved through the cache that a directory was moved, which also makes every
+ * cached full path stale.
+ */
+void dcache_renamed() {
+    __atomic_add_fetch(&rename_generation, 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Hashes a name together with the directory that holds it.
+ */
+static unsigned int dcache_hash(int parent, char *name) {
+    return dir_name_hash(name) ^ ((unsigned int) parent * 2654435761u);
+}
+
+
+/*
+ * Looks for a name in the dentry cache.
+ * Input:
+ *  - parent: inumber of the directory that holds the name
+ *  - name: name of the entry
+ *  - parent_generation: gets the generation of the parent the entry is valid for, if it is
+ * Returns:
+ *  - inumber: inumber the name resolved to, if it is still valid
+ *  - FAIL: if the name isn't cached or is stale
+ */
+int dcache_lookup(int parent, char *name, unsigned int *parent_generation) {
+    unsigned int hash = dcache_hash(parent, name);
+    int i = hash & (DCACHE_SIZE - 1);
+    dcacheEntry *entry = &dcache_entries[i];
+    int inumber = FAIL;
+
+    assert__(pthread_mutex_lock(&dcache_locks[i % DCACHE_LOCKS]) == 0, "Error: dcache_lookup failed to lock!\n")
+
+    if (entry->inumber != FAIL && entry->hash == hash && entry->parent == parent &&
+        strcmp(entry->name, name) == 0) {
+        if (entry->parent_generation == inode_generation(parent)) {
+            inumber = entry->inumber;
+            *parent_generation = entry->parent_generation;
+        } else
+            entry->inumber = FAIL;  /* stale entries are dropped as soon as they are seen */
+    }
+
+    assert__(pthread_mutex_unlock(&dcache_locks[i % DCACHE_LOCKS]) == 0, "Error: dcache_lookup failed to unlock!\n")
+    return inumber;
+}
+
+
+/*
+ * Looks for a full path in the dentry cache.
+ * Input:
+ *  - path: full path
+ * Returns:
+ *  - inumber: inumber the path resolved to, if it is still valid
+ *  - FAIL: if the path isn't cached or is stale
+ */
+static int dcache_path_lookup(char *path) {
+    unsigned int hash = dir_name_hash(path);
+    int i = hash & (DCACHE_SIZE - 1);
+    dcachePath *entry = &dcache_paths[i];
+    int inumber = FAIL;
+
+    assert__(pthread_mutex_lock(&dcache_path_locks[i % DCACHE_LOCKS]) == 0, "Error: dcache_path_lookup failed to lock!\n")
+
+    if (entry->inumber != FAIL && entry->hash == hash && strcmp(entry->path, path) == 0) {
+        if (entry->rename_generation == dcache_rename_generation() &&
+            entry->parent_generation == inode_generation(entry->parent))
+            inumber = entry->inumber;
+        else
+            entry->inumber = FAIL;
+    }
+
+    assert__(pthread_mutex_unlock(&dcache_path_locks[i % DCACHE_LOCKS]) == 0, "Error: dcache_path_lookup failed to unlock!\n")
+    return inumber;
+}
+
+
+/*
+ * Caches a resolved full path, replacing whatever path was in its slot.
+ * Input:
+ *  - path: full path
+ *  - inumber: inumber the path resolved to
+ *  - parent: inumber of the directory that holds the last component of the path
+ *  - parent_generation: generation of the parent the last component was resolved with
+ *  - rename_generation: rename generation, read before the path was resolved
+ */
+static void dcache_path_insert(char *path, int inumber, int parent, unsigned int parent_generation,
+                               unsigned int rename_generation) {
+    if (strlen(path) >= MAX_FILE_NAME) return;
+
+    unsigned int hash = dir_name_hash(path);
+    int i = hash & (DCACHE_SIZE - 1);
+    dcachePath *entry = &dcache_paths[i];
+
+    assert__(pthread_mutex_lock(&dcache_path_locks[i % DCACHE_LOCKS]) == 0, "Error: dcache_path_insert failed to lock!\n")
+
+    strcpy(entry->path, path);
+    entry->hash = hash;
+    entry->inumber = inumber;
+    entry->parent = parent;
+    entry->parent_generation = parent_generation;
+    entry->rename_generation = rename_generation;
+
+    assert__(pthread_mutex_unlock(&dcache_path_locks[i % DCACHE_LOCKS]) == 0, "Error: dcache_path_insert failed to unlock!\n")
+}
+
+
+/*
+ * Resolves a path using only cached entries: the full path if it was resolved before, otherwise
+ * one component at a time, after which the full path is cached.
+ * Input:
+ *  - path: full path
+ * Returns:
+ *  - inumber: inumber the path resolved to
+ *  - FAIL: if the path is the root, a component isn't cached or a directory was moved meanwhile
+ */
+int dcache_resolve(char *path) {
+    int inumber = dcache_path_lookup(path);
+    if (inumber != FAIL) return inumber;
+
+    unsigned int renames = dcache_rename_generation();
+    unsigned int parent_generation = 0;
+    char name[MAX_FILE_NAME];
+    char *cursor = path;
+    int parent = FAIL, components = 0;
+    inumber = FS_ROOT;
+
+    while (1) {
+        while (*cursor == '/') cursor++;
+        if (*cursor == '\0') break;
+
+        size_t len = strcspn(cursor, "/");
+        if (len >= MAX_FILE_NAME) return FAIL;
+        memcpy(name, cursor, len);
+        name[len] = '\0';
+
+        parent = inumber;
+        if ((inumber = dcache_lookup(parent, name, &parent_generation)) == FAIL) return FAIL;
+        cursor += len;
+        components++;
+    }
+
+    if (components == 0 || dcache_rename_generation() != renames) return FAIL;
+
+    dcache_path_insert(path, inumber, parent, parent_generation, renames);
+    return inumber;
+}
+
+
+/*
+ * Caches a resolved name, replacing whatever entry was in its slot.
+ * Input:
+ *  - parent: inumber of the directory that holds the name
+ *  - name: name of the entry
+ *  - inumber: inumber the name resolved to
+ *  - parent_generation: generation of the parent, read while the entry was locked
+ */
+void dcache_insert(int parent, char *name, int inumber, unsigned int parent_generation) {
+    if (strlen(name) >= MAX_FILE_NAME) return;
+
+    unsigned int hash = dcache_hash(parent, name);
+    int i = hash & (DCACHE_SIZE - 1);
+    dcacheEntry *entry = &dcache_entries[i];
+
+    assert__(pthread_mutex_lock(&dcache_locks[i % DCACHE_LOCKS]) == 0, "Error: dcache_insert failed to lock!\n")
+
+    strcpy(entry->name, name);
+    entry->hash = hash;
+    entry->parent = parent;
+    entry->inumber = inumber;
+    entry->parent_generation = parent_generation;
+
+    assert__(pthread_mutex_unlock(&dcache_locks[i % DCACHE_LOCKS]) == 0, "Error: dcache_insert failed to unlock!\n")
+}
@@ -0,0 +1,49 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include "state.h"
+
+/* number of cached entries (a power of two) and of locks protecting them */
+#define DCACHE_SIZE (1 << 16)
+#define DCACHE_LOCKS 256
+
+
+/*
+ * A cached directory entry: the inumber a name resolves to inside a directory. It is only
+ * trusted while the generation of that directory is the same it was when the name was resolved,
+ * so removing or moving an entry only makes the names cached for its own directory stale.
+ */
+typedef struct dcacheEntry {
+    char name[MAX_FILE_NAME];
+    unsigned int hash;  /* hash of the parent and the name */
+    int parent;  /* inumber of the directory that holds the name */
+    int inumber;
+    unsigned int parent_generation;
+} dcacheEntry;
+
+
+/*
+ * A cached full path, so that a path resolved before takes a single probe. On top of the
+ * generation of the directory that holds its last component, it is only trusted while no
+ * directory was moved since it was resolved.
+ */
+typedef struct dcachePath {
+    char path[MAX_FILE_NAME];
+    unsigned int hash;  /* hash of the path */
+    int parent;  /* inumber of the directory that holds the last component */
+    int inumber;
+    unsigned int parent_generation;
+    unsigned int rename_generation;
+} dcachePath;
+
+
+void dcache_init();
+void dcache_destroy();
+unsigned int dcache_rename_generation();
+void dcache_renamed();
+int dcache_lookup(int parent, char *name, unsigned int *parent_generation);
+int dcache_resolve(char *path);
+void dcache_insert(int parent, char *name, int inumber, unsigned int parent_generation);
+
+
+#endif /* DCACHE_H */
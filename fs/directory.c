@@ -0,0 +1,644 @@
+#include <string.h>
+#include <stdlib.h>
+#include "state.h"
+#include "directory.h"
+#include "epoch.h"
+
+
+/*
+ * Hashes an entry name (FNV-1a).
+ */
+unsigned int dir_name_hash(const char *name) {
+    unsigned int hash = 2166136261u;
+    for (; *name != '\0'; name++) {
+        hash ^= (unsigned char) *name;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+/*
+ * Gets the stripe of a name. Uses the high bits of the hash, the low ones pick the bucket.
+ */
+static inline DirStripe *stripe_of(DirTable *dir, unsigned int hash) {
+    return &dir->stripes[hash >> (32 - DIR_STRIPE_BITS)];
+}
+
+
+/*
+ * Gets the chunk that holds a slot.
+ */
+static inline int chunk_of(int slot) {
+    return 31 - __builtin_clz(slot / DIR_INITIAL_SIZE + 1);
+}
+
+
+/*
+ * Gets the index of a stripe.
+ */
+static inline DirIndex *index_of(DirStripe *stripe) {
+    return pstore_ptr(stripe->index);
+}
+
+
+/*
+ * Marks a stripe as being changed. Its index and entries can only be changed after this.
+ */
+static inline void stripe_write_begin(DirStripe *stripe) {
+    __atomic_store_n(&stripe->seq, stripe->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+
+/*
+ * Marks the end of a change to a stripe.
+ */
+static inline void stripe_write_end(DirStripe *stripe) {
+    __atomic_store_n(&stripe->seq, stripe->seq + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Creates an index with every bucket empty.
+ * Returns:
+ *  - pointer to the new index or NULL if there is no memory
+ */
+static DirIndex *index_create(int size) {
+    DirIndex *index = pstore_alloc(sizeof(DirIndex) + sizeof(int) * size);
+    if (index == NULL) return NULL;
+    index->size = size;
+    for (int i = 0; i < size; i++) index->buckets[i] = DIR_BUCKET_EMPTY;
+    return index;
+}
+
+
+/*
+ * Releases an index.
+ */
+static void index_destroy(void *index) {
+    if (index != NULL) pstore_free(index, sizeof(DirIndex) + sizeof(int) * ((DirIndex *) index)->size);
+}
+
+
+/*
+ * Gets an entry slot. The slot must have been taken before.
+ */
+DirEntry *dir_table_slot(DirTable *dir, int slot) {
+    int chunk = chunk_of(slot);
+    return (DirEntry *) pstore_ptr(dir->chunks[chunk]) + slot - DIR_INITIAL_SIZE * ((1 << chunk) - 1);
+}
+
+
+/*
+ * Sets up the locks of a directory table, which are left unlocked.
+ */
+static void init_locks(DirTable *dir) {
+    assert__(pthread_mutex_init(&dir->slot_lock, NULL) == 0, "Error: couldn't init directory lock!\n")
+    for (int i = 0; i < DIR_STRIPES; i++) {
+        assert__(pthread_rwlock_init(&dir->stripes[i].lock, NULL) == 0, "Error: couldn't init directory lock!\n")
+        dir->stripes[i].seq = 0;
+    }
+}
+
+
+/*
+ * Creates an empty directory table.
+ * Returns:
+ *  - pointer to the new table or NULL if there is no memory
+ */
+DirTable *dir_table_create() {
+    DirTable *dir = pstore_calloc(sizeof(DirTable));
+    if (dir == NULL) return NULL;
+
+    init_locks(dir);
+    dir->boot = pstore_boot();
+
+    for (int i = 0; i < DIR_STRIPES; i++) {
+        DirStripe *stripe = &dir->stripes[i];
+        stripe->index = pstore_ref(index_create(DIR_STRIPE_INITIAL_SIZE));
+        if (stripe->index == 0) {
+            dir_table_destroy(dir);
+            return NULL;
+        }
+    }
+
+    return dir;
+}
+
+
+/*
+ * Sizes the index of an empty directory table for a number of entries, so that adding them doesn't
+ * rebuild it over and over. Nobody else may be using the table.
+ * Input:
+ *  - dir: directory table
+ *  - count: number of entries it is about to get
+ * Returns: SUCCESS or FAIL (if there is no memory, and then the index keeps its size)
+ */
+int dir_table_reserve(DirTable *dir, int count) {
+    int size = DIR_STRIPE_INITIAL_SIZE;
+
+    /* names spread evenly across the stripes, with some room for stripes that get more of them */
+    int per_stripe = count / DIR_STRIPES + count / (4 * DIR_STRIPES) + 1;
+    while (3 * size < 4 * (per_stripe + 1)) size *= 2;
+
+    for (int i = 0; i < DIR_STRIPES; i++) {
+        DirStripe *stripe = &dir->stripes[i];
+        if (index_of(stripe)->size >= size) continue;
+
+        DirIndex *index = index_create(size);
+        if (index == NULL) return FAIL;
+        index_destroy(index_of(stripe));
+        stripe->index = pstore_ref(index);
+    }
+    return SUCCESS;
+}
+
+
+/*
+ * Releases the memory of a directory table.
+ */
+void dir_table_destroy(DirTable *dir) {
+    for (int i = 0; i < DIR_MAX_CHUNKS; i++)
+        pstore_free(pstore_ptr(dir->chunks[i]), sizeof(DirEntry) * (DIR_INITIAL_SIZE << i));
+    for (int i = 0; i < DIR_STRIPES; i++) {
+        index_destroy(index_of(&dir->stripes[i]));
+        pthread_rwlock_destroy(&dir->stripes[i].lock);
+    }
+    pstore_free(pstore_ptr(dir->free_slots), sizeof(int) * dir->free_capacity);
+    pthread_mutex_destroy(&dir->slot_lock);
+    pstore_free(dir, sizeof(DirTable));
+}
+
+
+/*
+ * Makes the locks of a directory table usable in this run of the server. A table kept in a
+ * persistent store still has the locks of the run that last used it, so the first thread that
+ * uses it in this run sets them up again while the others wait.
+ */
+void dir_table_attach(DirTable *dir) {
+    unsigned long boot = pstore_boot();
+    unsigned long seen;
+
+    while ((seen = __atomic_load_n(&dir->boot, __ATOMIC_ACQUIRE)) != boot) {
+        if (seen != DIR_ATTACHING &&
+            __atomic_compare_exchange_n(&dir->boot, &seen, DIR_ATTACHING, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            init_locks(dir);
+            __atomic_store_n(&dir->boot, boot, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+
+/*
+ * Locks the stripe of a name. Entries are only changed with the stripe write locked, unless
+ * the caller has the whole directory for itself.
+ * Input:
+ *  - dir: directory table
+ *  - name: name of the entry
+ *  - write: 1 to lock for writing and 0 to lock for reading
+ * Returns: SUCCESS or FAIL
+ */
+int dir_table_lock(DirTable *dir, char *name, int write) {
+    pthread_rwlock_t *lock = &stripe_of(dir, dir_name_hash(name))->lock;
+    if ((write ? pthread_rwlock_wrlock(lock) : pthread_rwlock_rdlock(lock)) != 0) {
+        fprintf(stderr, "Error: failed to lock directory entry!\n");
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
+
+/*
+ * Unlocks the stripe of a name.
+ * Returns: SUCCESS or FAIL
+ */
+int dir_table_unlock(DirTable *dir, char *name) {
+    if (pthread_rwlock_unlock(&stripe_of(dir, dir_name_hash(name))->lock) != 0) {
+        fprintf(stderr, "Error: failed to unlock directory entry!\n");
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
+
+/*
+ * Locks the stripe of the entry in a slot, for reading, so that the entry can be read while other
+ * entries are added and removed. A slot may go to another stripe once it is freed, so the entry is
+ * checked again with the stripe locked. It is unlocked with dir_table_unlock.
+ * Input:
+ *  - dir: directory table
+ *  - slot: slot below dir_table_slots
+ * Returns:
+ *  - the entry, or NULL if the slot is free (then nothing is locked)
+ */
+DirEntry *dir_table_lock_slot(DirTable *dir, int slot) {
+    DirEntry *entry = dir_table_slot(dir, slot);
+
+    /* an entry gets its hash before its inumber (see dir_table_add) */
+    while (__atomic_load_n(&entry->inumber, __ATOMIC_ACQUIRE) != FREE_INODE) {
+        DirStripe *stripe = stripe_of(dir, __atomic_load_n(&entry->hash, __ATOMIC_RELAXED));
+        if (pthread_rwlock_rdlock(&stripe->lock) != 0) {
+            fprintf(stderr, "Error: failed to lock directory entry!\n");
+            return NULL;
+        }
+        if (__atomic_load_n(&entry->inumber, __ATOMIC_ACQUIRE) != FREE_INODE &&
+            stripe_of(dir, __atomic_load_n(&entry->hash, __ATOMIC_RELAXED)) == stripe)
+            return entry;
+        pthread_rwlock_unlock(&stripe->lock);
+    }
+    return NULL;
+}
+
+
+/*
+ * Finds the bucket of a stripe that points to the entry with the given name.
+ * Input:
+ *  - dir: directory table
+ *  - stripe: stripe of the name
+ *  - name: name of the entry
+ *  - hash: hash of the name
+ * Returns:
+ *  - bucket of the entry or FAIL if there is no such entry
+ */
+static int find_bucket(DirTable *dir, DirStripe *stripe, char *name, unsigned int hash) {
+    DirIndex *index = index_of(stripe);
+    unsigned int mask = index->size - 1;
+
+    for (unsigned int i = hash & mask; ; i = (i + 1) & mask) {
+        int slot = index->buckets[i];
+        if (slot == DIR_BUCKET_EMPTY) return FAIL;
+        if (slot != DIR_BUCKET_DELETED) {
+            DirEntry *entry = dir_table_slot(dir, slot);
+            if (entry->hash == hash && strcmp(entry->name, name) == 0) return i;
+        }
+    }
+}
+
+
+/*
+ * Puts a slot in the first bucket that is not being used.
+ * Returns:
+ *  - 1 if the bucket was empty and 0 if it was a deleted one
+ */
+static int insert_bucket(DirIndex *index, unsigned int hash, int slot) {
+    unsigned int mask = index->size - 1;
+    unsigned int i = hash & mask;
+
+    while (index->buckets[i] >= 0) i = (i + 1) & mask;
+    int was_empty = index->buckets[i] == DIR_BUCKET_EMPTY;
+    __atomic_store_n(&index->buckets[i], slot, __ATOMIC_RELAXED);
+    return was_empty;
+}
+
+
+/*
+ * Rebuilds the index of a stripe with enough buckets for its entries, which also drops
+ * deleted buckets. The old index may still be read by lookups that don't lock, so it is
+ * retired instead of freed.
+ * Returns: SUCCESS or FAIL
+ */
+static int rebuild_index(DirTable *dir, DirStripe *stripe) {
+    int size = DIR_STRIPE_INITIAL_SIZE;
+    while (size < 4 * (stripe->count + 1)) size *= 2;
+
+    DirIndex *index = index_create(size);
+    if (index == NULL) return FAIL;
+
+    DirIndex *old = index_of(stripe);
+    for (int i = 0; i < old->size; i++) {
+        int slot = old->buckets[i];
+        if (slot >= 0) insert_bucket(index, dir_table_slot(dir, slot)->hash, slot);
+    }
+
+    __atomic_store_n(&stripe->index, pstore_ref(index), __ATOMIC_RELEASE);
+    stripe->index_fill = stripe->count;
+    epoch_retire(old, index_destroy);
+    return SUCCESS;
+}
+
+
+/*
+ * Marks the memory of a directory table as used while a store is recovered (see pstore_keep), and
+ * drops the chunks that can't be its own. Its indexes and free slots are left out, since they are
+ * rebuilt from its entries (see dir_table_rebuild).
+ * Input:
+ *  - ref: reference to the table
+ * Returns: number of slots whose entries can be read, or FAIL if the reference can't be a table
+ */
+int dir_table_keep(pstoreRef ref) {
+    if (pstore_keep(ref, sizeof(DirTable)) == FAIL) return FAIL;
+
+    DirTable *dir = pstore_ptr(ref);
+    int slots = 0;
+
+    /* chunks are taken in order, so the slots end at the first one that is missing */
+    for (int i = 0; i < DIR_MAX_CHUNKS; i++) {
+        if (dir->chunks[i] != 0 && slots == DIR_INITIAL_SIZE * ((1 << i) - 1) &&
+            pstore_keep(dir->chunks[i], sizeof(DirEntry) * (DIR_INITIAL_SIZE << i)) == SUCCESS)
+            slots += DIR_INITIAL_SIZE << i;
+        else dir->chunks[i] = 0;
+    }
+
+    if (dir->used < 0 || dir->used > slots) dir->used = slots;
+    return dir->used;
+}
+
+
+/*
+ * Rebuilds the indexes and free slots of a directory table from its entries, once the store it
+ * is in is recovered (see dir_table_keep). Its locks are set up for this run. Nobody else may be
+ * using the table.
+ * Returns: SUCCESS or FAIL (if there is no memory)
+ */
+int dir_table_rebuild(DirTable *dir) {
+    int counts[DIR_STRIPES] = {0};
+    int n_free = 0;
+
+    init_locks(dir);
+    dir->boot = pstore_boot();
+
+    for (int slot = 0; slot < dir->used; slot++) {
+        DirEntry *entry = dir_table_slot(dir, slot);
+        if (entry->inumber == FREE_INODE) n_free++;
+        else counts[stripe_of(dir, entry->hash) - dir->stripes]++;
+    }
+
+    dir->count = 0;
+    for (int i = 0; i < DIR_STRIPES; i++) {
+        DirStripe *stripe = &dir->stripes[i];
+        int size = DIR_STRIPE_INITIAL_SIZE;
+        while (size < 4 * (counts[i] + 1)) size *= 2;
+
+        DirIndex *index = index_create(size);
+        if (index == NULL) return FAIL;
+        stripe->index = pstore_ref(index);
+        stripe->index_fill = counts[i];
+        stripe->count = counts[i];
+        dir->count += counts[i];
+    }
+
+    dir->free_slots = 0;
+    dir->n_free = 0;
+    dir->free_capacity = 0;
+    if (n_free > 0) {
+        int capacity = DIR_INITIAL_SIZE;
+        while (capacity < n_free) capacity *= 2;
+
+        int *heap = pstore_alloc(sizeof(int) * capacity);
+        if (heap == NULL) return FAIL;
+        dir->free_slots = pstore_ref(heap);
+        dir->free_capacity = capacity;
+    }
+
+    /* free slots are found in increasing order, which already makes a heap */
+    for (int slot = 0; slot < dir->used; slot++) {
+        DirEntry *entry = dir_table_slot(dir, slot);
+        if (entry->inumber == FREE_INODE) ((int *) pstore_ptr(dir->free_slots))[dir->n_free++] = slot;
+        else insert_bucket(index_of(stripe_of(dir, entry->hash)), entry->hash, slot);
+    }
+    return SUCCESS;
+}
+
+
+/*
+ * Takes the lowest free slot, so that entries are listed in the same order as before.
+ * Returns:
+ *  - slot or FAIL if there is no memory for a new one
+ */
+static int take_slot(DirTable *dir) {
+    int slot = FAIL;
+
+    assert__(pthread_mutex_lock(&dir->slot_lock) == 0, "Error: take_slot failed to lock!\n")
+
+    if (dir->n_free > 0) {
+        int *heap = pstore_ptr(dir->free_slots);
+        int last = heap[--dir->n_free];
+        int i = 0;
+
+        slot = heap[0];
+        /* sifts the last slot down from the top */
+        while (2 * i + 1 < dir->n_free) {
+            int child = 2 * i + 1;
+            if (child + 1 < dir->n_free && heap[child + 1] < heap[child]) child++;
+            if (last <= heap[child]) break;
+            heap[i] = heap[child];
+            i = child;
+        }
+        heap[i] = last;
+    } else {
+        int chunk = chunk_of(dir->used);
+        /* lookups that don't lock may read the chunk as soon as it is published */
+        if (chunk < DIR_MAX_CHUNKS && dir->chunks[chunk] == 0)
+            __atomic_store_n(&dir->chunks[chunk], pstore_ref(pstore_alloc(sizeof(DirEntry) * (DIR_INITIAL_SIZE << chunk))),
+                             __ATOMIC_RELEASE);
+        if (chunk < DIR_MAX_CHUNKS && dir->chunks[chunk] != 0) {
+            /* slots below used are scanned (see dir_table_lock_slot), so the new one starts free */
+            slot = dir->used++;
+            __atomic_store_n(&dir_table_slot(dir, slot)->inumber, FREE_INODE, __ATOMIC_RELAXED);
+        }
+    }
+
+    assert__(pthread_mutex_unlock(&dir->slot_lock) == 0, "Error: take_slot failed to unlock!\n")
+    return slot;
+}
+
+
+/*
+ * Gives a slot back to the free slots heap.
+ */
+static void release_slot(DirTable *dir, int slot) {
+    assert__(pthread_mutex_lock(&dir->slot_lock) == 0, "Error: release_slot failed to lock!\n")
+
+    /* the heap is only allowed to fail to grow if the slot is left unused for good */
+    if (dir->n_free == dir->free_capacity) {
+        int capacity = dir->free_capacity == 0 ? DIR_INITIAL_SIZE : 2 * dir->free_capacity;
+        int *free_slots = pstore_realloc(pstore_ptr(dir->free_slots), sizeof(int) * dir->free_capacity,
+                                         sizeof(int) * capacity);
+        if (free_slots != NULL) {
+            dir->free_slots = pstore_ref(free_slots);
+            dir->free_capacity = capacity;
+        }
+    }
+
+    if (dir->n_free < dir->free_capacity) {
+        int *heap = pstore_ptr(dir->free_slots);
+        int i = dir->n_free++;
+
+        /* sifts the slot up from the bottom */
+        while (i > 0 && heap[(i - 1) / 2] > slot) {
+            heap[i] = heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        heap[i] = slot;
+    }
+
+    assert__(pthread_mutex_unlock(&dir->slot_lock) == 0, "Error: release_slot failed to unlock!\n")
+}
+
+
+/*
+ * Looks for an entry in a directory table. The stripe of the name must be locked.
+ * Input:
+ *  - dir: directory table
+ *  - name: name of the entry
+ * Returns:
+ *  - inumber of the entry or FAIL if not found
+ */
+int dir_table_lookup(DirTable *dir, char *name) {
+    unsigned int hash = dir_name_hash(name);
+    DirStripe *stripe = stripe_of(dir, hash);
+
+    int bucket = find_bucket(dir, stripe, name, hash);
+    if (bucket == FAIL) return FAIL;
+    return dir_table_slot(dir, index_of(stripe)->buckets[bucket])->inumber;
+}
+
+
+/*
+ * Looks for an entry in a directory table without locking the stripe of the name. The result
+ * only holds while the stripe is unchanged, which the caller checks with dir_table_validate.
+ * Must be called inside an epoch (see epoch_enter).
+ * Input:
+ *  - dir: directory table
+ *  - name: name of the entry
+ *  - version: where the version of the stripe that was read is stored
+ * Returns:
+ *  - inumber of the entry, FAIL if not found or DIR_RETRY if the stripe was being changed
+ */
+int dir_table_lookup_optimistic(DirTable *dir, char *name, DirVersion *version) {
+    unsigned int hash = dir_name_hash(name);
+    DirStripe *stripe = stripe_of(dir, hash);
+    int inumber = FAIL;
+
+    unsigned int seq = __atomic_load_n(&stripe->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) return DIR_RETRY;
+
+    DirIndex *index = pstore_ptr(__atomic_load_n(&stripe->index, __ATOMIC_ACQUIRE));
+    unsigned int mask = index->size - 1;
+
+    /* buckets may change under the probe, so it never looks at more than all of them */
+    for (unsigned int i = hash & mask, n = 0; n <= mask; i = (i + 1) & mask, n++) {
+        int slot = __atomic_load_n(&index->buckets[i], __ATOMIC_RELAXED);
+        if (slot == DIR_BUCKET_EMPTY) break;
+        if (slot == DIR_BUCKET_DELETED) continue;
+
+        int chunk = chunk_of(slot);
+        DirEntry *entries = pstore_ptr(__atomic_load_n(&dir->chunks[chunk], __ATOMIC_ACQUIRE));
+        if (entries == NULL) return DIR_RETRY;
+
+        DirEntry *entry = &entries[slot - DIR_INITIAL_SIZE * ((1 << chunk) - 1)];
+        if (__atomic_load_n(&entry->hash, __ATOMIC_RELAXED) == hash &&
+            strncmp(entry->name, name, MAX_FILE_NAME) == 0) {
+            inumber = __atomic_load_n(&entry->inumber, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+
+    version->stripe = stripe;
+    version->seq = seq;
+    return dir_table_validate(version) ? inumber : DIR_RETRY;
+}
+
+
+/*
+ * Checks if a stripe read by dir_table_lookup_optimistic is still unchanged.
+ * Returns: 1 if it is unchanged and 0 otherwise
+ */
+int dir_table_validate(DirVersion *version) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&version->stripe->seq, __ATOMIC_RELAXED) == version->seq;
+}
+
+
+/*
+ * Adds an entry to a directory table. The stripe of the name must be locked for writing.
+ * Input:
+ *  - dir: directory table
+ *  - name: name of the entry
+ *  - inumber: i-number of the entry
+ * Returns: SUCCESS or FAIL (if the name already exists or there is no memory)
+ */
+int dir_table_add(DirTable *dir, char *name, int inumber) {
+    unsigned int hash = dir_name_hash(name);
+    DirStripe *stripe = stripe_of(dir, hash);
+
+    if (find_bucket(dir, stripe, name, hash) != FAIL) return FAIL;
+
+    int slot = take_slot(dir);
+    if (slot == FAIL) return FAIL;
+
+    stripe_write_begin(stripe);
+
+    /* keeps at least a quarter of the buckets empty, so probes stay short */
+    if (4 * (stripe->index_fill + 1) > 3 * index_of(stripe)->size && rebuild_index(dir, stripe) == FAIL) {
+        stripe_write_end(stripe);
+        release_slot(dir, slot);
+        return FAIL;
+    }
+
+    DirEntry *entry = dir_table_slot(dir, slot);
+    strcpy(entry->name, name);
+    __atomic_store_n(&entry->hash, hash, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->inumber, inumber, __ATOMIC_RELEASE);
+
+    stripe->index_fill += insert_bucket(index_of(stripe), hash, slot);
+    stripe->count++;
+
+    stripe_write_end(stripe);
+
+    __atomic_add_fetch(&dir->count, 1, __ATOMIC_RELAXED);
+    return SUCCESS;
+}
+
+
+/*
+ * Removes an entry from a directory table. The stripe of the name must be locked for writing.
+ * Input:
+ *  - dir: directory table
+ *  - name: name of the entry
+ *  - inumber: i-number the entry must have
+ * Returns: SUCCESS or FAIL
+ */
+int dir_table_remove(DirTable *dir, char *name, int inumber) {
+    unsigned int hash = dir_name_hash(name);
+    DirStripe *stripe = stripe_of(dir, hash);
+
+    int bucket = find_bucket(dir, stripe, name, hash);
+    if (bucket == FAIL) return FAIL;
+
+    int slot = index_of(stripe)->buckets[bucket];
+    DirEntry *entry = dir_table_slot(dir, slot);
+    if (entry->inumber != inumber) return FAIL;
+
+    stripe_write_begin(stripe);
+    __atomic_store_n(&index_of(stripe)->buckets[bucket], DIR_BUCKET_DELETED, __ATOMIC_RELAXED);
+    stripe->count--;
+    __atomic_store_n(&entry->inumber, FREE_INODE, __ATOMIC_RELAXED);
+    entry->name[0] = '\0';
+    /* the slot may go to another stripe, so it is only released once this one is stable */
+    stripe_write_end(stripe);
+    release_slot(dir, slot);
+
+    __atomic_sub_fetch(&dir->count, 1, __ATOMIC_RELAXED);
+    return SUCCESS;
+}
+
+
+/*
+ * Gets the number of entries in a directory table.
+ */
+int dir_table_count(DirTable *dir) {
+    return __atomic_load_n(&dir->count, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Gets the number of slots that have been used, free or not, in a directory table.
+ */
+int dir_table_slots(DirTable *dir) {
+    assert__(pthread_mutex_lock(&dir->slot_lock) == 0, "Error: dir_table_slots failed to lock!\n")
+    int used = dir->used;
+    assert__(pthread_mutex_unlock(&dir->slot_lock) == 0, "Error: dir_table_slots failed to unlock!\n")
+    return used;
+}
@@ -0,0 +1,110 @@
+#ifndef DIRECTORY_H
+#define DIRECTORY_H
+
+#include <pthread.h>
+#include "../tecnicofs-api-constants.h"
+#include "pstore.h"
+
+/* number of slots of the first chunk of entries. each chunk has twice the slots of the previous */
+#define DIR_INITIAL_SIZE 8
+#define DIR_MAX_CHUNKS 24
+
+/* the index of a directory is split in stripes, each one with its own lock */
+#define DIR_STRIPE_BITS 3
+#define DIR_STRIPES (1 << DIR_STRIPE_BITS)
+#define DIR_STRIPE_INITIAL_SIZE 4
+
+/* values of an index bucket that doesn't point to an entry */
+#define DIR_BUCKET_EMPTY (-1)
+#define DIR_BUCKET_DELETED (-2)
+
+/* returned by lookups that don't lock when the stripe changed while it was being read */
+#define DIR_RETRY (-3)
+
+/* boot of a directory table whose locks are being set up (see dir_table_attach) */
+#define DIR_ATTACHING 0
+
+
+/*
+ * Contains the name of the entry and respective i-number
+ */
+typedef struct dirEntry {
+	char name[MAX_FILE_NAME];
+	int inumber;
+	unsigned int hash;
+} DirEntry;
+
+/*
+ * Open addressing hash index. It is replaced, never resized, so a reader that doesn't lock
+ * always sees a size that matches its buckets.
+ */
+typedef struct dirIndex {
+    int size;  /* number of buckets, always a power of two */
+    int buckets[];  /* slot of an entry, DIR_BUCKET_EMPTY or DIR_BUCKET_DELETED */
+} DirIndex;
+
+/*
+ * Part of the index of a directory. Names are spread across stripes by hash.
+ */
+typedef struct dirStripe {
+    pthread_rwlock_t lock;
+    unsigned int seq;  /* odd while the stripe is being changed, bumped again when done */
+    pstoreRef index;  /* DirIndex */
+    int index_fill;  /* number of buckets that are not empty */
+    int count;  /* number of entries in this stripe */
+} DirStripe;
+
+/*
+ * Entries of a directory. Entries are kept in slots, in the same order they are listed, and
+ * found by name through an open addressing hash index of those slots.
+ *
+ * Slots live in chunks that never move, so an entry can be read while other stripes grow the
+ * directory. An entry is protected by the lock of its stripe, slot allocation by slot_lock.
+ * Lookups that don't lock check the seq of the stripe instead, and old indexes and deleted
+ * tables are retired through epochs so that those lookups never read freed memory.
+ *
+ * Tables may live in a persistent store, so they reach their memory through references and
+ * their locks are set up again by the first thread that uses them in each run (see boot).
+ */
+typedef struct dirTable {
+    pstoreRef chunks[DIR_MAX_CHUNKS];  /* entry slots, a free slot has inumber FREE_INODE */
+    unsigned long boot;  /* run of the server the locks were set up in (see pstore_boot) */
+    pthread_mutex_t slot_lock;
+    int used;  /* slots below this one have been used at least once */
+    int count;  /* number of entries in the directory */
+    pstoreRef free_slots;  /* min-heap of the free slots below used */
+    int n_free;
+    int free_capacity;
+    DirStripe stripes[DIR_STRIPES];
+} DirTable;
+
+/*
+ * Version of a stripe seen by a lookup that didn't lock it (see dir_table_lookup_optimistic).
+ */
+typedef struct dirVersion {
+    DirStripe *stripe;
+    unsigned int seq;
+} DirVersion;
+
+
+unsigned int dir_name_hash(const char *name);
+DirTable *dir_table_create();
+void dir_table_destroy(DirTable *dir);
+int dir_table_reserve(DirTable *dir, int count);
+int dir_table_keep(pstoreRef ref);
+int dir_table_rebuild(DirTable *dir);
+void dir_table_attach(DirTable *dir);
+int dir_table_lock(DirTable *dir, char *name, int write);
+int dir_table_unlock(DirTable *dir, char *name);
+DirEntry *dir_table_lock_slot(DirTable *dir, int slot);
+int dir_table_lookup(DirTable *dir, char *name);
+int dir_table_lookup_optimistic(DirTable *dir, char *name, DirVersion *version);
+int dir_table_validate(DirVersion *version);
+int dir_table_add(DirTable *dir, char *name, int inumber);
+int dir_table_remove(DirTable *dir, char *name, int inumber);
+int dir_table_count(DirTable *dir);
+int dir_table_slots(DirTable *dir);
+DirEntry *dir_table_slot(DirTable *dir, int slot);
+
+
+#endif /* DIRECTORY_H */
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include "../tecnicofs-api-constants.h"
+#include "epoch.h"
+
+/*
+ * Epoch based reclamation. Readers that don't take locks run inside epoch_enter/epoch_exit,
+ * and memory they may be reading is retired instead of freed. An object retired in epoch e is
+ * only released once the global epoch reaches e + 2, since by then every reader that could
+ * have seen it has left its critical section.
+ *
+ * Changes that a print snapshot must see whole also run inside critical sections, and the
+ * snapshot waits for them with epoch_synchronize (see snapshot.c).
+ */
+
+/* global epoch */
+unsigned long global_epoch = 0;
+
+/* records of every thread that ever used an epoch */
+epochRecord *epoch_records = NULL;
+
+/* record of the calling thread */
+__thread epochRecord *thread_record = NULL;
+
+
+/*
+ * Gets the record of the calling thread, registering it on first use.
+ */
+static epochRecord *current_record() {
+    if (thread_record == NULL) {
+        epochRecord *record = calloc(1, sizeof(epochRecord));
+        assert__(record != NULL, "Error: couldn't allocate an epoch record!\n")
+
+        record->next = __atomic_load_n(&epoch_records, __ATOMIC_RELAXED);
+        while (! __atomic_compare_exchange_n(&epoch_records, &record->next, record, 1,
+                                             __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        thread_record = record;
+    }
+    return thread_record;
+}
+
+
+/*
+ * Enters a critical section.
+ */
+void epoch_enter() {
+    epochRecord *record = current_record();
+    if (record->depth++ > 0) return;
+
+    unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_RELAXED);
+    __atomic_store_n(&record->sections, record->sections + 1, __ATOMIC_RELAXED);
+
+    /* must be visible before anything the thread loads afterwards */
+    __atomic_store_n(&record->state, (epoch << 1) | 1, __ATOMIC_SEQ_CST);
+}
+
+
+/*
+ * Leaves a critical section.
+ */
+void epoch_exit() {
+    if (--thread_record->depth > 0) return;
+    __atomic_store_n(&thread_record->state, 0, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Advances the global epoch if every thread inside a critical section has seen the current one.
+ */
+static void epoch_try_advance() {
+    unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+
+    for (epochRecord *record = __atomic_load_n(&epoch_records, __ATOMIC_ACQUIRE); record != NULL;
+         record = record->next) {
+        unsigned long state = __atomic_load_n(&record->state, __ATOMIC_SEQ_CST);
+        if ((state & 1) && (state >> 1) != epoch) return;
+    }
+    __atomic_compare_exchange_n(&global_epoch, &epoch, epoch + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Waits until every critical section that was running when this was called has finished.
+ * Must not be called inside a critical section.
+ */
+void epoch_synchronize() {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    for (epochRecord *record = __atomic_load_n(&epoch_records, __ATOMIC_ACQUIRE); record != NULL;
+         record = record->next) {
+        if (! (__atomic_load_n(&record->state, __ATOMIC_SEQ_CST) & 1)) continue;
+
+        /* a thread that left and entered again started its section after this was called */
+        unsigned long sections = __atomic_load_n(&record->sections, __ATOMIC_RELAXED);
+        while ((__atomic_load_n(&record->state, __ATOMIC_ACQUIRE) & 1) &&
+               __atomic_load_n(&record->sections, __ATOMIC_RELAXED) == sections)
+            sched_yield();
+    }
+}
+
+
+/*
+ * Releases every object of a limbo list.
+ */
+static void release_list(epochRetired *list) {
+    while (list != NULL) {
+        epochRetired *next = list->next;
+        list->release(list->object);
+        free(list);
+        list = next;
+    }
+}
+
+
+/*
+ * Retires an object that was unlinked from every shared structure. It is released once no
+ * reader can still be using it.
+ * Input:
+ *  - object: object to retire
+ *  - release: function that releases the object
+ */
+void epoch_retire(void *object, void (*release)(void *)) {
+    epochRecord *record = current_record();
+
+    epochRetired *retired = malloc(sizeof(epochRetired));
+    if (retired == NULL) {
+        /* there is no safe way to release it now, so it is leaked */
+        fprintf(stderr, "Error: couldn't retire an object!\n");
+        return;
+    }
+
+    if (++record->retired_count % EPOCH_ADVANCE_PERIOD == 0) epoch_try_advance();
+
+    unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    int i = epoch % 3;
+
+    /* the list of this slot was retired at least three epochs ago, so it can be released */
+    if (record->limbo_epoch[i] != epoch) {
+        release_list(record->limbo[i]);
+        record->limbo[i] = NULL;
+        record->limbo_epoch[i] = epoch;
+    }
+
+    retired->object = object;
+    retired->release = release;
+    retired->next = record->limbo[i];
+    record->limbo[i] = retired;
+}
@@ -0,0 +1,37 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+/* a thread tries to advance the global epoch every time it retires this many objects */
+#define EPOCH_ADVANCE_PERIOD 64
+
+
+/*
+ * Object waiting until no reader can still be using it.
+ */
+typedef struct epochRetired {
+    void *object;
+    void (*release)(void *);
+    struct epochRetired *next;
+} epochRetired;
+
+/*
+ * Per thread epoch state. Records are never freed, threads that exit leave theirs inactive.
+ */
+typedef struct epochRecord {
+    unsigned long state;  /* (epoch << 1) | 1 while inside a critical section, 0 otherwise */
+    unsigned long sections;  /* number of critical sections entered so far */
+    int depth;  /* critical sections can be nested, only the outermost one counts */
+    struct epochRecord *next;
+    epochRetired *limbo[3];  /* objects retired in the last three epochs */
+    unsigned long limbo_epoch[3];
+    int retired_count;
+} epochRecord;
+
+
+void epoch_enter();
+void epoch_exit();
+void epoch_retire(void *object, void (*release)(void *));
+void epoch_synchronize();
+
+
+#endif /* EPOCH_H */
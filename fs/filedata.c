@@ -0,0 +1,390 @@
+#include <string.h>
+#include <stdlib.h>
+#include "state.h"
+#include "filedata.h"
+
+
+/* chunks blocks were taken from */
+fileBlockChunk *block_chunks = NULL;
+
+/* protects the free blocks shared by all threads (a root of the store, each block holding a
+ * reference to the next) and block_chunks */
+pthread_mutex_t blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* each thread keeps a few free blocks for itself, like it does with inodes (see state.c) */
+__thread blockMagazine block_magazine;
+
+/* magazines of the threads that have used theirs, protected by blocks_lock */
+blockMagazine *block_magazines = NULL;
+
+/* empties the magazine of a thread that exits (see block_magazine_exit) */
+pthread_key_t block_magazine_key;
+pthread_once_t block_magazine_key_once = PTHREAD_ONCE_INIT;
+
+
+/*
+ * Puts a block in the free blocks shared by all threads. blocks_lock must be held.
+ */
+static inline void block_push(char *block) {
+    pstoreRef *free_blocks = pstore_root(PSTORE_ROOT_BLOCKS);
+    *(pstoreRef *) block = *free_blocks;
+    *free_blocks = pstore_ref(block);
+}
+
+
+/*
+ * Takes a magazine out of the list. blocks_lock must be held.
+ */
+static void block_magazine_unlist(blockMagazine *mag) {
+    if (mag->prev != NULL) mag->prev->next = mag->next;
+    else block_magazines = mag->next;
+    if (mag->next != NULL) mag->next->prev = mag->prev;
+    mag->listed = 0;
+}
+
+
+/*
+ * Gives the free blocks of a thread that exits back to the shared ones, so that they are not lost.
+ * Input:
+ *  - ptr: magazine of the thread
+ */
+static void block_magazine_exit(void *ptr) {
+    blockMagazine *mag = ptr;
+
+    assert__(pthread_mutex_lock(&blocks_lock) == 0, "Error: block_magazine_exit failed to lock!\n")
+    /* destroying the blocks already took it out */
+    if (mag->listed) {
+        while (mag->count > 0) block_push(mag->blocks[--mag->count]);
+        block_magazine_unlist(mag);
+    }
+    assert__(pthread_mutex_unlock(&blocks_lock) == 0, "Error: block_magazine_exit failed to unlock!\n")
+}
+
+
+/*
+ * Creates the key that calls block_magazine_exit, once.
+ */
+static void block_magazine_key_create() {
+    assert__(pthread_key_create(&block_magazine_key, block_magazine_exit) == 0,
+             "Error: couldn't create the block magazine key!\n")
+}
+
+
+/*
+ * Lists the calling thread's magazine, the first time it is used after the blocks were destroyed.
+ */
+static inline void block_magazine_list() {
+    if (block_magazine.listed) return;
+
+    pthread_once(&block_magazine_key_once, block_magazine_key_create);
+    pthread_setspecific(block_magazine_key, &block_magazine);
+
+    assert__(pthread_mutex_lock(&blocks_lock) == 0, "Error: block_magazine_list failed to lock!\n")
+    block_magazine.prev = NULL;
+    block_magazine.next = block_magazines;
+    if (block_magazines != NULL) block_magazines->prev = &block_magazine;
+    block_magazines = &block_magazine;
+    block_magazine.listed = 1;
+    assert__(pthread_mutex_unlock(&blocks_lock) == 0, "Error: block_magazine_list failed to unlock!\n")
+}
+
+
+/*
+ * Refills the calling thread's magazine of blocks, from the shared free blocks or from a new chunk.
+ * Returns: SUCCESS or FAIL (if there is no memory left)
+ */
+static int block_refill() {
+    pstoreRef *free_blocks = pstore_root(PSTORE_ROOT_BLOCKS);
+
+    assert__(pthread_mutex_lock(&blocks_lock) == 0, "Error: block_refill failed to lock!\n")
+
+    while (*free_blocks != 0 && block_magazine.count < FILE_BLOCK_BATCH) {
+        char *block = pstore_ptr(*free_blocks);
+        block_magazine.blocks[block_magazine.count++] = block;
+        *free_blocks = *(pstoreRef *) block;
+    }
+
+    if (block_magazine.count == 0) {
+        fileBlockChunk *chunk = pstore_persistent() ? NULL : malloc(sizeof(fileBlockChunk));
+        char *blocks = NULL;
+
+        if ((chunk == NULL && ! pstore_persistent()) ||
+            (blocks = pstore_alloc((size_t) FILE_BLOCK_SIZE * FILE_BLOCK_CHUNK)) == NULL) {
+            free(chunk);
+            assert__(pthread_mutex_unlock(&blocks_lock) == 0, "Error: block_refill failed to unlock!\n")
+            return FAIL;
+        }
+        if (chunk != NULL) {
+            chunk->blocks = blocks;
+            chunk->next = block_chunks;
+            block_chunks = chunk;
+        }
+
+        /* the first batch goes to the calling thread and the others are shared */
+        for (int i = 0; i < FILE_BLOCK_BATCH; i++)
+            block_magazine.blocks[block_magazine.count++] = blocks + (size_t) i * FILE_BLOCK_SIZE;
+        for (int i = FILE_BLOCK_BATCH; i < FILE_BLOCK_CHUNK; i++)
+            block_push(blocks + (size_t) i * FILE_BLOCK_SIZE);
+    }
+
+    assert__(pthread_mutex_unlock(&blocks_lock) == 0, "Error: block_refill failed to unlock!\n")
+    return SUCCESS;
+}
+
+
+/*
+ * Takes a free block, filled with zeros.
+ * Returns: the block or NULL (if there is no memory left)
+ */
+static char *block_alloc() {
+    block_magazine_list();
+    if (block_magazine.count == 0 && block_refill() == FAIL) return NULL;
+
+    char *block = block_magazine.blocks[--block_magazine.count];
+    memset(block, 0, FILE_BLOCK_SIZE);
+    return block;
+}
+
+
+/*
+ * Puts a block back in the calling thread's magazine. When the magazine is full, half of it goes
+ * to the shared free blocks.
+ * Input:
+ *  - block: block that is no longer used
+ */
+static void block_free(char *block) {
+    block_magazine_list();
+    if (block_magazine.count == 2 * FILE_BLOCK_BATCH) {
+        assert__(pthread_mutex_lock(&blocks_lock) == 0, "Error: block_free failed to lock!\n")
+        for (int i = FILE_BLOCK_BATCH; i < 2 * FILE_BLOCK_BATCH; i++) block_push(block_magazine.blocks[i]);
+        assert__(pthread_mutex_unlock(&blocks_lock) == 0, "Error: block_free failed to unlock!\n")
+        block_magazine.count = FILE_BLOCK_BATCH;
+    }
+    block_magazine.blocks[block_magazine.count++] = block;
+}
+
+
+/*
+ * Gives every block back to the system, or leaves them in the store with the blocks every thread
+ * kept for itself. No file can be used after this.
+ */
+void file_blocks_destroy() {
+    assert__(pthread_mutex_lock(&blocks_lock) == 0, "Error: file_blocks_destroy failed to lock!\n")
+    while (block_magazines != NULL) {
+        blockMagazine *mag = block_magazines;
+        while (mag->count > 0) {
+            char *block = mag->blocks[--mag->count];
+            if (pstore_persistent()) block_push(block);
+        }
+        block_magazine_unlist(mag);
+    }
+    assert__(pthread_mutex_unlock(&blocks_lock) == 0, "Error: file_blocks_destroy failed to unlock!\n")
+
+    while (block_chunks != NULL) {
+        fileBlockChunk *chunk = block_chunks;
+        block_chunks = chunk->next;
+        pstore_free(chunk->blocks, (size_t) FILE_BLOCK_SIZE * FILE_BLOCK_CHUNK);
+        free(chunk);
+    }
+    block_magazine.count = 0;
+}
+
+
+/*
+ * Creates the contents of an empty file.
+ * Returns: the contents or NULL (if there is no memory left)
+ */
+FileData *file_data_create() {
+    FileData *file = pstore_alloc(sizeof(FileData));
+    if (file == NULL) return NULL;
+
+    file->size = 0;
+    file->map = 0;
+    return file;
+}
+
+
+/*
+ * Gets a data block of a file.
+ * Input:
+ *  - file: contents of the file
+ *  - n: number of the block in the file
+ *  - create: if set, the block (and the map blocks on the way to it) are created if they are holes
+ * Returns: the block or NULL (if it is a hole or there is no memory left)
+ */
+static char *file_block(FileData *file, size_t n, int create) {
+    size_t i = n / FILE_MAP_ENTRIES, j = n % FILE_MAP_ENTRIES;
+    pstoreRef *map, *blocks;
+
+    if (file->map == 0 && (! create || (file->map = pstore_ref(block_alloc())) == 0)) return NULL;
+    map = pstore_ptr(file->map);
+    if (map[i] == 0 && (! create || (map[i] = pstore_ref(block_alloc())) == 0)) return NULL;
+    blocks = pstore_ptr(map[i]);
+    if (blocks[j] == 0 && create) blocks[j] = pstore_ref(block_alloc());
+
+    return pstore_ptr(blocks[j]);
+}
+
+
+/*
+ * Frees the data blocks of a file from a given block on, and the map blocks left without any.
+ * Input:
+ *  - file: contents of the file
+ *  - first: number of the first block that is freed
+ */
+static void file_free_blocks(FileData *file, size_t first) {
+    pstoreRef *map = pstore_ptr(file->map);
+
+    if (map == NULL) return;
+
+    for (size_t i = first / FILE_MAP_ENTRIES; i < FILE_MAP_ENTRIES; i++) {
+        pstoreRef *blocks = pstore_ptr(map[i]);
+        if (blocks == NULL) continue;
+
+        for (size_t j = i == first / FILE_MAP_ENTRIES ? first % FILE_MAP_ENTRIES : 0; j < FILE_MAP_ENTRIES; j++) {
+            if (blocks[j] != 0) block_free(pstore_ptr(blocks[j]));
+            blocks[j] = 0;
+        }
+        if (i * FILE_MAP_ENTRIES >= first) {
+            block_free((char *) blocks);
+            map[i] = 0;
+        }
+    }
+
+    if (first == 0) {
+        block_free((char *) map);
+        file->map = 0;
+    }
+}
+
+
+/*
+ * Releases the contents of a file.
+ * Input:
+ *  - file: contents of the file, or NULL
+ */
+void file_data_destroy(FileData *file) {
+    if (file == NULL) return;
+    file_free_blocks(file, 0);
+    pstore_free(file, sizeof(FileData));
+}
+
+
+/*
+ * Marks the memory of the contents of a file as used while a store is recovered (see pstore_keep),
+ * dropping the blocks that can't be its own, which are read as holes from then on.
+ * Input:
+ *  - ref: reference to the contents
+ * Returns: SUCCESS or FAIL (if the reference can't be the contents of a file)
+ */
+int file_data_keep(pstoreRef ref) {
+    if (pstore_keep(ref, sizeof(FileData)) == FAIL) return FAIL;
+
+    FileData *file = pstore_ptr(ref);
+    if (file->size > FILE_MAX_SIZE) file->size = FILE_MAX_SIZE;
+    if (file->map != 0 && pstore_keep(file->map, FILE_BLOCK_SIZE) == FAIL) file->map = 0;
+
+    pstoreRef *map = pstore_ptr(file->map);
+    for (size_t i = 0; map != NULL && i < FILE_MAP_ENTRIES; i++) {
+        if (map[i] != 0 && pstore_keep(map[i], FILE_BLOCK_SIZE) == FAIL) map[i] = 0;
+
+        pstoreRef *blocks = pstore_ptr(map[i]);
+        for (size_t j = 0; blocks != NULL && j < FILE_MAP_ENTRIES; j++)
+            if (blocks[j] != 0 && pstore_keep(blocks[j], FILE_BLOCK_SIZE) == FAIL) blocks[j] = 0;
+    }
+    return SUCCESS;
+}
+
+
+/*
+ * Forgets the free blocks of a store being recovered. They go back to the store along with the
+ * rest of the memory that no file uses (see pstore_recover).
+ */
+void file_blocks_forget() {
+    *pstore_root(PSTORE_ROOT_BLOCKS) = 0;
+}
+
+
+/*
+ * Writes to a file, growing it if the write goes past its end. Bytes between the old end and the
+ * offset are read as zeros.
+ * Input:
+ *  - file: contents of the file
+ *  - offset: where the write starts
+ *  - buffer: bytes that are written
+ *  - len: number of bytes
+ * Returns: number of bytes written or FAIL (if the file would be too large or there is no memory left)
+ */
+long file_data_write(FileData *file, size_t offset, const char *buffer, size_t len) {
+    size_t written = 0;
+
+    if (offset > FILE_MAX_SIZE || len > FILE_MAX_SIZE - offset) return FAIL;
+
+    while (written < len) {
+        size_t position = offset + written;
+        size_t in_block = position % FILE_BLOCK_SIZE;
+        size_t count = FILE_BLOCK_SIZE - in_block < len - written ? FILE_BLOCK_SIZE - in_block : len - written;
+
+        char *block = file_block(file, position / FILE_BLOCK_SIZE, 1);
+        if (block == NULL) break;
+
+        memcpy(block + in_block, buffer + written, count);
+        written += count;
+    }
+
+    if (written > 0 && offset + written > file->size) file->size = offset + written;
+    return written > 0 || len == 0 ? (long) written : FAIL;
+}
+
+
+/*
+ * Reads from a file.
+ * Input:
+ *  - file: contents of the file
+ *  - offset: where the read starts
+ *  - buffer: where the bytes are copied to
+ *  - len: maximum number of bytes
+ * Returns: number of bytes read, 0 if the offset is at or past the end of the file
+ */
+long file_data_read(FileData *file, size_t offset, char *buffer, size_t len) {
+    size_t done = 0;
+
+    if (offset >= file->size) return 0;
+    if (len > file->size - offset) len = file->size - offset;
+
+    while (done < len) {
+        size_t position = offset + done;
+        size_t in_block = position % FILE_BLOCK_SIZE;
+        size_t count = FILE_BLOCK_SIZE - in_block < len - done ? FILE_BLOCK_SIZE - in_block : len - done;
+
+        char *block = file_block(file, position / FILE_BLOCK_SIZE, 0);
+        if (block != NULL) memcpy(buffer + done, block + in_block, count);
+        else memset(buffer + done, 0, count);
+        done += count;
+    }
+
+    return done;
+}
+
+
+/*
+ * Changes the size of a file. Bytes past the old end are read as zeros.
+ * Input:
+ *  - file: contents of the file
+ *  - size: new size
+ * Returns: SUCCESS or FAIL (if the size is too large)
+ */
+int file_data_truncate(FileData *file, size_t size) {
+    if (size > FILE_MAX_SIZE) return FAIL;
+
+    if (size < file->size) {
+        /* the end of the last block is cleared, since the file may grow again */
+        char *block = size % FILE_BLOCK_SIZE != 0 ? file_block(file, size / FILE_BLOCK_SIZE, 0) : NULL;
+        if (block != NULL) memset(block + size % FILE_BLOCK_SIZE, 0, FILE_BLOCK_SIZE - size % FILE_BLOCK_SIZE);
+
+        file_free_blocks(file, (size + FILE_BLOCK_SIZE - 1) / FILE_BLOCK_SIZE);
+    }
+
+    file->size = size;
+    return SUCCESS;
+}
@@ -0,0 +1,65 @@
+#ifndef FILEDATA_H
+#define FILEDATA_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include "../tecnicofs-api-constants.h"
+#include "pstore.h"
+
+/* contents of files are kept in blocks of this size */
+#define FILE_BLOCK_SIZE 4096
+
+/* block references that fit in a block, the fan out of each level of a block map */
+#define FILE_MAP_ENTRIES (FILE_BLOCK_SIZE / sizeof(pstoreRef))
+
+/* a file maps at most FILE_MAP_ENTRIES blocks of FILE_MAP_ENTRIES blocks (1 GiB) */
+#define FILE_MAX_SIZE ((size_t) FILE_MAP_ENTRIES * FILE_MAP_ENTRIES * FILE_BLOCK_SIZE)
+
+/* free blocks move between threads in batches of this size */
+#define FILE_BLOCK_BATCH 32
+
+/* blocks are taken from the system this many at a time */
+#define FILE_BLOCK_CHUNK 256
+
+
+/*
+ * Contents of a file. The map is a block of references to blocks of references to data blocks,
+ * so writing at any offset only touches the blocks it covers. Blocks that were never written are
+ * holes, read as zeros.
+ */
+typedef struct FileData {
+	uint64_t size;
+	pstoreRef map;  /* 0 until something is written */
+} FileData;
+
+/*
+ * Blocks taken from the system together, kept until the file system is destroyed. Blocks taken
+ * from a store stay in it and aren't listed.
+ */
+typedef struct fileBlockChunk {
+	char *blocks;
+	struct fileBlockChunk *next;
+} fileBlockChunk;
+
+/*
+ * Free blocks a thread keeps for itself, listed like the free inodes are (see inodeMagazine).
+ */
+typedef struct blockMagazine {
+	char *blocks[2 * FILE_BLOCK_BATCH];
+	int count;
+	int listed;
+	struct blockMagazine *prev, *next;
+} blockMagazine;
+
+
+void file_blocks_destroy();
+FileData *file_data_create();
+void file_data_destroy(FileData *file);
+int file_data_keep(pstoreRef ref);
+void file_blocks_forget();
+long file_data_write(FileData *file, size_t offset, const char *buffer, size_t len);
+long file_data_read(FileData *file, size_t offset, char *buffer, size_t len);
+int file_data_truncate(FileData *file, size_t size);
+
+
+#endif /* FILEDATA_H */
@@ -1,7 +1,13 @@
 #include "operations.h"
+#include "epoch.h"
+#include "snapshot.h"
+#include "wal.h"
+#include "checkpoint.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 
 /* Given a path, fills pointers with strings for the parent path and child
@@ -62,26 +68,53 @@ int check_if_node_is_in_array(int inumber, const int *arr, int size) {
 
 
 /*
- * Initializes tecnicofs and creates root node.
+ * Initializes tecnicofs and creates root node, or takes the tree left in a persistent store, and
+ * loads the last checkpoint and replays the log after it.
+ * Input:
+ *  - store_path: path of the store file, or NULL to keep everything in memory
+ *  - log_path: path of the log file, or NULL to not log changes
  */
-void init_fs() {
-    inode_table_init();
+void init_fs(char *store_path, char *log_path) {
+    if (store_path != NULL && pstore_open(store_path) == FAIL) {
+        printf("failed to open tecnicofs store %s\n", store_path);
+        exit(EXIT_FAILURE);
+    }
 
-    /* create root inode */
-    int root = inode_create(T_DIRECTORY);
+    int restored = inode_table_init();
+    dcache_init();
+    snapshot_init();
 
-    if (root != FS_ROOT) {
+    /* a store that was used before already has its root */
+    if (! restored && inode_create(T_DIRECTORY) != FS_ROOT) {
         printf("failed to create node for tecnicofs root\n");
         exit(EXIT_FAILURE);
     }
+
+    if (log_path == NULL) return;
+
+    uint64_t log_id, log_offset;
+    if (checkpoint_load(log_path, &log_id, &log_offset) == FAIL) {
+        printf("failed to load the checkpoint of tecnicofs log %s\n", log_path);
+        exit(EXIT_FAILURE);
+    }
+    if (wal_open(log_path, log_id, log_offset) == FAIL) {
+        printf("failed to open tecnicofs log %s\n", log_path);
+        exit(EXIT_FAILURE);
+    }
 }
 
 
 /*
- * Destroy tecnicofs and inode table.
+ * Destroy tecnicofs and inode table. A persistent store is written back and closed, keeping the
+ * tree for the next time the server runs, and so is the log, after a last checkpoint.
  */
 void destroy_fs() {
+    checkpoint_close();
+    wal_close();
+    snapshot_destroy();
+    dcache_destroy();
     inode_table_destroy();
+    pstore_close();
 }
 
 
@@ -92,41 +125,14 @@ void destroy_fs() {
  * Returns: SUCCESS or FAIL
  */
 
-int is_dir_empty(DirEntry *dirEntries) {
-    if (dirEntries == NULL) {
+int is_dir_empty(DirTable *dirEntries) {
+    if (dirEntries == NULL || dir_table_count(dirEntries) != 0) {
         return FAIL;
     }
-    for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (dirEntries[i].inumber != FREE_INODE) {
-            return FAIL;
-        }
-    }
     return SUCCESS;
 }
 
 
-/*
- * Looks for node in directory entry from name.
- * Input:
- *  - name: path of node
- *  - entries: entries of directory
- * Returns:
- *  - inumber: found node's inumber
- *  - FAIL: if not found
- */
-int lookup_sub_node(char *name, DirEntry *entries) {
-    if (entries == NULL) {
-        return FAIL;
-    }
-    for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (entries[i].inumber != FREE_INODE && strcmp(entries[i].name, name) == 0) {
-            return entries[i].inumber;
-        }
-    }
-    return FAIL;
-}
-
-
 /*
  * Creates a new node given a path.
  * Input:
@@ -149,8 +155,9 @@ int create(char *name, type nodeType){
     strcpy(name_copy, name);
     split_parent_child_from_path(name_copy, &parent_name, &child_name);
 
-    /* gets parent directory's inode number (locks all the used inodes) */
-    parent_inumber = traverse_path(parent_name, locked_inumbers, &amount, 0);
+    /* gets parent directory's inode number (only the parent stays locked). the parent is only
+     * read locked, the entry itself is locked below */
+    parent_inumber = traverse_path(parent_name, locked_inumbers, &amount, TRAVERSE_READ | TRAVERSE_COUPLED);
 
     if (parent_inumber == FAIL) {
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
@@ -167,7 +174,12 @@ int create(char *name, type nodeType){
         return FAIL;
     }
 
-    if (lookup_sub_node(child_name, pdata.dirEntries) != FAIL) {
+    /* locks (write) the entry that will be created, so that other names can be created and
+     * deleted in the same directory at the same time */
+    assert__(dir_table_lock(pdata.dirEntries, child_name, 1) == SUCCESS, "Error: create failed to lock an entry!\n")
+
+    if (dir_table_lookup(pdata.dirEntries, child_name) != FAIL) {
+        dir_table_unlock(pdata.dirEntries, child_name);
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("failed to create %s, already exists in dir %s\n", child_name, parent_name);
         return FAIL;
@@ -176,17 +188,30 @@ int create(char *name, type nodeType){
     /* create node and add entry to folder that contains new node */
     child_inumber = inode_create(nodeType);
     if (child_inumber == FAIL) {
+        dir_table_unlock(pdata.dirEntries, child_name);
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("failed to create %s in  %s, couldn't allocate inode\n", child_name, parent_name);
         return FAIL;
     }
 
+    /* a checkpoint must have the entry if and only if it has its record (see checkpoint.c) */
+    snapshot_change_begin();
+
     if (dir_add_entry(parent_inumber, child_inumber, child_name) == FAIL) {
+        snapshot_change_end();
+        /* nobody else knows about the new inode, so it can be given back right away */
+        lock_write(child_inumber);
+        inode_delete(child_inumber);
+        dir_table_unlock(pdata.dirEntries, child_name);
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("could not add entry %s in dir %s\n", child_name, parent_name);
         return FAIL;
     }
 
+    wal_log(WAL_CREATE, name, NULL, nodeType);
+    snapshot_change_end();
+
+    dir_table_unlock(pdata.dirEntries, child_name);
     unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
 
     return SUCCESS;
@@ -214,8 +239,9 @@ int delete(char *name){
     strcpy(name_copy, name);
     split_parent_child_from_path(name_copy, &parent_name, &child_name);
 
-    /* gets parent directory's inode number (locks all the used inodes) */
-    parent_inumber = traverse_path(parent_name, locked_inumbers, &amount, 0);
+    /* gets parent directory's inode number (only the parent stays locked). the parent is only
+     * read locked, the entry itself is locked below */
+    parent_inumber = traverse_path(parent_name, locked_inumbers, &amount, TRAVERSE_READ | TRAVERSE_COUPLED);
 
     if (parent_inumber == FAIL) {
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
@@ -231,9 +257,13 @@ int delete(char *name){
         return FAIL;
     }
 
-    child_inumber = lookup_sub_node(child_name, pdata.dirEntries);
+    /* locks (write) the entry that will be deleted */
+    assert__(dir_table_lock(pdata.dirEntries, child_name, 1) == SUCCESS, "Error: delete failed to lock an entry!\n")
+
+    child_inumber = dir_table_lookup(pdata.dirEntries, child_name);
 
     if (child_inumber == FAIL) {
+        dir_table_unlock(pdata.dirEntries, child_name);
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("could not delete %s, does not exist in dir %s\n", name, parent_name);
         return FAIL;
@@ -246,30 +276,105 @@ int delete(char *name){
     inode_get(child_inumber, &cType, &cdata);
 
     if (cType == T_DIRECTORY && is_dir_empty(cdata.dirEntries) == FAIL) {
+        dir_table_unlock(pdata.dirEntries, child_name);
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("could not delete %s: is a directory and not empty\n", name);
         return FAIL;
     }
 
+    /* a checkpoint must have the entry removed if and only if it has its record (see checkpoint.c) */
+    snapshot_change_begin();
+
     /* remove entry from folder that contained deleted node */
-    if (dir_reset_entry(parent_inumber, child_inumber) == FAIL) {
+    if (dir_reset_entry(parent_inumber, child_inumber, child_name) == FAIL) {
+        snapshot_change_end();
+        dir_table_unlock(pdata.dirEntries, child_name);
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("failed to delete %s from dir %s\n", child_name, parent_name);
         return FAIL;
     }
 
+    wal_log(WAL_DELETE, name, NULL, T_NONE);
+    snapshot_change_end();
+
     if (inode_delete(child_inumber) == FAIL) {
+        dir_table_unlock(pdata.dirEntries, child_name);
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("could not delete inode number %d from dir %s\n", child_inumber, parent_name);
         return FAIL;
     }
 
+    /* inode_delete already unlocked the child, which may now be reused by another thread */
+    amount--;
+
+    dir_table_unlock(pdata.dirEntries, child_name);
     unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
 
     return SUCCESS;
 }
 
 
+/*
+ * Lookup for a given path without locking anything. Every entry on the way is checked again at
+ * the end, so the result is what the path resolved to at that moment.
+ * Input:
+ *  - name: path of node
+ *  - inumber: where the identifier of the i-node (or FAIL, if not found) is stored
+ * Returns: SUCCESS or FAIL (if the path changed meanwhile)
+ */
+static int lookup_optimistic(char *name, int *inumber) {
+
+    char full_path[MAX_FILE_NAME];
+    char delim[] = "/";
+    int current_inumber = FS_ROOT;
+    int res = SUCCESS;
+
+    /* versions of the entries read so far */
+    DirVersion versions[MAX_PATH_INODE_LENGTH];
+    int depth = 0;
+
+    /* use for copy and to store data */
+    type nType;
+    union Data data;
+
+    /* used to make strtok_r thread safe */
+    char *save_ptr;
+
+    strcpy(full_path, name);
+
+    /* tables that are deleted meanwhile are only freed after this thread leaves the epoch */
+    epoch_enter();
+
+    for (char *path = strtok_r(full_path, delim, &save_ptr); path != NULL;
+         path = strtok_r(NULL, delim, &save_ptr)) {
+        if (inode_get_optimistic(current_inumber, &nType, &data) == FAIL || depth == MAX_PATH_INODE_LENGTH) {
+            res = FAIL;
+            break;
+        }
+        if (nType != T_DIRECTORY) {
+            current_inumber = FAIL;
+            break;
+        }
+
+        current_inumber = dir_table_lookup_optimistic(data.dirEntries, path, &versions[depth]);
+        if (current_inumber == DIR_RETRY) {
+            res = FAIL;
+            break;
+        }
+        depth++;
+        if (current_inumber == FAIL) break;
+    }
+
+    for (int i = 0; res == SUCCESS && i < depth; i++)
+        if (! dir_table_validate(&versions[i])) res = FAIL;
+
+    epoch_exit();
+
+    *inumber = current_inumber;
+    return res;
+}
+
+
 /*
  * Lookup for a given path.
  * Input:
@@ -283,9 +388,14 @@ int lookup(char *name) {
     /* holds all the inode id's locked while doing this operation */
     int locked_inumbers[MAX_PATH_INODE_LENGTH];
     int amount = 0;
+    int res;
+
+    /* only locks the path if it keeps changing while it is read */
+    for (int i = 0; i < LOOKUP_RETRIES; i++)
+        if (lookup_optimistic(name, &res) == SUCCESS) return res;
 
-    /* traverses path and lock all the used inodes */
-    int res = traverse_path(name, locked_inumbers, &amount, 1);
+    /* traverses path, only the node it leads to stays locked */
+    res = traverse_path(name, locked_inumbers, &amount, TRAVERSE_READ | TRAVERSE_COUPLED);
 
     /* unlocks all the used nodes */
     unlock_inodes(locked_inumbers, amount);
@@ -343,13 +453,14 @@ int move(char* from, char* to) {
      * create a deadlock since we would try to lock for writing when there was already a
      * read lock in place. if they have the same number of nodes, the order won't matter because
      * only two cases can happen: either both parent dirs are the same (we use a trylock to fix
-     * this) or they are different and if so, it won't interfere with the process */
+     * this) or they are different and if so, it won't interfere with the process. ancestors stay
+     * locked (no TRAVERSE_COUPLED), otherwise two moves could each put a dir inside the other */
     if (strcmp(parent_from, parent_to) > 0) {
-        parent_to_inumber = traverse_path(parent_to, locked_inumbers, &amount, 0);
-        parent_from_inumber = traverse_path(parent_from, locked_inumbers, &amount, 0);
+        parent_to_inumber = traverse_path(parent_to, locked_inumbers, &amount, TRAVERSE_WRITE);
+        parent_from_inumber = traverse_path(parent_from, locked_inumbers, &amount, TRAVERSE_WRITE);
     } else {
-        parent_from_inumber = traverse_path(parent_from, locked_inumbers, &amount, 0);
-        parent_to_inumber = traverse_path(parent_to, locked_inumbers, &amount, 0);
+        parent_from_inumber = traverse_path(parent_from, locked_inumbers, &amount, TRAVERSE_WRITE);
+        parent_to_inumber = traverse_path(parent_to, locked_inumbers, &amount, TRAVERSE_WRITE);
     }
 
     /* if we couldn't find it, returns an error */
@@ -380,12 +491,9 @@ int move(char* from, char* to) {
         return FAIL;
     }
 
-    /* tries to get child inumber. it can be 'FAIL' if not found */
-    child_from_inumber = lookup_sub_node(child_from, pdata_from.dirEntries);
-
-    /* locks (write) the directory/file that will be moved */
-    assert__(lock_write(child_from_inumber) == SUCCESS, "Error: move failed to lock an inode!\n")
-    locked_inumbers[amount++] = child_from_inumber;
+    /* tries to get child inumber. it can be 'FAIL' if not found. both parents are write locked,
+     * so their entries don't need to be locked */
+    child_from_inumber = dir_table_lookup(pdata_from.dirEntries, child_from);
 
     /* if we couldn't find the node that is going to be moves, we show an error */
     if (child_from_inumber == FAIL) {
@@ -394,11 +502,15 @@ int move(char* from, char* to) {
         return FAIL;
     }
 
+    /* locks (write) the directory/file that will be moved */
+    assert__(lock_write(child_from_inumber) == SUCCESS, "Error: move failed to lock an inode!\n")
+    locked_inumbers[amount++] = child_from_inumber;
+
     /* since we already have the child's inumber, we can get it's information */
     inode_get(child_from_inumber, &cType_from, &cdata_from);
 
     /* checks if there is already a node with this child name in this directory */
-    child_to_inumber = lookup_sub_node(child_to, pdata_to.dirEntries);
+    child_to_inumber = dir_table_lookup(pdata_to.dirEntries, child_to);
 
     /* if we found a node with this name, we throw an error */
     if (child_to_inumber != FAIL) {
@@ -407,21 +519,33 @@ int move(char* from, char* to) {
         return FAIL;
     }
 
+    /* a print must see the node in one of the directories, so it can't start in between, and a
+     * checkpoint must have the move if and only if it has its record */
+    snapshot_change_begin();
+
     /* remove entry from folder that contained moved node */
-    if (dir_reset_entry(parent_from_inumber, child_from_inumber) == FAIL) {
+    if (dir_reset_entry(parent_from_inumber, child_from_inumber, child_from) == FAIL) {
+        snapshot_change_end();
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("failed to move %s from dir %s\n", child_from, parent_from);
         return FAIL;
     }
 
+    /* paths being resolved through the cache may have seen the directory in both places */
+    if (cType_from == T_DIRECTORY) dcache_renamed();
+
     /* adds removed node to the destiny directory */
     if (dir_add_entry(parent_to_inumber, child_from_inumber, child_to) == FAIL) {
         dir_add_entry(parent_from_inumber, child_from_inumber, child_from);  /* if an error occurred, we have to add back the removed directory */
+        snapshot_change_end();
         unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
         printf("could not move entry %s in dir %s\n", child_from, parent_to);
         return FAIL;
     }
 
+    wal_log(WAL_MOVE, from, to, T_NONE);
+    snapshot_change_end();
+
     unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
 
     return SUCCESS;
@@ -429,25 +553,106 @@ int move(char* from, char* to) {
 
 
 /*
- * Lookup for a given path. Does not unlock traveled inodes.
+ * Looks for an entry without locking it. The result is what the entry held at some point
+ * during the call. The entries must belong to a directory the caller holds.
+ */
+static int lookup_entry_now(DirTable *dir, char *name) {
+    DirVersion version;
+    int inumber;
+
+    epoch_enter();
+    do {
+        inumber = dir_table_lookup_optimistic(dir, name, &version);
+    } while (inumber == DIR_RETRY);
+    epoch_exit();
+
+    return inumber;
+}
+
+
+/*
+ * Finds and locks the node of an entry without locking the entry, for a traversal that already
+ * holds inodes from another one (see move). Waiting for an entry there could deadlock with a
+ * delete, which holds the entry (and every other name of its stripe) while it waits for a node
+ * the caller may hold. So the node is locked first and the entry is checked again afterwards.
+ * Input:
+ *  - dir: entries of a directory the caller holds
+ *  - name: name of the entry
+ *  - write: 1 to lock the node for writing and 0 to lock it for reading
+ *  - locked_inumbers: array with the inumbers the caller holds, where the node is added
+ *  - amount: number of used locks
+ * Returns:
+ *  - inumber: identifier of the node, if found
+ *  - FAIL: otherwise
+ */
+static int lock_entry_nested(DirTable *dir, char *name, int write, int *locked_inumbers, int *amount) {
+    for (;;) {
+        int inumber = lookup_entry_now(dir, name);
+
+        /* a held node can't be removed, so its entry can't change either */
+        if (inumber == FAIL || check_if_node_is_in_array(inumber, locked_inumbers, *amount))
+            return inumber;
+
+        if (write) lock_write(inumber);
+        else lock_read(inumber);
+
+        if (lookup_entry_now(dir, name) == inumber) {
+            locked_inumbers[*amount] = inumber;
+            *amount += 1;
+            return inumber;
+        }
+
+        /* the node was removed (and its inode maybe reused) before it was locked */
+        unlock(inumber);
+    }
+}
+
+
+/*
+ * Lookup for a given path. Does not unlock traveled inodes, unless told to.
  * Input:
  *  - name: path of node
  *  - locked_inumbers: array that will hold all the inumbers of the traveled by inodes
  *  - amount: number of used locks
- *  - is_lookup: 1 if operation is lookup() and 0 if it is not
+ *  - mode: TRAVERSE_READ to read lock every inode, TRAVERSE_WRITE to write lock the last one.
+ *          with TRAVERSE_COUPLED, each inode this call locked is unlocked as soon as the next
+ *          one is locked, so only the last one stays locked
  * Returns:
  *  - inumber: identifier of the i-node, if found
  *  - FAIL: otherwise
  */
-int traverse_path(char *name, int *locked_inumbers, int *amount, int is_lookup) {
+int traverse_path(char *name, int *locked_inumbers, int *amount, int mode) {
 
     char full_path[MAX_FILE_NAME];
     char delim[] = "/";
+    int current_inumber;
+    int write = mode & TRAVERSE_WRITE, coupled = mode & TRAVERSE_COUPLED;
+
+    /* set when the caller already holds inodes from another traversal (see move) */
+    int nested = *amount > 0;
 
     strcpy(full_path, name);
 
+    /* a path whose components were all resolved before only needs its last inode to be locked */
+    if (! write && *amount == 0) {
+        current_inumber = dcache_resolve(name);
+        if (current_inumber != FAIL) {
+            lock_read(current_inumber);
+            /* the path may have changed before the inode was locked */
+            if (dcache_resolve(name) == current_inumber) {
+                locked_inumbers[(*amount)++] = current_inumber;
+                return current_inumber;
+            }
+            unlock(current_inumber);
+        }
+    }
+
     /* start at root node */
-    int current_inumber = FS_ROOT;
+    current_inumber = FS_ROOT;
+    int parent_inumber = FAIL;
+
+    /* position in locked_inumbers of the inode this call locked last, if it is still locked */
+    int held = FAIL;
 
     /* use for copy and to store data */
     type nType;
@@ -460,8 +665,9 @@ int traverse_path(char *name, int *locked_inumbers, int *amount, int is_lookup)
 
     /* puts root in locking queue if it isn't there already */
     if ( ! check_if_node_is_in_array(current_inumber, locked_inumbers, *amount)) {
-        if (path == NULL && ! is_lookup) lock_write(current_inumber);
+        if (path == NULL && write) lock_write(current_inumber);
         else lock_read(current_inumber);
+        held = *amount;
         locked_inumbers[*amount] = current_inumber;
         *amount += 1;
     }
@@ -469,34 +675,328 @@ int traverse_path(char *name, int *locked_inumbers, int *amount, int is_lookup)
     /* get root inode data */
     inode_get(current_inumber, &nType, &data);
 
-    /* search for all sub nodes */
-    while (path != NULL && (current_inumber = lookup_sub_node(path, data.dirEntries)) != FAIL) {
-        path = strtok_r(NULL, delim, &save_ptr);
-        if ( ! check_if_node_is_in_array(current_inumber, locked_inumbers, *amount)) {
-            if (path == NULL && ! is_lookup) lock_write(current_inumber);
-            else lock_read(current_inumber);
-            locked_inumbers[*amount] = current_inumber;
-            *amount += 1;
+    /* search for all sub nodes. each entry stays locked until its node is, so that the node can't
+     * be deleted (and its inode reused) in between. nested traversals check the entry again
+     * instead (see lock_entry_nested) */
+    while (path != NULL) {
+        if (nType != T_DIRECTORY) return FAIL;
+
+        parent_inumber = current_inumber;
+        char *next_path;
+        int locked;
+
+        if (nested) {
+            next_path = strtok_r(NULL, delim, &save_ptr);
+            int before = *amount;
+            current_inumber = lock_entry_nested(data.dirEntries, path, next_path == NULL && write,
+                                                locked_inumbers, amount);
+            if (current_inumber == FAIL) return FAIL;
+            locked = *amount > before;
+        } else {
+            assert__(dir_table_lock(data.dirEntries, path, 0) == SUCCESS, "Error: traverse_path failed to lock an entry!\n")
+            current_inumber = dir_table_lookup(data.dirEntries, path);
+
+            if (current_inumber == FAIL) {
+                dir_table_unlock(data.dirEntries, path);
+                return FAIL;
+            }
+
+            next_path = strtok_r(NULL, delim, &save_ptr);
+            locked = ! check_if_node_is_in_array(current_inumber, locked_inumbers, *amount);
+            if (locked) {
+                if (next_path == NULL && write) lock_write(current_inumber);
+                else lock_read(current_inumber);
+                locked_inumbers[*amount] = current_inumber;
+                *amount += 1;
+            }
+            /* the entry is locked, so it can't have been removed yet */
+            dcache_insert(parent_inumber, path, current_inumber, inode_generation(parent_inumber));
+            dir_table_unlock(data.dirEntries, path);
+        }
+
+        /* the node is locked, so its parent is no longer needed. the parent is always the inode
+         * just before it in locked_inumbers */
+        if (coupled && held != FAIL) {
+            assert__(unlock(parent_inumber) == SUCCESS, "Error: traverse_path failed to unlock a node!\n")
+            if (locked) locked_inumbers[held] = current_inumber;
+            *amount -= 1;
         }
+        held = locked ? *amount - 1 : FAIL;
+
+        path = next_path;
         inode_get(current_inumber, &nType, &data);
     }
+
     return current_inumber;
 }
 
 
 /*
- * Prints tecnicofs tree.
+ * Writes to a file given its path.
+ * Input:
+ *  - name: path of the file
+ *  - offset: where the write starts
+ *  - buffer: bytes that are written
+ *  - len: number of bytes
+ * Returns: number of bytes written or FAIL
+ */
+long write_file(char *name, size_t offset, char *buffer, size_t len) {
+
+    /* holds all the inode id's locked while doing this operation */
+    int locked_inumbers[MAX_PATH_INODE_LENGTH];
+    int amount = 0;
+
+    /* only the file stays locked, for writing */
+    int inumber = traverse_path(name, locked_inumbers, &amount, TRAVERSE_WRITE | TRAVERSE_COUPLED);
+
+    long res = inumber == FAIL ? FAIL : inode_write(inumber, offset, buffer, len);
+    unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
+
+    if (res == FAIL) printf("failed to write to %s\n", name);
+    return res;
+}
+
+
+/*
+ * Reads from a file given its path.
+ * Input:
+ *  - name: path of the file
+ *  - offset: where the read starts
+ *  - buffer: where the bytes are copied to
+ *  - len: maximum number of bytes
+ * Returns: number of bytes read (0 past the end of the file) or FAIL
+ */
+long read_file(char *name, size_t offset, char *buffer, size_t len) {
+
+    /* holds all the inode id's locked while doing this operation */
+    int locked_inumbers[MAX_PATH_INODE_LENGTH];
+    int amount = 0;
+
+    /* only the file stays locked, for reading */
+    int inumber = traverse_path(name, locked_inumbers, &amount, TRAVERSE_READ | TRAVERSE_COUPLED);
+
+    long res = inumber == FAIL ? FAIL : inode_read(inumber, offset, buffer, len);
+    unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
+
+    if (res == FAIL) printf("failed to read from %s\n", name);
+    return res;
+}
+
+
+/*
+ * Changes the size of a file given its path.
+ * Input:
+ *  - name: path of the file
+ *  - size: new size
+ * Returns: SUCCESS or FAIL
+ */
+int truncate_file(char *name, size_t size) {
+
+    /* holds all the inode id's locked while doing this operation */
+    int locked_inumbers[MAX_PATH_INODE_LENGTH];
+    int amount = 0;
+
+    /* only the file stays locked, for writing */
+    int inumber = traverse_path(name, locked_inumbers, &amount, TRAVERSE_WRITE | TRAVERSE_COUPLED);
+
+    int res = inumber == FAIL ? FAIL : inode_truncate(inumber, size);
+    unlock_inodes(locked_inumbers, amount);  /* unlocks all the used inodes */
+
+    if (res == FAIL) printf("failed to truncate %s\n", name);
+    return res;
+}
+
+
+/*
+ * Prints tecnicofs tree, as it was when the print started. Other operations keep running
+ * meanwhile.
  * Input:
  *  - output_file_path: output file path
  * Output:
  *  - SUCCESS or error
  */
 int print_tecnicofs_tree(char* output_file_path) {
-    FILE *out = fopen(output_file_path, "w");
-    assert__(out != NULL, "Error: print_tecnico_tree couldn't open output file!\n")
-    inode_print_tree(out, FS_ROOT, "");
-    fclose(out);
-    return SUCCESS;
+    int fd = open(output_file_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    assert__(fd != -1, "Error: print_tecnico_tree couldn't open output file!\n")
+    int res = snapshot_print(fd);
+    close(fd);
+    return res;
+}
+
+
+/*
+ * Prints tecnicofs tree to memory, as it was when the print started, so that the caller can write it
+ * out however it wants.
+ * Input:
+ *  - buffer: where the allocated text is stored, to be freed by the caller
+ *  - size: where the size of the text is stored
+ * Output:
+ *  - SUCCESS or FAIL
+ */
+int print_tecnicofs_tree_buffer(char **buffer, size_t *size) {
+    return snapshot_print_buffer(buffer, size);
+}
+
+
+/*
+ * Starts a walk of the tree, which is listed in pieces by tree_walk_next. The text is the same a
+ * print writes, of the tree as it is while each piece is taken, so entries added or removed in
+ * between may or may not be listed.
+ * Input:
+ *  - walk: where the walk is kept until tree_walk_end
+ */
+void tree_walk_start(treeWalk *walk) {
+    walk->stack_capacity = MAX_PATH_INODE_LENGTH;
+    walk->stack = malloc(sizeof(walkFrame) * walk->stack_capacity);
+    walk->path_capacity = MAX_FILE_NAME;
+    walk->path = malloc(walk->path_capacity);
+    assert__(walk->stack != NULL && walk->path != NULL, "Error: couldn't allocate a tree walk!\n")
+
+    /* the root is listed first, with an empty path */
+    walk->depth = 1;
+    walk->stack[0] = (walkFrame) {FS_ROOT, 0, 0};
+    walk->path[0] = '\n';
+    walk->line_len = 1;
+    walk->line_sent = 0;
+}
+
+
+/*
+ * Copies what is left of the last line of a walk that fits in a piece.
+ * Returns: number of bytes copied
+ */
+static size_t walk_output(treeWalk *walk, char *buffer, size_t size) {
+    size_t len = walk->line_len - walk->line_sent < size ? walk->line_len - walk->line_sent : size;
+    memcpy(buffer, walk->path + walk->line_sent, len);
+    walk->line_sent += len;
+    return len;
+}
+
+
+/*
+ * Locks a directory of a walk again, if it is still the entry it was found at in the directory
+ * before it, which must be locked.
+ * Input:
+ *  - walk: tree walk
+ *  - level: position of the directory in the stack of the walk
+ * Returns: SUCCESS or FAIL (if the entry was removed or moved)
+ */
+static int walk_enter(treeWalk *walk, int level) {
+    walkFrame *parent = &walk->stack[level - 1], *frame = &walk->stack[level];
+    size_t name_len = frame->path_len - parent->path_len - 1;
+    char name[MAX_FILE_NAME];
+    type nType;
+    union Data data;
+
+    memcpy(name, walk->path + parent->path_len + 1, name_len);
+    name[name_len] = '\0';
+    inode_get(parent->inumber, NULL, &data);
+
+    assert__(dir_table_lock(data.dirEntries, name, 0) == SUCCESS, "Error: tree walk failed to lock an entry!\n")
+    int found = dir_table_lookup(data.dirEntries, name) == frame->inumber;
+    if (found) lock_read(frame->inumber);
+    dir_table_unlock(data.dirEntries, name);
+
+    /* the inode may have been reused for a file with the same name */
+    if (found && (inode_get(frame->inumber, &nType, NULL) == FAIL || nType != T_DIRECTORY)) {
+        unlock(frame->inumber);
+        found = 0;
+    }
+    return found ? SUCCESS : FAIL;
+}
+
+
+/*
+ * Lists the next piece of a walk of the tree. The directories of the walk are locked from the root
+ * down, and only until the piece is listed. Those that were removed or moved since the last piece
+ * are left, with everything below them.
+ * Input:
+ *  - walk: tree walk
+ *  - buffer: where the piece is copied to
+ *  - size: maximum size of the piece
+ *  - finished: where 1 is stored if the piece ends the listing, 0 otherwise
+ * Returns: size of the piece
+ */
+long tree_walk_next(treeWalk *walk, char *buffer, size_t size, int *finished) {
+    size_t used = walk_output(walk, buffer, size);
+    int locked = used < size && walk->depth > 0;
+
+    if (locked) {
+        lock_read(FS_ROOT);
+        int level = 1;
+        while (level < walk->depth && walk_enter(walk, level) == SUCCESS) level++;
+        walk->depth = level;
+    }
+
+    while (used < size && walk->depth > 0) {
+        walkFrame *top = &walk->stack[walk->depth - 1];
+        union Data data;
+        int pushed = 0;
+
+        inode_get(top->inumber, NULL, &data);
+        int slots = dir_table_slots(data.dirEntries);
+
+        while (used < size && ! pushed && top->next < slots) {
+            DirEntry *entry = dir_table_lock_slot(data.dirEntries, top->next++);
+            if (entry == NULL) continue;
+
+            /* the path of the entry replaces the one of the entry listed before it, after the directory's */
+            size_t name_len = strlen(entry->name), path_len = top->path_len + 1 + name_len;
+            if (path_len + 1 > walk->path_capacity) {
+                while (path_len + 1 > walk->path_capacity) walk->path_capacity *= 2;
+                walk->path = realloc(walk->path, walk->path_capacity);
+                assert__(walk->path != NULL, "Error: couldn't grow the tree walk path!\n")
+            }
+            walk->path[top->path_len] = '/';
+            memcpy(walk->path + top->path_len + 1, entry->name, name_len);
+            walk->path[path_len] = '\n';
+
+            /* the entry is locked, so its inode can't be deleted before it is */
+            int inumber = entry->inumber;
+            type nType;
+            union Data child;
+            while (inode_get_optimistic(inumber, &nType, &child) == FAIL);
+            if (nType == T_DIRECTORY) lock_read(inumber);
+            dir_table_unlock(data.dirEntries, entry->name);
+
+            if (nType == T_FILE || nType == T_DIRECTORY) {
+                walk->line_len = path_len + 1;
+                walk->line_sent = 0;
+                used += walk_output(walk, buffer + used, size - used);
+            }
+            if (nType != T_DIRECTORY) continue;
+
+            if (walk->depth == walk->stack_capacity) {
+                walk->stack_capacity *= 2;
+                walk->stack = realloc(walk->stack, sizeof(walkFrame) * walk->stack_capacity);
+                assert__(walk->stack != NULL, "Error: couldn't grow the tree walk stack!\n")
+            }
+            walk->stack[walk->depth++] = (walkFrame) {inumber, 0, path_len};
+            pushed = 1;
+        }
+
+        /* every entry of the directory was listed */
+        if (! pushed && top->next >= slots) {
+            unlock(top->inumber);
+            walk->depth--;
+        }
+    }
+
+    /* the directories left are locked again when the next piece is taken */
+    for (int level = walk->depth - 1; locked && level >= 0; level--) unlock(walk->stack[level].inumber);
+    *finished = walk->depth == 0 && walk->line_sent == walk->line_len;
+    return used;
+}
+
+
+/*
+ * Releases a walk of the tree.
+ */
+void tree_walk_end(treeWalk *walk) {
+    free(walk->stack);
+    free(walk->path);
+    walk->stack = NULL;
+    walk->path = NULL;
 }
 
 
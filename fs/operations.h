@@ -1,16 +1,54 @@
 #ifndef FS_H
 #define FS_H
 #include "state.h"
+#include "dcache.h"
 
-void init_fs();
+/* ways traverse_path can lock the inodes of a path */
+#define TRAVERSE_READ 0  /* read locks every inode */
+#define TRAVERSE_WRITE 1  /* write locks the last inode and read locks the others */
+#define TRAVERSE_COUPLED 2  /* added to the above, only keeps the last inode locked */
+
+/* times a lookup tries to resolve a path without locks before it locks the path */
+#define LOOKUP_RETRIES 4
+
+/*
+ * Directory a tree walk is inside of: the slot of its next entry and the length of its path.
+ */
+typedef struct walkFrame {
+    int inumber;
+    int next;
+    size_t path_len;
+} walkFrame;
+
+/*
+ * Listing of the tree that is taken in pieces, each one from the tree as it is when it is taken.
+ * It only keeps the directories it is inside of, so its size doesn't depend on the tree's.
+ */
+typedef struct treeWalk {
+    walkFrame *stack;  /* from the root to the directory being listed */
+    int depth, stack_capacity;
+    char *path;  /* line of the last entry listed, which starts with the paths of the directories */
+    size_t path_capacity;
+    size_t line_len, line_sent;  /* length of that line and how much of it was output */
+} treeWalk;
+
+
+void init_fs(char *store_path, char *log_path);
 void destroy_fs();
-int is_dir_empty(DirEntry *dirEntries);
+int is_dir_empty(DirTable *dirEntries);
 int create(char *name, type nodeType);
 int delete(char *name);
 int lookup(char *name);
 int move(char *from, char *to);
-int traverse_path(char *name, int *locked_inumbers, int *amount, int is_lookup);
+long write_file(char *name, size_t offset, char *buffer, size_t len);
+long read_file(char *name, size_t offset, char *buffer, size_t len);
+int truncate_file(char *name, size_t size);
+int traverse_path(char *name, int *locked_inumbers, int *amount, int mode);
 int print_tecnicofs_tree(char* output_file_path);
+int print_tecnicofs_tree_buffer(char **buffer, size_t *size);
+void tree_walk_start(treeWalk *walk);
+long tree_walk_next(treeWalk *walk, char *buffer, size_t size, int *finished);
+void tree_walk_end(treeWalk *walk);
 void unlock_inodes(const int locked_inumbers[MAX_PATH_INODE_LENGTH], int amount);
 
 #endif /* FS_H */
@@ -0,0 +1,373 @@
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "state.h"
+#include "pstore.h"
+
+/*
+ * Persistent store. The inode table, directory tables and file contents are allocated in a file
+ * that is mapped with MAP_SHARED, and point to each other through references (offsets from the
+ * start of the file) instead of pointers. Opening the store maps it and the file system is ready
+ * as it was left, without rebuilding anything.
+ *
+ * Without a store, memory comes from malloc and references are plain addresses, so the rest of
+ * the file system works the same either way.
+ *
+ * A store the server didn't close may be halfway through changes, and have memory that was being
+ * handed out or waiting to be freed. Before it is used, the file system walks its tree from the
+ * root and marks the memory it reaches (see pstore_keep), and everything else becomes free.
+ */
+
+/* where the store is mapped, NULL without a store */
+char *pstore_base = NULL;
+
+/* header of the store, NULL without a store */
+pstoreHeader *store = NULL;
+
+/* file of the store */
+int store_fd = -1;
+
+/* roots of the file system without a store */
+pstoreRef volatile_roots[PSTORE_ROOTS];
+
+/* protects the allocator of the store */
+pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* set from when a store that wasn't closed is opened until it is recovered */
+int store_dirty = 0;
+
+/*
+ * Memory of a store being recovered that is still used.
+ */
+typedef struct pstoreRange {
+    uint64_t offset;
+    uint64_t size;
+} pstoreRange;
+
+/* memory marked with pstore_keep */
+pstoreRange *kept = NULL;
+size_t kept_count = 0, kept_capacity = 0;
+
+
+/*
+ * Opens a store file, creating it if it doesn't exist. Memory allocated from then on comes from
+ * the store.
+ * Input:
+ *  - path: path of the file
+ * Returns: SUCCESS or FAIL (if the file can't be mapped or isn't a store)
+ */
+int pstore_open(char *path) {
+    struct stat file_stat;
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+    if (fd == -1) return FAIL;
+    if (fstat(fd, &file_stat) != 0) goto close_file;
+
+    int fresh = file_stat.st_size == 0;
+    if (fresh && ftruncate(fd, PSTORE_GROWTH) != 0) goto close_file;
+
+    /* the whole range is mapped now, only the part inside the file can be touched */
+    char *base = mmap(NULL, PSTORE_MAX_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0);
+    if (base == MAP_FAILED) goto close_file;
+    pstoreHeader *header = (pstoreHeader *) base;
+
+    if (fresh) {
+        header->magic = PSTORE_MAGIC;
+        header->version = PSTORE_VERSION;
+        header->clean = 1;
+        header->used = PSTORE_PAGE;
+        header->size = PSTORE_GROWTH;
+    } else if ((size_t) file_stat.st_size < sizeof(pstoreHeader) || header->magic != PSTORE_MAGIC ||
+               header->version != PSTORE_VERSION || header->size > (uint64_t) file_stat.st_size) {
+        fprintf(stderr, "Error: %s is not a tecnicofs store!\n", path);
+        munmap(base, PSTORE_MAX_SIZE);
+        goto close_file;
+    }
+
+    /* changes stop halfway when the server doesn't close the store (see pstore_close), so it is
+     * recovered before it is used. if the server stops again meanwhile, the next one recovers it */
+    store_dirty = ! header->clean;
+    if (store_dirty) fprintf(stderr, "Warning: %s was not closed, recovering it\n", path);
+    header->clean = 0;
+    msync(base, PSTORE_PAGE, MS_SYNC);
+    header->boot++;
+
+    pstore_base = base;
+    store = header;
+    store_fd = fd;
+    return SUCCESS;
+
+close_file:
+    close(fd);
+    return FAIL;
+}
+
+
+/*
+ * Writes the store back to its file and unmaps it. Nothing may be changing it meanwhile.
+ */
+void pstore_close() {
+    if (store == NULL) {
+        memset(volatile_roots, 0, sizeof(volatile_roots));
+        return;
+    }
+
+    /* pages are written back in any order, so the store is only marked clean once the rest is */
+    msync(pstore_base, store->used, MS_SYNC);
+    store->clean = 1;
+    msync(pstore_base, PSTORE_PAGE, MS_SYNC);
+    munmap(pstore_base, PSTORE_MAX_SIZE);
+    close(store_fd);
+
+    pstore_base = NULL;
+    store = NULL;
+    store_fd = -1;
+}
+
+
+/*
+ * Checks if memory comes from a store.
+ * Returns: 1 if there is a store and 0 otherwise
+ */
+int pstore_persistent() {
+    return store != NULL;
+}
+
+
+/*
+ * Checks if the store has to be recovered before it is used, since the server that used it last
+ * didn't close it.
+ * Returns: 1 if it has to be recovered and 0 otherwise
+ */
+int pstore_dirty() {
+    return store_dirty;
+}
+
+
+/*
+ * Gets the number of times the store was opened, which tells this run of the server from the
+ * ones before it. Always 1 without a store.
+ */
+unsigned long pstore_boot() {
+    return store != NULL ? store->boot : 1;
+}
+
+
+/*
+ * Gets a root of the file system, 0 until it is set.
+ * Input:
+ *  - id: one of PSTORE_ROOT_*
+ */
+pstoreRef *pstore_root(int id) {
+    return store != NULL ? &store->roots[id] : &volatile_roots[id];
+}
+
+
+/*
+ * Gets the size class of an allocation.
+ */
+static int size_class(size_t size) {
+    int class = PSTORE_MIN_CLASS;
+    while (class < PSTORE_CLASSES - 1 && ((size_t) 1 << class) < size) class++;
+    return class;
+}
+
+
+/*
+ * Grows the file of the store. The store lock must be held.
+ * Input:
+ *  - needed: size the file must have at least
+ * Returns: SUCCESS or FAIL (if the file can't grow that much)
+ */
+static int store_grow(size_t needed) {
+    size_t size = store->size + PSTORE_GROWTH;
+
+    if (size < needed) size = (needed + PSTORE_GROWTH - 1) / PSTORE_GROWTH * PSTORE_GROWTH;
+    if (size > PSTORE_MAX_SIZE || ftruncate(store_fd, size) != 0) return FAIL;
+
+    store->size = size;
+    return SUCCESS;
+}
+
+
+/*
+ * Allocates memory, from the store if there is one.
+ * Input:
+ *  - size: number of bytes
+ * Returns: the memory, aligned to its size up to PSTORE_PAGE, or NULL if there is no memory left
+ */
+void *pstore_alloc(size_t size) {
+    void *ptr = NULL;
+
+    if (store == NULL) {
+        if (size < PSTORE_PAGE) return malloc(size);
+        return posix_memalign(&ptr, PSTORE_PAGE, size) == 0 ? ptr : NULL;
+    }
+
+    int class = size_class(size);
+    size_t class_size = (size_t) 1 << class;
+
+    if (class_size < size) return NULL;
+    assert__(pthread_mutex_lock(&store_lock) == 0, "Error: pstore_alloc failed to lock!\n")
+
+    if (store->free_lists[class] != 0) {
+        ptr = pstore_ptr(store->free_lists[class]);
+        store->free_lists[class] = *(pstoreRef *) ptr;
+    } else {
+        size_t align = class_size < PSTORE_PAGE ? class_size : PSTORE_PAGE;
+        size_t offset = (store->used + align - 1) & ~(align - 1);
+
+        if (offset + class_size <= store->size || store_grow(offset + class_size) == SUCCESS) {
+            ptr = pstore_base + offset;
+            store->used = offset + class_size;
+        }
+    }
+
+    assert__(pthread_mutex_unlock(&store_lock) == 0, "Error: pstore_alloc failed to unlock!\n")
+    return ptr;
+}
+
+
+/*
+ * Allocates memory filled with zeros, from the store if there is one.
+ * Input:
+ *  - size: number of bytes
+ * Returns: the memory or NULL if there is no memory left
+ */
+void *pstore_calloc(size_t size) {
+    if (store == NULL && size < PSTORE_PAGE) return calloc(1, size);
+
+    void *ptr = pstore_alloc(size);
+    if (ptr != NULL) memset(ptr, 0, size);
+    return ptr;
+}
+
+
+/*
+ * Changes the size of an allocation, moving it if it doesn't fit.
+ * Input:
+ *  - ptr: memory from pstore_alloc, or NULL
+ *  - old_size: size it was allocated with
+ *  - size: new size
+ * Returns: the memory, with the contents it had, or NULL (and ptr is kept) if there is no memory left
+ */
+void *pstore_realloc(void *ptr, size_t old_size, size_t size) {
+    if (store == NULL) return realloc(ptr, size);
+    if (ptr != NULL && size_class(old_size) == size_class(size)) return ptr;
+
+    void *new_ptr = pstore_alloc(size);
+    if (new_ptr == NULL) return NULL;
+
+    if (ptr != NULL) {
+        memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+        pstore_free(ptr, old_size);
+    }
+    return new_ptr;
+}
+
+
+/*
+ * Gives back memory from pstore_alloc.
+ * Input:
+ *  - ptr: the memory, or NULL
+ *  - size: size it was allocated with
+ */
+void pstore_free(void *ptr, size_t size) {
+    if (ptr == NULL) return;
+    if (store == NULL) {
+        free(ptr);
+        return;
+    }
+
+    int class = size_class(size);
+
+    assert__(pthread_mutex_lock(&store_lock) == 0, "Error: pstore_free failed to lock!\n")
+    *(pstoreRef *) ptr = store->free_lists[class];
+    store->free_lists[class] = pstore_ref(ptr);
+    assert__(pthread_mutex_unlock(&store_lock) == 0, "Error: pstore_free failed to unlock!\n")
+}
+
+
+/*
+ * Marks memory of a store being recovered as used, while the file system walks its tree. Memory
+ * that isn't marked is free once the store is recovered.
+ * Input:
+ *  - ref: reference to the memory, as the tree has it
+ *  - size: size it was allocated with
+ * Returns: SUCCESS or FAIL (if the reference can't be memory of that size, and must be dropped)
+ */
+int pstore_keep(pstoreRef ref, size_t size) {
+    uint64_t class_size = (uint64_t) 1 << size_class(size);
+    uint64_t align = class_size < PSTORE_PAGE ? class_size : PSTORE_PAGE;
+
+    if (ref < PSTORE_PAGE || ref % align != 0 || ref > store->used || class_size > store->used - ref) return FAIL;
+
+    if (kept_count == kept_capacity) {
+        kept_capacity = kept_capacity == 0 ? PSTORE_PAGE : 2 * kept_capacity;
+        kept = realloc(kept, sizeof(pstoreRange) * kept_capacity);
+        assert__(kept != NULL, "Error: couldn't allocate memory to recover the store!\n")
+    }
+    kept[kept_count].offset = ref;
+    kept[kept_count].size = class_size;
+    kept_count++;
+    return SUCCESS;
+}
+
+
+/*
+ * Orders memory of a store by offset.
+ */
+static int compare_ranges(const void *a, const void *b) {
+    uint64_t offset_a = ((const pstoreRange *) a)->offset, offset_b = ((const pstoreRange *) b)->offset;
+    return offset_a < offset_b ? -1 : offset_a > offset_b;
+}
+
+
+/*
+ * Puts the memory between two offsets of the store in the free lists, in the largest pieces that
+ * are aligned the way pstore_alloc aligns them.
+ */
+static void free_range(uint64_t start, uint64_t end) {
+    while (start < end) {
+        int class = PSTORE_CLASSES - 1;
+        uint64_t class_size = (uint64_t) 1 << class;
+
+        while (class > PSTORE_MIN_CLASS &&
+               (class_size > end - start || start % (class_size < PSTORE_PAGE ? class_size : PSTORE_PAGE) != 0))
+            class_size = (uint64_t) 1 << --class;
+
+        *(pstoreRef *) pstore_ptr(start) = store->free_lists[class];
+        store->free_lists[class] = start;
+        start += class_size;
+    }
+}
+
+
+/*
+ * Finishes recovering a store once every memory its tree reaches is marked with pstore_keep. The
+ * free lists are rebuilt from the memory between what was marked, which takes back what the
+ * server that stopped leaked, was handing out or was about to free. Nothing may be allocated from
+ * the store before this.
+ */
+void pstore_recover() {
+    uint64_t end = PSTORE_PAGE;
+
+    qsort(kept, kept_count, sizeof(pstoreRange), compare_ranges);
+    memset(store->free_lists, 0, sizeof(store->free_lists));
+
+    for (size_t i = 0; i < kept_count; i++) {
+        if (kept[i].offset > end) free_range(end, kept[i].offset);
+        if (kept[i].offset + kept[i].size > end) end = kept[i].offset + kept[i].size;
+    }
+
+    /* memory past the last that is used is handed out from the end again */
+    store->used = end;
+
+    free(kept);
+    kept = NULL;
+    kept_count = kept_capacity = 0;
+    store_dirty = 0;
+}
@@ -0,0 +1,86 @@
+#ifndef PSTORE_H
+#define PSTORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../tecnicofs-api-constants.h"
+
+/* first bytes of a store file, and version of its layout */
+#define PSTORE_MAGIC 0x3165726f74536674ULL  /* "tfStore1" */
+#define PSTORE_VERSION 1
+
+/* the store is mapped once with room to grow up to this size, so its address never changes */
+#define PSTORE_MAX_SIZE ((size_t) 1 << 40)
+
+/* the file grows at least this much at a time */
+#define PSTORE_GROWTH ((size_t) 16 * 1024 * 1024)
+
+/* allocations are rounded up to a power of two, from 1 << PSTORE_MIN_CLASS bytes on, and aligned
+ * to their size up to PSTORE_PAGE bytes */
+#define PSTORE_MIN_CLASS 4
+#define PSTORE_CLASSES 48
+#define PSTORE_PAGE 4096
+
+/* structures of the file system that are found from the header of the store */
+#define PSTORE_ROOTS 8
+#define PSTORE_ROOT_INODES 0  /* inode table (see state.c) */
+#define PSTORE_ROOT_BLOCKS 1  /* free file blocks (see filedata.c) */
+
+
+/*
+ * Reference to memory of the store: its offset from the start of the store, so that it holds
+ * wherever the store is mapped. Without a store the base is 0 and a reference is an address.
+ * 0 is NULL, since offset 0 is the header.
+ */
+typedef uint64_t pstoreRef;
+
+/*
+ * Start of a store file. Everything else is reached from its roots.
+ */
+typedef struct pstoreHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t clean;  /* set while the store is closed, cleared while a server has it open */
+    uint64_t boot;  /* number of times the store was opened */
+    uint64_t used;  /* bytes handed out so far, from the start of the file */
+    uint64_t size;  /* size of the file */
+    pstoreRef free_lists[PSTORE_CLASSES];  /* freed memory of each size class, linked through itself */
+    pstoreRef roots[PSTORE_ROOTS];
+} pstoreHeader;
+
+
+/* where the store is mapped, NULL without a store */
+extern char *pstore_base;
+
+
+/*
+ * Gets the memory a reference points to.
+ */
+static inline void *pstore_ptr(pstoreRef ref) {
+    return ref == 0 ? NULL : (void *) ((uintptr_t) pstore_base + ref);
+}
+
+
+/*
+ * Gets the reference to memory of the store, or to any memory without a store.
+ */
+static inline pstoreRef pstore_ref(void *ptr) {
+    return ptr == NULL ? 0 : (pstoreRef) ((uintptr_t) ptr - (uintptr_t) pstore_base);
+}
+
+
+int pstore_open(char *path);
+void pstore_close();
+int pstore_persistent();
+int pstore_dirty();
+unsigned long pstore_boot();
+pstoreRef *pstore_root(int id);
+void *pstore_alloc(size_t size);
+void *pstore_calloc(size_t size);
+void *pstore_realloc(void *ptr, size_t old_size, size_t size);
+void pstore_free(void *ptr, size_t size);
+int pstore_keep(pstoreRef ref, size_t size);
+void pstore_recover();
+
+
+#endif /* PSTORE_H */
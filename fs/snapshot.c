@@ -0,0 +1,622 @@
+#include <string.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <unistd.h>
+#include "snapshot.h"
+#include "epoch.h"
+
+/*
+ * Copy-on-write snapshot of the namespace, so the tree can be printed or checkpointed while other
+ * threads keep changing it. While a snapshot is in use, the first change to an inode preserves
+ * the state the inode had when the snapshot was taken (see snapshot_preserve). The reader gets
+ * those states, and the live state of every inode that didn't change.
+ *
+ * Changes run inside epochs (see snapshot_change_begin), so the snapshot is taken once every
+ * change that started before it has finished.
+ */
+
+/* phase of the snapshot in use, if any */
+int snapshot_phase = SNAPSHOT_OFF;
+
+/* phase the change the calling thread is making started in, and how nested it is */
+__thread int change_phase = SNAPSHOT_OFF;
+__thread int change_depth = 0;
+
+/* preserved states, in chunks of INODE_CHUNK_SIZE inodes that are allocated on demand */
+snapshotNode **snapshot_chunks[MAX_INODE_CHUNKS];
+
+/* inode i of the snapshot is protected by lock i % SNAPSHOT_LOCKS */
+pthread_mutex_t snapshot_locks[SNAPSHOT_LOCKS];
+
+/* only one snapshot is taken at a time */
+pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* threads a print uses, 0 for one per processor (at most SNAPSHOT_PRINT_THREADS) */
+int print_threads = 0;
+
+
+/*
+ * Initializes the snapshot locks.
+ */
+void snapshot_init() {
+    for (int i = 0; i < SNAPSHOT_LOCKS; i++)
+        assert__(pthread_mutex_init(&snapshot_locks[i], NULL) == 0, "Error: couldn't init snapshot lock!\n")
+}
+
+
+/*
+ * Releases the snapshot locks.
+ */
+void snapshot_destroy() {
+    for (int i = 0; i < SNAPSHOT_LOCKS; i++) pthread_mutex_destroy(&snapshot_locks[i]);
+}
+
+
+/*
+ * Gets where the preserved state of an inode is kept, allocating its chunk if needed.
+ */
+static snapshotNode **node_slot(int inumber) {
+    snapshotNode ***chunk = &snapshot_chunks[inumber / INODE_CHUNK_SIZE];
+    snapshotNode **nodes = __atomic_load_n(chunk, __ATOMIC_ACQUIRE);
+
+    if (nodes == NULL) {
+        snapshotNode **new_nodes = calloc(INODE_CHUNK_SIZE, sizeof(snapshotNode *));
+        assert__(new_nodes != NULL, "Error: couldn't allocate the snapshot!\n")
+        if (__atomic_compare_exchange_n(chunk, &nodes, new_nodes, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            nodes = new_nodes;
+        else
+            free(new_nodes);
+    }
+    return &nodes[inumber % INODE_CHUNK_SIZE];
+}
+
+
+/*
+ * Copies the current state of an inode. Nobody may change the inode meanwhile.
+ */
+static snapshotNode *copy_node(int inumber) {
+    snapshotNode *node = malloc(sizeof(snapshotNode));
+    union Data data;
+
+    assert__(node != NULL, "Error: couldn't preserve an inode!\n")
+
+    while (inode_get_optimistic(inumber, &node->nodeType, &data) == FAIL);
+    node->n_entries = 0;
+    node->entries = NULL;
+
+    if (node->nodeType == T_DIRECTORY) {
+        int slots = dir_table_slots(data.dirEntries);
+        node->entries = malloc(sizeof(DirEntry) * (slots > 0 ? slots : 1));
+        assert__(node->entries != NULL, "Error: couldn't preserve an inode!\n")
+
+        for (int i = 0; i < slots; i++) {
+            DirEntry *entry = dir_table_slot(data.dirEntries, i);
+            if (entry->inumber != FREE_INODE) node->entries[node->n_entries++] = *entry;
+        }
+    }
+    return node;
+}
+
+
+/*
+ * Releases a copied state.
+ */
+static void free_node(snapshotNode *node) {
+    if (node == NULL || node == SNAPSHOT_DONE) return;
+    free(node->entries);
+    free(node);
+}
+
+
+/*
+ * Starts a change to the tree. A snapshot sees either none or all of the changes made until the
+ * matching snapshot_change_end. Changes can be nested, only the outermost one counts.
+ */
+void snapshot_change_begin() {
+    if (change_depth++ > 0) return;
+
+    for (;;) {
+        epoch_enter();
+        change_phase = __atomic_load_n(&snapshot_phase, __ATOMIC_SEQ_CST);
+        if (change_phase != SNAPSHOT_STARTING) return;
+
+        /* the snapshot is waiting for older changes, and this one has to wait for the snapshot */
+        epoch_exit();
+        while (__atomic_load_n(&snapshot_phase, __ATOMIC_ACQUIRE) == SNAPSHOT_STARTING) sched_yield();
+    }
+}
+
+
+/*
+ * Ends a change to the tree.
+ */
+void snapshot_change_end() {
+    if (--change_depth > 0) return;
+    epoch_exit();
+}
+
+
+/*
+ * Preserves the state of an inode that is about to change, if the change started after a
+ * snapshot was taken and the inode wasn't preserved yet. Must be called between
+ * snapshot_change_begin and snapshot_change_end.
+ * Input:
+ *  - inumber: identifier of the i-node
+ */
+void snapshot_preserve(int inumber) {
+    if (change_phase != SNAPSHOT_TAKEN) return;
+
+    pthread_mutex_t *lock = &snapshot_locks[inumber % SNAPSHOT_LOCKS];
+    snapshotNode **node = node_slot(inumber);
+
+    assert__(pthread_mutex_lock(lock) == 0, "Error: snapshot_preserve failed to lock!\n")
+    if (*node == NULL) *node = copy_node(inumber);
+    assert__(pthread_mutex_unlock(lock) == 0, "Error: snapshot_preserve failed to unlock!\n")
+}
+
+
+/*
+ * Takes a snapshot of the tree as it is now, while other threads keep changing it. Only one
+ * snapshot is taken at a time, until snapshot_release.
+ * Input:
+ *  - quiet: called once every change that started before the snapshot has finished and before
+ *           any other starts, or NULL
+ *  - arg: passed to quiet
+ */
+void snapshot_take(void (*quiet)(void *), void *arg) {
+    assert__(pthread_mutex_lock(&snapshot_lock) == 0, "Error: snapshot_take failed to lock!\n")
+
+    /* changes that didn't see the snapshot have to finish before the tree is read */
+    __atomic_store_n(&snapshot_phase, SNAPSHOT_STARTING, __ATOMIC_SEQ_CST);
+    epoch_synchronize();
+    if (quiet != NULL) quiet(arg);
+    __atomic_store_n(&snapshot_phase, SNAPSHOT_TAKEN, __ATOMIC_SEQ_CST);
+}
+
+
+/*
+ * Gets the state an i-node had when the snapshot was taken. Each inode can only be read once,
+ * and then it no longer needs to be preserved.
+ * Input:
+ *  - inumber: identifier of the i-node
+ * Returns: the state, released with snapshot_node_free
+ */
+snapshotNode *snapshot_node(int inumber) {
+    pthread_mutex_t *lock = &snapshot_locks[inumber % SNAPSHOT_LOCKS];
+    snapshotNode **slot = node_slot(inumber);
+
+    /* an inode that didn't change is copied now */
+    assert__(pthread_mutex_lock(lock) == 0, "Error: snapshot_node failed to lock!\n")
+    snapshotNode *node = *slot;
+    if (node == NULL) node = copy_node(inumber);
+    *slot = SNAPSHOT_DONE;
+    assert__(pthread_mutex_unlock(lock) == 0, "Error: snapshot_node failed to unlock!\n")
+
+    return node;
+}
+
+
+/*
+ * Releases a state from snapshot_node.
+ */
+void snapshot_node_free(snapshotNode *node) {
+    free_node(node);
+}
+
+
+/*
+ * Releases the snapshot, so that another one can be taken.
+ */
+void snapshot_release() {
+    /* nobody may still be preserving an inode when the snapshot is released */
+    __atomic_store_n(&snapshot_phase, SNAPSHOT_OFF, __ATOMIC_SEQ_CST);
+    epoch_synchronize();
+
+    for (int i = 0; i < MAX_INODE_CHUNKS; i++) {
+        if (snapshot_chunks[i] == NULL) continue;
+        for (int j = 0; j < INODE_CHUNK_SIZE; j++) free_node(snapshot_chunks[i][j]);
+        free(snapshot_chunks[i]);
+        snapshot_chunks[i] = NULL;
+    }
+
+    assert__(pthread_mutex_unlock(&snapshot_lock) == 0, "Error: snapshot_release failed to unlock!\n")
+}
+
+
+/*
+ * Allocates a print buffer aligned to SNAPSHOT_PRINT_ALIGN, with the bytes of an old one.
+ */
+static char *print_buffer(char *old, size_t used, size_t capacity) {
+    void *buffer;
+    assert__(posix_memalign(&buffer, SNAPSHOT_PRINT_ALIGN, capacity) == 0, "Error: couldn't allocate the print buffer!\n")
+    if (used > 0) memcpy(buffer, old, used);
+    free(old);
+    return buffer;
+}
+
+
+/*
+ * Places text at the end of what a print has written so far. The print lock must be held. A
+ * print to memory copies the text meanwhile, a print to a file writes it later with print_write.
+ * Returns: offset of the text in the output
+ */
+static uint64_t print_reserve(snapshotPrint *print, const char *bytes, size_t size) {
+    uint64_t offset = print->offset;
+    print->offset += size;
+
+    if (print->fd == -1 && size > 0) {
+        if (print->offset > print->capacity) {
+            size_t capacity = print->capacity > 0 ? print->capacity : SNAPSHOT_PRINT_BUFFER;
+            while (print->offset > capacity) capacity *= 2;
+            char *text = realloc(print->text, capacity);
+            assert__(text != NULL, "Error: couldn't grow the print text!\n")
+            print->text = text;
+            print->capacity = capacity;
+        }
+        memcpy(print->text + offset, bytes, size);
+    }
+    return offset;
+}
+
+
+/*
+ * Writes text of a print to its file, at the offset print_reserve gave it.
+ */
+static void print_write(snapshotPrint *print, const char *bytes, size_t size, uint64_t offset) {
+    if (print->fd == -1) return;
+
+    for (size_t written = 0; written < size; ) {
+        ssize_t res = pwrite(print->fd, bytes + written, size - written, offset + written);
+        if (res <= 0) {
+            __atomic_store_n(&print->failed, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        written += res;
+    }
+}
+
+
+/*
+ * Outputs the tasks that are done and come right after the ones already output. If the task
+ * after them is the one given, which isn't done yet, the text in its buffer is output as well,
+ * so the task that is first in line never has to keep its text.
+ * Input:
+ *  - print: print the tasks are in
+ *  - index: task whose buffer is full, -1 if none
+ * Returns: if the buffer of the task given was output and can be reused
+ */
+static int print_advance(snapshotPrint *print, int index) {
+    int first, last, streamed = 0;
+    uint64_t offset = 0;
+
+    assert__(pthread_mutex_lock(&print->lock) == 0, "Error: print_advance failed to lock!\n")
+    first = print->written;
+    while (print->written < print->n_tasks && print->tasks[print->written].done) {
+        printTask *task = &print->tasks[print->written++];
+        task->offset = print_reserve(print, task->buffer, task->used);
+    }
+    last = print->written;
+    if (index != -1 && print->written == index) {
+        offset = print_reserve(print, print->tasks[index].buffer, print->tasks[index].used);
+        streamed = 1;
+    }
+    assert__(pthread_mutex_unlock(&print->lock) == 0, "Error: print_advance failed to unlock!\n")
+
+    /* the text is written outside the lock, and only this thread has it now */
+    for (int i = first; i < last; i++) {
+        printTask *task = &print->tasks[i];
+        print_write(print, task->buffer, task->used, task->offset);
+        free(task->buffer);
+        task->buffer = NULL;
+    }
+    if (streamed) {
+        printTask *task = &print->tasks[index];
+        print_write(print, task->buffer, task->used, offset);
+        task->used = 0;
+    }
+    return streamed;
+}
+
+
+/*
+ * Adds text to the buffer of a task. A full buffer is output if the task is first in line, and
+ * grows otherwise.
+ */
+static void task_put(snapshotPrint *print, int index, const char *bytes, size_t size) {
+    printTask *task = &print->tasks[index];
+
+    if (task->buffer == NULL) {
+        task->buffer = print_buffer(NULL, 0, SNAPSHOT_PRINT_BUFFER);
+        task->capacity = SNAPSHOT_PRINT_BUFFER;
+    }
+    while (task->used + size > task->capacity) {
+        if (task->used > 0 && print_advance(print, index)) continue;
+        task->buffer = print_buffer(task->buffer, task->used, task->capacity * 2);
+        task->capacity *= 2;
+    }
+    memcpy(task->buffer + task->used, bytes, size);
+    task->used += size;
+}
+
+
+/*
+ * Prints a range of the entries of a directory of the snapshot, each followed by everything below
+ * it. The directories being listed are kept in a stack instead of the call stack, so any depth
+ * can be printed, and the path of the current entry is built in place in a single buffer that only
+ * grows.
+ * Input:
+ *  - print: print the task is in
+ *  - index: task with the directory and the range
+ */
+static void print_entries(snapshotPrint *print, int index) {
+    printTask *task = &print->tasks[index];
+    size_t path_capacity = MAX_FILE_NAME;
+    int stack_capacity = MAX_PATH_INODE_LENGTH;
+    int depth = 0;
+
+    while (path_capacity < task->path_len + 1) path_capacity *= 2;
+    char *path = malloc(path_capacity);
+    printFrame *stack = malloc(sizeof(printFrame) * stack_capacity);
+    assert__(path != NULL && stack != NULL, "Error: couldn't allocate the print!\n")
+
+    memcpy(path, task->path, task->path_len);
+    stack[depth++] = (printFrame) {task->dir, task->first, task->last, task->path_len};
+
+    while (depth > 0) {
+        printFrame *top = &stack[depth - 1];
+        if (top->next == top->end) {
+            /* the directory of the task is shared with the other ranges of its entries */
+            if (depth > 1) snapshot_node_free(top->node);
+            depth--;
+            continue;
+        }
+
+        /* the path of the entry replaces the one of the entry before it, after the directory's */
+        DirEntry *entry = &top->node->entries[top->next++];
+        size_t name_len = strlen(entry->name), path_len = top->path_len + 1 + name_len;
+        if (path_len + 1 > path_capacity) {
+            while (path_len + 1 > path_capacity) path_capacity *= 2;
+            path = realloc(path, path_capacity);
+            assert__(path != NULL, "Error: couldn't grow the print path!\n")
+        }
+        path[top->path_len] = '/';
+        memcpy(path + top->path_len + 1, entry->name, name_len);
+        path[path_len] = '\n';
+
+        snapshotNode *node = snapshot_node(entry->inumber);
+        if (node->nodeType == T_FILE || node->nodeType == T_DIRECTORY) task_put(print, index, path, path_len + 1);
+
+        if (node->n_entries == 0) {
+            snapshot_node_free(node);
+            continue;
+        }
+        if (depth == stack_capacity) {
+            stack_capacity *= 2;
+            stack = realloc(stack, sizeof(printFrame) * stack_capacity);
+            assert__(stack != NULL, "Error: couldn't grow the print stack!\n")
+        }
+        stack[depth++] = (printFrame) {node, 0, node->n_entries, path_len};
+    }
+
+    free(stack);
+    free(path);
+}
+
+
+/*
+ * Adds a task to a print.
+ * Input:
+ *  - print: print being planned
+ *  - capacity: where the number of tasks there is room for is kept
+ *  - task: task to add, which the print takes
+ */
+static void add_task(snapshotPrint *print, int *capacity, printTask task) {
+    if (print->n_tasks == *capacity) {
+        *capacity = *capacity > 0 ? *capacity * 2 : SNAPSHOT_PRINT_TASKS;
+        print->tasks = realloc(print->tasks, sizeof(printTask) * *capacity);
+        assert__(print->tasks != NULL, "Error: couldn't allocate the print tasks!\n")
+    }
+    print->tasks[print->n_tasks++] = task;
+}
+
+
+/*
+ * Adds the tasks that print a node of the snapshot: its path, which is output as it is, and the
+ * entries of the node, if it has any.
+ * Input:
+ *  - print: print being planned
+ *  - capacity: where the number of tasks there is room for is kept
+ *  - node: state of the node, which the print takes
+ *  - path: path of the node, which the print takes
+ *  - path_len: length of the path
+ */
+static void add_node(snapshotPrint *print, int *capacity, snapshotNode *node, char *path, size_t path_len) {
+    if (node->nodeType == T_FILE || node->nodeType == T_DIRECTORY) {
+        char *line = malloc(path_len + 1);
+        assert__(line != NULL, "Error: couldn't allocate the print tasks!\n")
+        memcpy(line, path, path_len);
+        line[path_len] = '\n';
+        add_task(print, capacity, (printTask) {.buffer = line, .used = path_len + 1, .capacity = path_len + 1, .done = 1});
+    }
+
+    if (node->n_entries == 0) {
+        snapshot_node_free(node);
+        free(path);
+        return;
+    }
+    add_task(print, capacity, (printTask) {.dir = node, .path = path, .path_len = path_len, .first = 0,
+                                           .last = node->n_entries});
+}
+
+
+/*
+ * Splits the snapshot into tasks, in the order their text goes in the output. The entries below
+ * the root are listed one level at a time until there are enough to give every thread several
+ * ranges of them, which keeps the threads busy when the subtrees have different sizes.
+ * Input:
+ *  - print: print to plan
+ *  - threads: number of threads that will print it
+ */
+static void plan_print(snapshotPrint *print, int threads) {
+    int capacity = 0, target = threads > 1 ? threads * SNAPSHOT_PRINT_TASKS : 1;
+    long entries = 0;
+
+    /* the root has an empty path */
+    char *root_path = malloc(1);
+    assert__(root_path != NULL, "Error: couldn't allocate the print tasks!\n")
+    add_node(print, &capacity, snapshot_node(FS_ROOT), root_path, 0);
+
+    for (int level = 0; ; level++) {
+        entries = 0;
+        for (int i = 0; i < print->n_tasks; i++)
+            if (print->tasks[i].dir != NULL) entries += print->tasks[i].last - print->tasks[i].first;
+        if (entries == 0 || entries >= target || level == SNAPSHOT_PRINT_LEVELS) break;
+
+        /* the entries of this level become the tasks of the next one */
+        printTask *tasks = print->tasks;
+        int n_tasks = print->n_tasks;
+        print->tasks = NULL;
+        print->n_tasks = capacity = 0;
+
+        for (int i = 0; i < n_tasks; i++) {
+            if (tasks[i].dir == NULL) {
+                add_task(print, &capacity, tasks[i]);
+                continue;
+            }
+            for (int j = 0; j < tasks[i].last; j++) {
+                DirEntry *entry = &tasks[i].dir->entries[j];
+                size_t name_len = strlen(entry->name), path_len = tasks[i].path_len + 1 + name_len;
+                char *path = malloc(path_len + 1);
+                assert__(path != NULL, "Error: couldn't allocate the print tasks!\n")
+                memcpy(path, tasks[i].path, tasks[i].path_len);
+                path[tasks[i].path_len] = '/';
+                memcpy(path + tasks[i].path_len + 1, entry->name, name_len);
+                add_node(print, &capacity, snapshot_node(entry->inumber), path, path_len);
+            }
+            snapshot_node_free(tasks[i].dir);
+            free(tasks[i].path);
+        }
+        free(tasks);
+    }
+
+    if (entries <= target) return;
+
+    /* directories with more entries than a task should have are split in ranges */
+    int range = (entries + target - 1) / target;
+    printTask *tasks = print->tasks;
+    int n_tasks = print->n_tasks;
+    print->tasks = NULL;
+    print->n_tasks = capacity = 0;
+
+    for (int i = 0; i < n_tasks; i++) {
+        add_task(print, &capacity, tasks[i]);
+        if (tasks[i].dir == NULL) continue;
+
+        print->tasks[print->n_tasks - 1].last = tasks[i].last < range ? tasks[i].last : range;
+        for (int first = range; first < tasks[i].last; first += range) {
+            printTask task = tasks[i];
+            task.first = first;
+            task.last = first + range < tasks[i].last ? first + range : tasks[i].last;
+            add_task(print, &capacity, task);
+        }
+    }
+    free(tasks);
+}
+
+
+/*
+ * Prints the tasks of a print until none is left. Runs on the thread printing and on its helpers.
+ * Input:
+ *  - ptr: print the tasks are in
+ */
+static void *print_tasks(void *ptr) {
+    snapshotPrint *print = ptr;
+
+    for (;;) {
+        int index = __atomic_fetch_add(&print->next_task, 1, __ATOMIC_RELAXED);
+        if (index >= print->n_tasks) break;
+
+        /* paths found while planning are output as they are */
+        if (print->tasks[index].dir == NULL) continue;
+        print_entries(print, index);
+
+        assert__(pthread_mutex_lock(&print->lock) == 0, "Error: print_tasks failed to lock!\n")
+        print->tasks[index].done = 1;
+        assert__(pthread_mutex_unlock(&print->lock) == 0, "Error: print_tasks failed to unlock!\n")
+        print_advance(print, -1);
+    }
+    return NULL;
+}
+
+
+/*
+ * Prints the tree as it was when this was called, while other threads keep changing it. Subtrees
+ * are printed by several threads at once, each to its own buffer, and the buffers are output in
+ * the order of the tree, so the text is the same as a single thread would print.
+ * Input:
+ *  - print: print with its output set, which gets the rest
+ */
+static void print_tree(snapshotPrint *print) {
+    int threads = print_threads > 0 ? print_threads : (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) threads = 1;
+    if (threads > SNAPSHOT_PRINT_THREADS) threads = SNAPSHOT_PRINT_THREADS;
+
+    assert__(pthread_mutex_init(&print->lock, NULL) == 0, "Error: couldn't init print lock!\n")
+    snapshot_take(NULL, NULL);
+    plan_print(print, threads);
+
+    /* there is no use for more helpers than there are ranges to give them */
+    int ranges = 0, helpers = 0;
+    for (int i = 0; i < print->n_tasks; i++) ranges += print->tasks[i].dir != NULL;
+    pthread_t helper_ids[SNAPSHOT_PRINT_THREADS];
+    while (helpers < threads - 1 && helpers < ranges - 1 &&
+           pthread_create(&helper_ids[helpers], NULL, print_tasks, print) == 0)
+        helpers++;
+
+    print_tasks(print);
+    for (int i = 0; i < helpers; i++) pthread_join(helper_ids[i], NULL);
+    snapshot_release();
+
+    /* a print that only has paths never had a range to output them after */
+    print_advance(print, -1);
+
+    for (int i = 0; i < print->n_tasks; i++) {
+        printTask *task = &print->tasks[i];
+        if (task->dir != NULL && task->first == 0) {
+            snapshot_node_free(task->dir);
+            free(task->path);
+        }
+    }
+    free(print->tasks);
+    pthread_mutex_destroy(&print->lock);
+}
+
+
+/*
+ * Prints the tree as it was when this was called, while other threads keep changing it.
+ * Input:
+ *  - fd: output file
+ * Returns: SUCCESS or FAIL (if the file can't be written)
+ */
+int snapshot_print(int fd) {
+    snapshotPrint print = {.fd = fd};
+    print_tree(&print);
+    return print.failed ? FAIL : SUCCESS;
+}
+
+
+/*
+ * Prints the tree to memory, as it was when this was called, while other threads keep changing it.
+ * Input:
+ *  - buffer: where the text is stored, to be freed by the caller
+ *  - size: where the size of the text is stored
+ * Returns: SUCCESS
+ */
+int snapshot_print_buffer(char **buffer, size_t *size) {
+    snapshotPrint print = {.fd = -1};
+    print_tree(&print);
+
+    *buffer = print.text;
+    *size = print.offset;
+    return SUCCESS;
+}
@@ -0,0 +1,99 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "state.h"
+
+/* inode i of the snapshot is protected by lock i % SNAPSHOT_LOCKS */
+#define SNAPSHOT_LOCKS 256
+
+/* phases of a snapshot */
+#define SNAPSHOT_OFF 0
+#define SNAPSHOT_STARTING 1  /* waiting for the changes that started before it */
+#define SNAPSHOT_TAKEN 2
+
+/* marks an inode the printer is done with, which no longer needs to be preserved */
+#define SNAPSHOT_DONE ((snapshotNode *) 1)
+
+/* a print is written in pieces of this size, from a buffer aligned to SNAPSHOT_PRINT_ALIGN */
+#define SNAPSHOT_PRINT_BUFFER (1024 * 1024)
+#define SNAPSHOT_PRINT_ALIGN 4096
+
+/* most threads a print uses, and the number of tasks it tries to give each one */
+#define SNAPSHOT_PRINT_THREADS 16
+#define SNAPSHOT_PRINT_TASKS 16
+
+/* most levels of the tree a print goes through to find enough entries to split between its threads */
+#define SNAPSHOT_PRINT_LEVELS 8
+
+
+/*
+ * State an inode had when the snapshot was taken, kept once the inode is about to change.
+ */
+typedef struct snapshotNode {
+    type nodeType;
+    int n_entries;
+    DirEntry *entries;  /* entries of a directory, in the order they are listed */
+} snapshotNode;
+
+/*
+ * Part of a print: the path of a node, or a range of the entries of a directory with everything
+ * below them.
+ * Its text is kept until the text of the tasks before it is output.
+ */
+typedef struct printTask {
+    snapshotNode *dir;  /* directory whose entries are printed, NULL if the task is just the path in its buffer */
+    char *path;  /* path of the directory, without '\0' */
+    size_t path_len;
+    int first, last;  /* range of the entries */
+    char *buffer;  /* text waiting to be output */
+    size_t used, capacity;
+    uint64_t offset;  /* where the text goes in the output */
+    int done;
+} printTask;
+
+/*
+ * Print of the tree being written.
+ */
+typedef struct snapshotPrint {
+    int fd;  /* output file, -1 to keep the text in memory */
+    char *text;  /* text of a print to memory */
+    size_t capacity;
+    printTask *tasks;  /* in the order their text is output */
+    int n_tasks;
+    int next_task;  /* first task no thread took yet */
+    int written;  /* tasks before this one were output */
+    uint64_t offset;  /* size of the text output so far */
+    int failed;
+    pthread_mutex_t lock;
+} snapshotPrint;
+
+/*
+ * Directory whose entries are being printed.
+ */
+typedef struct printFrame {
+    snapshotNode *node;
+    int next;  /* index of the next entry to print */
+    int end;  /* index after the last entry to print */
+    size_t path_len;  /* length of the directory's path */
+} printFrame;
+
+
+extern int print_threads;
+
+
+void snapshot_init();
+void snapshot_destroy();
+void snapshot_change_begin();
+void snapshot_change_end();
+void snapshot_preserve(int inumber);
+void snapshot_take(void (*quiet)(void *), void *arg);
+snapshotNode *snapshot_node(int inumber);
+void snapshot_node_free(snapshotNode *node);
+void snapshot_release();
+int snapshot_print(int fd);
+int snapshot_print_buffer(char **buffer, size_t *size);
+
+
+#endif /* SNAPSHOT_H */
@@ -2,10 +2,33 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "state.h"
+#include "epoch.h"
+#include "snapshot.h"
 
 
-/* table that has all inodes */
-inode_t inode_table[INODE_TABLE_SIZE];
+/* table that has all inodes, in the store if there is one. its free_batches is a lock-free stack
+ * of free inode batches: the low 32 bits hold the inumber of the first inode of the top batch
+ * and the high 32 bits hold a tag that changes on every update (avoids ABA) */
+inodeTable *inode_table = NULL;
+
+/* where the chunks of the table are, and the state of their inodes in this run */
+inode_t *inode_chunks[MAX_INODE_CHUNKS];
+inodeSync *sync_chunks[MAX_INODE_CHUNKS];
+
+/* serializes the growth of the inode table */
+pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* each thread keeps a few free inodes for itself, so most creates and deletes don't touch
+ * shared memory */
+__thread inodeMagazine magazine;
+
+/* magazines of the threads that have used theirs, and what protects the list */
+inodeMagazine *magazines = NULL;
+pthread_mutex_t magazines_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* empties the magazine of a thread that exits (see magazine_exit) */
+pthread_key_t magazine_key;
+pthread_once_t magazine_key_once = PTHREAD_ONCE_INIT;
 
 
 /*
@@ -17,29 +40,530 @@ void insert_delay(int cycles) {
 
 
 /*
- * Initializes the i-nodes table.
+ * Gets the inode with the given inumber. The inumber must be inside the table.
+ */
+static inline inode_t *inode_at(int inumber) {
+    return &inode_chunks[inumber / INODE_CHUNK_SIZE][inumber % INODE_CHUNK_SIZE];
+}
+
+
+/*
+ * Gets the state in this run of the inode with the given inumber, which must be inside the table.
+ */
+static inline inodeSync *inode_sync(int inumber) {
+    return &sync_chunks[inumber / INODE_CHUNK_SIZE][inumber % INODE_CHUNK_SIZE];
+}
+
+
+/*
+ * Gets the data of an i-node from its reference. The locks of a directory kept in the store are
+ * set up the first time it is used in this run.
+ */
+static inline union Data data_of(type nType, pstoreRef ref) {
+    union Data data;
+
+    data.dirEntries = pstore_ptr(ref);
+    if (nType == T_DIRECTORY && data.dirEntries != NULL) dir_table_attach(data.dirEntries);
+    return data;
+}
+
+
+/*
+ * Checks if an inumber identifies an inode that is in use.
+ * Input:
+ *  - inumber: identifier of the i-node
+ * Returns: 1 if it is in use and 0 otherwise
+ */
+static int inode_exists(int inumber) {
+    if (inumber < 0 || inumber >= __atomic_load_n(&inode_table->size, __ATOMIC_ACQUIRE)) return 0;
+    return inode_at(inumber)->nodeType != T_NONE;
+}
+
+
+/*
+ * Builds the tagged top of the free batch stack.
  */
-void inode_table_init() {
-    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
-        inode_table[i].nodeType = T_NONE;
-        inode_table[i].data.dirEntries = NULL;
-        inode_table[i].data.fileContents = NULL;
+static inline uint64_t free_batches_top(uint64_t old, int inumber) {
+    return (((old >> 32) + 1) << 32) | (uint32_t) inumber;
+}
+
+
+/*
+ * Pushes a batch of free inodes, already linked through next_free, to the shared stack.
+ * Input:
+ *  - first: identifier of the first i-node of the batch
+ */
+static void free_batches_push(int first) {
+    uint64_t old = __atomic_load_n(&inode_table->free_batches, __ATOMIC_RELAXED);
+    do {
+        __atomic_store_n(&inode_at(first)->next_batch, (int) (uint32_t) old, __ATOMIC_RELAXED);
+    } while (! __atomic_compare_exchange_n(&inode_table->free_batches, &old, free_batches_top(old, first), 1,
+                                           __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+
+/*
+ * Pops a batch of free inodes from the shared stack.
+ * Returns:
+ *  inumber: identifier of the first i-node of the batch
+ *     FAIL: if there are no free batches
+ */
+static int free_batches_pop() {
+    uint64_t old = __atomic_load_n(&inode_table->free_batches, __ATOMIC_ACQUIRE);
+    int first;
+    do {
+        first = (int) (uint32_t) old;
+        if (first == FREE_INODE) return FAIL;
+        /* the inode may have been popped (and reused) meanwhile, but then the tag changed */
+    } while (! __atomic_compare_exchange_n(&inode_table->free_batches, &old,
+                                           free_batches_top(old, __atomic_load_n(&inode_at(first)->next_batch, __ATOMIC_RELAXED)), 1,
+                                           __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+    return first;
+}
+
+
+/*
+ * Creates the state in this run of a chunk of inodes, unlocked.
+ * Returns: the state or NULL (if there is no memory left)
+ */
+static inodeSync *sync_chunk_create() {
+    inodeSync *chunk = malloc(sizeof(inodeSync) * INODE_CHUNK_SIZE);
+    if (chunk == NULL) return NULL;
+
+    for (int i = 0; i < INODE_CHUNK_SIZE; i++) {
+        assert__(pthread_rwlock_init(&chunk[i].lock, NULL) == 0, "Error: couldn't init inode lock!\n")
+        chunk[i].generation = 0;
+        chunk[i].seq = 0;
     }
+    return chunk;
+}
+
+
+/*
+ * Adds a new chunk to the inode table. The first batch of new inodes goes to the calling
+ * thread's magazine and the others to the shared stack.
+ * Returns: SUCCESS or FAIL
+ */
+static int inode_table_grow() {
+    assert__(pthread_mutex_lock(&table_lock) == 0, "Error: inode_table_grow failed to lock!\n")
+
+    int first = inode_table->size;
+    int n_chunk = first / INODE_CHUNK_SIZE;
+
+    if (n_chunk == MAX_INODE_CHUNKS) {
+        assert__(pthread_mutex_unlock(&table_lock) == 0, "Error: inode_table_grow failed to unlock!\n")
+        return FAIL;
+    }
+
+    inode_t *chunk = pstore_alloc(sizeof(inode_t) * INODE_CHUNK_SIZE);
+    inodeSync *sync = sync_chunk_create();
+    if (chunk == NULL || sync == NULL) {
+        pstore_free(chunk, sizeof(inode_t) * INODE_CHUNK_SIZE);
+        free(sync);
+        assert__(pthread_mutex_unlock(&table_lock) == 0, "Error: inode_table_grow failed to unlock!\n")
+        return FAIL;
+    }
+
+    for (int i = 0; i < INODE_CHUNK_SIZE; i++) {
+        chunk[i].nodeType = T_NONE;
+        chunk[i].data = 0;
+        /* links the inodes of each batch */
+        chunk[i].next_free = (i + 1) % INODE_BATCH == 0 ? FREE_INODE : first + i + 1;
+    }
+
+    /* the chunk has to be visible before the new size is */
+    inode_chunks[n_chunk] = chunk;
+    sync_chunks[n_chunk] = sync;
+    inode_table->chunks[n_chunk] = pstore_ref(chunk);
+    __atomic_store_n(&inode_table->size, first + INODE_CHUNK_SIZE, __ATOMIC_RELEASE);
+
+    assert__(pthread_mutex_unlock(&table_lock) == 0, "Error: inode_table_grow failed to unlock!\n")
+
+    /* lowest inumbers are handed out first, so the first inode ever created is the root */
+    for (int i = 0; i < INODE_BATCH; i++)
+        magazine.inumbers[magazine.count++] = first + INODE_BATCH - 1 - i;
+    for (int i = INODE_CHUNK_SIZE - INODE_BATCH; i > 0; i -= INODE_BATCH)
+        free_batches_push(first + i);
+
+    return SUCCESS;
+}
+
+
+/*
+ * Gives the inodes of a magazine to the shared stack. magazines_lock must be held.
+ */
+static void magazine_flush(inodeMagazine *mag) {
+    if (mag->count == 0) return;
+
+    for (int i = 0; i < mag->count - 1; i++) inode_at(mag->inumbers[i])->next_free = mag->inumbers[i + 1];
+    inode_at(mag->inumbers[mag->count - 1])->next_free = FREE_INODE;
+    free_batches_push(mag->inumbers[0]);
+    mag->count = 0;
 }
 
 
 /*
- * Releases the allocated memory for the i-nodes tables.
+ * Takes a magazine out of the list. magazines_lock must be held.
+ */
+static void magazine_unlist(inodeMagazine *mag) {
+    if (mag->prev != NULL) mag->prev->next = mag->next;
+    else magazines = mag->next;
+    if (mag->next != NULL) mag->next->prev = mag->prev;
+    mag->listed = 0;
+}
+
+
+/*
+ * Gives the free inodes of a thread that exits back, so that they are not lost.
+ * Input:
+ *  - ptr: magazine of the thread
+ */
+static void magazine_exit(void *ptr) {
+    inodeMagazine *mag = ptr;
+
+    assert__(pthread_mutex_lock(&magazines_lock) == 0, "Error: magazine_exit failed to lock!\n")
+    /* a destroyed table already took it out */
+    if (mag->listed) {
+        magazine_flush(mag);
+        magazine_unlist(mag);
+    }
+    assert__(pthread_mutex_unlock(&magazines_lock) == 0, "Error: magazine_exit failed to unlock!\n")
+}
+
+
+/*
+ * Creates the key that calls magazine_exit, once.
+ */
+static void magazine_key_create() {
+    assert__(pthread_key_create(&magazine_key, magazine_exit) == 0, "Error: couldn't create the magazine key!\n")
+}
+
+
+/*
+ * Lists the calling thread's magazine, the first time it is used after the table was created.
+ */
+static inline void magazine_list() {
+    if (magazine.listed) return;
+
+    pthread_once(&magazine_key_once, magazine_key_create);
+    pthread_setspecific(magazine_key, &magazine);
+
+    assert__(pthread_mutex_lock(&magazines_lock) == 0, "Error: magazine_list failed to lock!\n")
+    magazine.prev = NULL;
+    magazine.next = magazines;
+    if (magazines != NULL) magazines->prev = &magazine;
+    magazines = &magazine;
+    magazine.listed = 1;
+    assert__(pthread_mutex_unlock(&magazines_lock) == 0, "Error: magazine_list failed to unlock!\n")
+}
+
+
+/*
+ * Takes an inode from the calling thread's magazine, refilling it when it is empty.
+ * Returns:
+ *  inumber: identifier of the free inode
+ *     FAIL: if there are no free inodes
+ */
+static int inode_pop_free() {
+    magazine_list();
+    if (magazine.count == 0) {
+        int inumber = free_batches_pop();
+
+        if (inumber == FAIL) return inode_table_grow() == SUCCESS ? magazine.inumbers[--magazine.count] : FAIL;
+
+        /* stacks the batch so that its first inode is handed out first */
+        int count = 0;
+        for (int i = inumber; i != FREE_INODE; i = inode_at(i)->next_free) count++;
+        magazine.count = count;
+        for (int i = inumber; i != FREE_INODE; i = inode_at(i)->next_free) magazine.inumbers[--count] = i;
+    }
+    return magazine.inumbers[--magazine.count];
+}
+
+
+/*
+ * Puts an inode back in the calling thread's magazine. When the magazine is full, half of it
+ * goes to the shared stack.
+ * Input:
+ *  - inumber: identifier of the i-node
+ */
+static void inode_release(int inumber) {
+    magazine_list();
+    if (magazine.count == 2 * INODE_BATCH) {
+        int first = magazine.inumbers[INODE_BATCH];
+        for (int i = INODE_BATCH; i < 2 * INODE_BATCH - 1; i++)
+            inode_at(magazine.inumbers[i])->next_free = magazine.inumbers[i + 1];
+        inode_at(magazine.inumbers[2 * INODE_BATCH - 1])->next_free = FREE_INODE;
+        free_batches_push(first);
+        magazine.count = INODE_BATCH;
+    }
+    magazine.inumbers[magazine.count++] = inumber;
+}
+
+
+/*
+ * Marks an inode as being changed. Its type and data can only be changed after this.
+ */
+static inline void inode_write_begin(inodeSync *sync) {
+    __atomic_store_n(&sync->seq, sync->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+
+/*
+ * Marks the end of a change to an inode.
+ */
+static inline void inode_write_end(inodeSync *sync) {
+    __atomic_store_n(&sync->seq, sync->seq + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Releases a directory table once no lookup can be reading it (see epoch_retire).
+ */
+static void release_dir_table(void *dir) {
+    dir_table_destroy(dir);
+}
+
+
+/*
+ * Checks if an entry of a directory being recovered can be kept: its name must be whole and match
+ * its hash, and it must lead to an inode in use that no other entry leads to.
+ */
+static int entry_recoverable(DirEntry *entry, char *reached) {
+    int inumber = entry->inumber;
+
+    if (memchr(entry->name, '\0', MAX_FILE_NAME) == NULL || entry->name[0] == '\0' ||
+        entry->hash != dir_name_hash(entry->name))
+        return 0;
+    if (inumber <= FS_ROOT || inumber >= inode_table->size || reached[inumber]) return 0;
+    return inode_at(inumber)->nodeType == T_FILE || inode_at(inumber)->nodeType == T_DIRECTORY;
+}
+
+
+/*
+ * Checks if a name was already seen in a directory being recovered, and adds it to the names seen
+ * if it wasn't.
+ * Input:
+ *  - dir: directory table
+ *  - names: slots of the names seen, by hash, FREE_INODE where there is none
+ *  - mask: number of buckets of names minus one
+ *  - slot: slot of the entry with the name
+ * Returns: 1 if it was seen and 0 otherwise
+ */
+static int name_seen(DirTable *dir, int *names, unsigned int mask, int slot) {
+    DirEntry *entry = dir_table_slot(dir, slot);
+
+    for (unsigned int i = entry->hash & mask; ; i = (i + 1) & mask) {
+        if (names[i] == FREE_INODE) {
+            names[i] = slot;
+            return 0;
+        }
+        if (strcmp(dir_table_slot(dir, names[i])->name, entry->name) == 0) return 1;
+    }
+}
+
+
+/*
+ * Recovers the inode table of a store the server didn't close (see pstore_open). Only what the
+ * root reaches is kept: entries that lead nowhere, repeat a name or lead to an inode another entry
+ * already leads to are cleared, and inodes no entry leads to are freed. The store then takes back
+ * the memory of everything else, and the indexes of the directories and the free inodes are
+ * rebuilt.
+ */
+static void inode_table_recover() {
+    int size = inode_table->size, kept = 0, freed = 0;
+    char *reached = calloc(size + 1, 1);
+    int *dirs = malloc(sizeof(int) * (size + 1));  /* directories reached, walked in the order they were */
+    int n_dirs = 0;
+
+    assert__(reached != NULL && dirs != NULL, "Error: couldn't allocate memory to recover the store!\n")
+    assert__(pstore_keep(pstore_ref(inode_table), sizeof(inodeTable)) == SUCCESS,
+             "Error: the store can't be recovered!\n")
+    for (int i = 0; i < size / INODE_CHUNK_SIZE; i++)
+        assert__(pstore_keep(inode_table->chunks[i], sizeof(inode_t) * INODE_CHUNK_SIZE) == SUCCESS,
+                 "Error: the store can't be recovered!\n")
+
+    /* without a root nothing is reached, and a new one is created (see init_fs) */
+    if (size > FS_ROOT && inode_at(FS_ROOT)->nodeType == T_DIRECTORY && dir_table_keep(inode_at(FS_ROOT)->data) != FAIL) {
+        reached[FS_ROOT] = 1;
+        dirs[n_dirs++] = FS_ROOT;
+    }
+
+    for (int d = 0; d < n_dirs; d++) {
+        DirTable *dir = pstore_ptr(inode_at(dirs[d])->data);
+        unsigned int n_names = 1;
+        while (n_names < 2 * (unsigned int) dir->used) n_names *= 2;
+
+        int *names = malloc(sizeof(int) * n_names);
+        assert__(names != NULL, "Error: couldn't allocate memory to recover the store!\n")
+        for (unsigned int i = 0; i < n_names; i++) names[i] = FREE_INODE;
+
+        for (int slot = 0; slot < dir->used; slot++) {
+            DirEntry *entry = dir_table_slot(dir, slot);
+            if (entry->inumber == FREE_INODE) continue;
+
+            int keep = entry_recoverable(entry, reached) && ! name_seen(dir, names, n_names - 1, slot);
+            inode_t *inode = keep ? inode_at(entry->inumber) : NULL;
+
+            if (keep && inode->nodeType == T_DIRECTORY) {
+                keep = dir_table_keep(inode->data) != FAIL;
+                if (keep) dirs[n_dirs++] = entry->inumber;
+            } else if (keep && inode->data != 0 && file_data_keep(inode->data) == FAIL) {
+                /* contents that can't be the file's are dropped, leaving it empty */
+                inode->data = 0;
+            }
+
+            if (keep) reached[entry->inumber] = 1;
+            else {
+                entry->inumber = FREE_INODE;
+                entry->name[0] = '\0';
+            }
+        }
+        free(names);
+    }
+
+    for (int i = 0; i < size; i++) {
+        kept += reached[i];
+        if (reached[i] || inode_at(i)->nodeType == T_NONE) continue;
+        inode_at(i)->nodeType = T_NONE;
+        inode_at(i)->data = 0;
+        freed++;
+    }
+
+    file_blocks_forget();
+    pstore_recover();
+
+    for (int d = 0; d < n_dirs; d++)
+        assert__(dir_table_rebuild(pstore_ptr(inode_at(dirs[d])->data)) == SUCCESS,
+                 "Error: couldn't allocate memory to recover the store!\n")
+    inode_table_loaded();
+
+    fprintf(stderr, "Warning: recovered the store, %d i-nodes were kept and %d lost ones were freed\n", kept, freed);
+    free(reached);
+    free(dirs);
+}
+
+
+/*
+ * Initializes the i-nodes table, or takes the one left in the store. Only the state of the inodes
+ * in this run is set up, the inodes themselves are used as they are.
+ * Returns: 1 if the table already has a root and 0 otherwise
+ */
+int inode_table_init() {
+    pstoreRef *root = pstore_root(PSTORE_ROOT_INODES);
+
+    if (*root == 0) {
+        /* the store has nothing of a tree yet, so all of its memory is free */
+        if (pstore_dirty()) pstore_recover();
+        inode_table = pstore_calloc(sizeof(inodeTable));
+        assert__(inode_table != NULL, "Error: couldn't allocate the inode table!\n")
+        inode_table->free_batches = (uint32_t) FREE_INODE;
+        *root = pstore_ref(inode_table);
+        return 0;
+    }
+
+    inode_table = pstore_ptr(*root);
+    for (int i = 0; i < inode_table->size / INODE_CHUNK_SIZE; i++) {
+        inode_chunks[i] = pstore_ptr(inode_table->chunks[i]);
+        sync_chunks[i] = sync_chunk_create();
+        assert__(sync_chunks[i] != NULL, "Error: couldn't allocate the inode table!\n")
+    }
+
+    /* a store the server didn't close is recovered before anything uses it */
+    if (pstore_dirty()) inode_table_recover();
+    return inode_table->size > FS_ROOT && inode_at(FS_ROOT)->nodeType != T_NONE;
+}
+
+
+/*
+ * Releases the allocated memory for the i-nodes tables. With a store, the inodes stay in it along
+ * with the free ones every thread kept for itself. No thread may be using the table.
  */
 void inode_table_destroy() {
-    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
-        if (inode_table[i].nodeType != T_NONE) {
-            /* as data is an union, the same pointer is used for both dirEntries and fileContents */
-            /* just release one of them */
-	        if (inode_table[i].data.dirEntries)
-                free(inode_table[i].data.dirEntries);
+    int persistent = pstore_persistent();
+
+    for (int i = 0; i < inode_table->size; i++) {
+        inode_t *inode = inode_at(i);
+        if (! persistent && inode->nodeType == T_DIRECTORY)
+            dir_table_destroy(pstore_ptr(inode->data));
+        else if (! persistent && inode->nodeType == T_FILE)
+            file_data_destroy(pstore_ptr(inode->data));
+        pthread_rwlock_destroy(&inode_sync(i)->lock);
+    }
+
+    /* the free inodes every thread kept for itself stay in the store */
+    assert__(pthread_mutex_lock(&magazines_lock) == 0, "Error: inode_table_destroy failed to lock!\n")
+    while (magazines != NULL) {
+        if (persistent) magazine_flush(magazines);
+        magazines->count = 0;
+        magazine_unlist(magazines);
+    }
+    assert__(pthread_mutex_unlock(&magazines_lock) == 0, "Error: inode_table_destroy failed to unlock!\n")
+
+    for (int i = 0; i < inode_table->size / INODE_CHUNK_SIZE; i++) {
+        if (! persistent) pstore_free(inode_chunks[i], sizeof(inode_t) * INODE_CHUNK_SIZE);
+        free(sync_chunks[i]);
+        inode_chunks[i] = NULL;
+        sync_chunks[i] = NULL;
+    }
+    file_blocks_destroy();
+    if (! persistent) pstore_free(inode_table, sizeof(inodeTable));
+    inode_table = NULL;
+    magazine.count = 0;
+}
+
+
+/*
+ * Puts an i-node in the table with a given inumber, while a tree is loaded (see checkpoint.c).
+ * Nothing else may use the table until inode_table_loaded.
+ * Input:
+ *  - inumber: identifier the i-node had when the tree was saved
+ *  - nType: the type of the node (file or directory)
+ *  - data: where the data of the new i-node is stored
+ * Returns: SUCCESS or FAIL (if the inumber is taken or there is no memory left)
+ */
+int inode_load(int inumber, type nType, union Data *data) {
+    if (inumber < 0 || (nType != T_FILE && nType != T_DIRECTORY)) return FAIL;
+    while (inumber >= inode_table->size) {
+        /* growing hands out free inodes, which are only set up once the tree is loaded */
+        magazine.count = 0;
+        if (inode_table_grow() == FAIL) return FAIL;
+    }
+
+    inode_t *inode = inode_at(inumber);
+    if (inode->nodeType != T_NONE) return FAIL;
+
+    data->dirEntries = NULL;
+    if (nType == T_DIRECTORY && (data->dirEntries = dir_table_create()) == NULL) return FAIL;
+
+    inode->data = pstore_ref(data->dirEntries);
+    inode->nodeType = nType;
+    return SUCCESS;
+}
+
+
+/*
+ * Makes the i-nodes that weren't loaded free again, so that the lowest ones are handed out first.
+ */
+void inode_table_loaded() {
+    int first = FREE_INODE, count = 0;
+
+    inode_table->free_batches = (uint32_t) FREE_INODE;
+    magazine.count = 0;
+
+    for (int i = inode_table->size - 1; i >= 0; i--) {
+        if (inode_at(i)->nodeType != T_NONE) continue;
+
+        inode_at(i)->next_free = first;
+        first = i;
+        if (++count == INODE_BATCH) {
+            free_batches_push(first);
+            first = FREE_INODE;
+            count = 0;
         }
     }
+    if (first != FREE_INODE) free_batches_push(first);
 }
 
 
@@ -56,36 +580,28 @@ int inode_create(type nType) {
     /* Used for testing synchronization speedup */
     insert_delay(DELAY);
 
-    for (int inumber = 0; inumber < INODE_TABLE_SIZE; inumber++) {
-
-        /* locks for reading because we are accessing shared information. zero was used instead
-         * of an error code because we don't want to test for both EBUSY and EDEADLK. makes things
-         * way simpler. the objective is to find an empty node so we only need to check when
-         * a node has not been locked before */
-        if (pthread_rwlock_trywrlock(&inode_table[inumber].lock) != 0) continue;
+    int inumber = inode_pop_free();
+    if (inumber == FAIL) return FAIL;
 
-        if (inode_table[inumber].nodeType == T_NONE) {
-            inode_table[inumber].nodeType = nType;
+    inode_t *inode = inode_at(inumber);
+    inodeSync *sync = inode_sync(inumber);
+    DirTable *entries = NULL;
 
-            if (nType == T_DIRECTORY) {
-                /* Initializes entry table */
-                inode_table[inumber].data.dirEntries = malloc(sizeof(DirEntry) * MAX_DIR_ENTRIES);
-                
-                for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-                    inode_table[inumber].data.dirEntries[i].inumber = FREE_INODE;
-                }
-            }
-            else {
-                inode_table[inumber].data.fileContents = NULL;
-            }
-            /* unlocks previously locked inode */
-            unlock(inumber);
-            return inumber;
+    if (nType == T_DIRECTORY) {
+        /* Initializes entry table */
+        entries = dir_table_create();
+        if (entries == NULL) {
+            inode_release(inumber);
+            return FAIL;
         }
-        /* unlocks previously locked inode */
-        unlock(inumber);
     }
-    return FAIL;
+
+    inode_write_begin(sync);
+    inode->data = pstore_ref(entries);
+    inode->nodeType = nType;
+    inode_write_end(sync);
+
+    return inumber;
 }
 
 
@@ -99,16 +615,34 @@ int inode_delete(int inumber) {
     /* Used for testing synchronization speedup */
     insert_delay(DELAY);
 
-    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_table[inumber].nodeType == T_NONE)) {
+    if (! inode_exists(inumber)) {
         printf("inode_delete: invalid inumber\n");
         return FAIL;
     } 
 
-    inode_table[inumber].nodeType = T_NONE;
+    inode_t *inode = inode_at(inumber);
+    inodeSync *sync = inode_sync(inumber);
+
+    type nType = inode->nodeType;
+    union Data data = data_of(nType, inode->data);
+
+    /* a print or checkpoint that is running may still have to list the inode (see snapshot.c) */
+    snapshot_change_begin();
+    snapshot_preserve(inumber);
+    inode_write_begin(sync);
+    inode->nodeType = T_NONE;
+    inode->data = 0;
+    inode_write_end(sync);
+    snapshot_change_end();
     unlock(inumber);
-    /* see inode_table_destroy function */
-    if (inode_table[inumber].data.dirEntries)
-        free(inode_table[inumber].data.dirEntries);
+
+    /* lookups that don't lock may still be reading the entries (see inode_table_destroy) */
+    if (nType == T_DIRECTORY)
+        epoch_retire(data.dirEntries, release_dir_table);
+    else
+        file_data_destroy(data.fileContents);
+
+    inode_release(inumber);
     return SUCCESS;
 }
 
@@ -126,60 +660,186 @@ int inode_get(int inumber, type *nType, union Data *data) {
     /* Used for testing synchronization speedup */
     insert_delay(DELAY);
 
-    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_table[inumber].nodeType == T_NONE)) {
+    if (! inode_exists(inumber)) {
         printf("inode_get: invalid inumber %d\n", inumber);
         return FAIL;
     }
 
     /* copies node data */
-    if (nType) *nType = inode_table[inumber].nodeType;
-    if (data) *data = inode_table[inumber].data;
+    if (nType) *nType = inode_at(inumber)->nodeType;
+    if (data) *data = data_of(inode_at(inumber)->nodeType, inode_at(inumber)->data);
+
+    return SUCCESS;
+}
+
+
+/*
+ * Copies the type and data of an i-node without locking it, for lookups that don't lock.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - nType: pointer to type
+ *  - data: pointer to data
+ * Returns: SUCCESS or FAIL (if the i-node was being created or deleted meanwhile)
+ */
+int inode_get_optimistic(int inumber, type *nType, union Data *data) {
+    if (inumber < 0 || inumber >= __atomic_load_n(&inode_table->size, __ATOMIC_ACQUIRE)) return FAIL;
+
+    inode_t *inode = inode_at(inumber);
+    inodeSync *sync = inode_sync(inumber);
+    unsigned int seq = __atomic_load_n(&sync->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) return FAIL;
+
+    type read_type = __atomic_load_n(&inode->nodeType, __ATOMIC_RELAXED);
+    pstoreRef ref = __atomic_load_n(&inode->data, __ATOMIC_RELAXED);
 
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&sync->seq, __ATOMIC_RELAXED) != seq) return FAIL;
+
+    /* the data only matches the type once both are known to be from the same version */
+    *nType = read_type;
+    *data = data_of(read_type, ref);
     return SUCCESS;
 }
 
 
 /*
- * Resets an entry for a directory.
+ * Gets the contents of a file, creating them if it is still empty. The caller must hold the
+ * i-node's write lock.
+ * Input:
+ *  - inumber: identifier of the i-node
+ * Returns: the contents or NULL (if the i-node isn't a file or there is no memory left)
+ */
+static FileData *file_contents(int inumber) {
+    if (! inode_exists(inumber) || inode_at(inumber)->nodeType != T_FILE) return NULL;
+
+    inode_t *inode = inode_at(inumber);
+    /* lookups that don't lock read the reference while checking the type of the i-node */
+    if (inode->data == 0)
+        __atomic_store_n(&inode->data, pstore_ref(file_data_create()), __ATOMIC_RELAXED);
+    return pstore_ptr(inode->data);
+}
+
+
+/*
+ * Replaces the contents of a file. The caller must hold the i-node's write lock.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - fileContents: new contents
+ *  - len: size of the new contents
+ * Returns: SUCCESS or FAIL
+ */
+int inode_set_file(int inumber, char *fileContents, int len) {
+    FileData *file = file_contents(inumber);
+
+    if (file == NULL || len < 0 || file_data_truncate(file, 0) == FAIL) return FAIL;
+    return file_data_write(file, 0, fileContents, len) == len ? SUCCESS : FAIL;
+}
+
+
+/*
+ * Writes to a file at a given offset. The caller must hold the i-node's write lock.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - offset: where the write starts
+ *  - buffer: bytes that are written
+ *  - len: number of bytes
+ * Returns: number of bytes written or FAIL
+ */
+long inode_write(int inumber, size_t offset, char *buffer, size_t len) {
+    FileData *file = file_contents(inumber);
+
+    if (file == NULL) return FAIL;
+    return file_data_write(file, offset, buffer, len);
+}
+
+
+/*
+ * Reads from a file at a given offset. The caller must hold the i-node's read lock.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - offset: where the read starts
+ *  - buffer: where the bytes are copied to
+ *  - len: maximum number of bytes
+ * Returns: number of bytes read or FAIL (if the i-node isn't a file)
+ */
+long inode_read(int inumber, size_t offset, char *buffer, size_t len) {
+    if (! inode_exists(inumber) || inode_at(inumber)->nodeType != T_FILE) return FAIL;
+
+    FileData *file = pstore_ptr(inode_at(inumber)->data);
+    return file != NULL ? file_data_read(file, offset, buffer, len) : 0;
+}
+
+
+/*
+ * Changes the size of a file. The caller must hold the i-node's write lock.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - size: new size
+ * Returns: SUCCESS or FAIL
+ */
+int inode_truncate(int inumber, size_t size) {
+    FileData *file = file_contents(inumber);
+
+    if (file == NULL) return FAIL;
+    return file_data_truncate(file, size);
+}
+
+
+/*
+ * Resets an entry for a directory. The caller must hold the directory's write lock, or its
+ * read lock and the write lock of the entry (see dir_table_lock).
  * Input:
  *  - inumber: identifier of the i-node
  *  - sub_inumber: identifier of the sub i-node entry
+ *  - sub_name: name of the sub i-node entry
  * Returns: SUCCESS or FAIL
  */
-int dir_reset_entry(int inumber, int sub_inumber) {
+int dir_reset_entry(int inumber, int sub_inumber, char *sub_name) {
     /* Used for testing synchronization speedup */
     insert_delay(DELAY);
 
-    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_table[inumber].nodeType == T_NONE)) {
+    if (! inode_exists(inumber)) {
         printf("inode_reset_entry: invalid inumber\n");
         return FAIL;
     }
 
-    if (inode_table[inumber].nodeType != T_DIRECTORY) {
+    if (inode_at(inumber)->nodeType != T_DIRECTORY) {
         printf("inode_reset_entry: can only reset entry to directories\n");
         return FAIL;
     }
 
-    if ((sub_inumber < FREE_INODE) || (sub_inumber > INODE_TABLE_SIZE) || (inode_table[sub_inumber].nodeType == T_NONE)) {
+    if (! inode_exists(sub_inumber)) {
         printf("inode_reset_entry: invalid entry inumber\n");
         return FAIL;
     }
 
-    for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (inode_table[inumber].data.dirEntries[i].inumber == sub_inumber) {
-            inode_table[inumber].data.dirEntries[i].inumber = FREE_INODE;
-            inode_table[inumber].data.dirEntries[i].name[0] = '\0';
-            return SUCCESS;
-        }
-    }
+    /* a print or checkpoint that is running may still have to list the old entries (see snapshot.c) */
+    snapshot_change_begin();
+    snapshot_preserve(inumber);
+    int res = dir_table_remove(data_of(T_DIRECTORY, inode_at(inumber)->data).dirEntries, sub_name, sub_inumber);
+    snapshot_change_end();
 
-    return FAIL;
+    if (res == FAIL) return FAIL;
 
+    /* names cached for this directory may have just become stale */
+    __atomic_add_fetch(&inode_sync(inumber)->generation, 1, __ATOMIC_RELEASE);
+    return SUCCESS;
 }
 
 
 /*
- * Adds an entry to the i-node directory data.
+ * Gets the generation of an i-node, which changes every time an entry is removed from it.
+ * Input:
+ *  - inumber: identifier of the i-node
+ */
+unsigned int inode_generation(int inumber) {
+    return __atomic_load_n(&inode_sync(inumber)->generation, __ATOMIC_ACQUIRE);
+}
+
+
+/*
+ * Adds an entry to the i-node directory data. The caller must hold the directory's write lock,
+ * or its read lock and the write lock of the entry (see dir_table_lock).
  * Input:
  *  - inumber: identifier of the i-node
  *  - sub_inumber: identifier of the sub i-node entry
@@ -190,17 +850,17 @@ int dir_add_entry(int inumber, int sub_inumber, char *sub_name) {
     /* Used for testing synchronization speedup */
     insert_delay(DELAY);
 
-    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_table[inumber].nodeType == T_NONE)) {
+    if (! inode_exists(inumber)) {
         printf("inode_add_entry: invalid inumber\n");
         return FAIL;
     }
 
-    if (inode_table[inumber].nodeType != T_DIRECTORY) {
+    if (inode_at(inumber)->nodeType != T_DIRECTORY) {
         printf("inode_add_entry: can only add entry to directories\n");
         return FAIL;
     }
 
-    if ((sub_inumber < 0) || (sub_inumber > INODE_TABLE_SIZE) || (inode_table[sub_inumber].nodeType == T_NONE)) {
+    if (! inode_exists(sub_inumber)) {
         printf("inode_add_entry: invalid entry inumber\n");
         return FAIL;
     }
@@ -210,41 +870,13 @@ int dir_add_entry(int inumber, int sub_inumber, char *sub_name) {
         return FAIL;
     }
     
-    for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (inode_table[inumber].data.dirEntries[i].inumber == FREE_INODE) {
-            inode_table[inumber].data.dirEntries[i].inumber = sub_inumber;
-            strcpy(inode_table[inumber].data.dirEntries[i].name, sub_name);
-            return SUCCESS;
-        }
-    }
-    return FAIL;
-}
+    /* a print or checkpoint that is running may still have to list the old entries (see snapshot.c) */
+    snapshot_change_begin();
+    snapshot_preserve(inumber);
+    int res = dir_table_add(data_of(T_DIRECTORY, inode_at(inumber)->data).dirEntries, sub_name, sub_inumber);
+    snapshot_change_end();
 
-
-/*
- * Prints the i-nodes table.
- * Input:
- *  - inumber: identifier of the i-node
- *  - name: pointer to the name of current file/dir
- */
-void inode_print_tree(FILE *fp, int inumber, char *name) {
-    if (inode_table[inumber].nodeType == T_FILE) {
-        fprintf(fp, "%s\n", name);
-        return;
-    }
-
-    if (inode_table[inumber].nodeType == T_DIRECTORY) {
-        fprintf(fp, "%s\n", name);
-        for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-            if (inode_table[inumber].data.dirEntries[i].inumber != FREE_INODE) {
-                char path[MAX_FILE_NAME];
-                if (snprintf(path, sizeof(path), "%s/%s", name, inode_table[inumber].data.dirEntries[i].name) > sizeof(path)) {
-                    fprintf(stderr, "truncation when building full path\n");
-                }
-                inode_print_tree(fp, inode_table[inumber].data.dirEntries[i].inumber, path);
-            }
-        }
-    }
+    return res;
 }
 
 
@@ -257,7 +889,7 @@ void inode_print_tree(FILE *fp, int inumber, char *name) {
  *   - SUCCESS: if locking was successful
  * */
 int lock_read(int inumber) {
-    if (pthread_rwlock_rdlock(&inode_table[inumber].lock) != 0) {
+    if (pthread_rwlock_rdlock(&inode_sync(inumber)->lock) != 0) {
         fprintf(stderr, "Error: failed to lock (read) inode!\n");
         return FAIL;
     }
@@ -274,7 +906,7 @@ int lock_read(int inumber) {
  *   - SUCCESS: if locking was successful
  * */
 int lock_write(int inumber) {
-    if(pthread_rwlock_wrlock(&inode_table[inumber].lock) != 0) {
+    if(pthread_rwlock_wrlock(&inode_sync(inumber)->lock) != 0) {
         fprintf(stderr, "Error: failed to lock (write) inode!\n");
         return FAIL;
     }
@@ -290,7 +922,7 @@ int lock_write(int inumber) {
  *   - FAIL: if locking was unsuccessful
  *   - SUCCESS: if locking was successful
  * */
-int trylock_read(int inumber) { return pthread_rwlock_tryrdlock(&inode_table[inumber].lock); }
+int trylock_read(int inumber) { return pthread_rwlock_tryrdlock(&inode_sync(inumber)->lock); }
 
 
 /*
@@ -301,7 +933,7 @@ int trylock_read(int inumber) { return pthread_rwlock_tryrdlock(&inode_table[inu
  *   - FAIL: if locking was unsuccessful
  *   - SUCCESS: if locking was successful
  * */
-int trylock_write(int inumber) { return pthread_rwlock_trywrlock(&inode_table[inumber].lock); }
+int trylock_write(int inumber) { return pthread_rwlock_trywrlock(&inode_sync(inumber)->lock); }
 
 
 /*
@@ -313,7 +945,7 @@ int trylock_write(int inumber) { return pthread_rwlock_trywrlock(&inode_table[in
  *   - SUCCESS: if unlocking was successful
  * */
 int unlock(int inumber) {
-    if(pthread_rwlock_unlock(&inode_table[inumber].lock) != 0) {
+    if(pthread_rwlock_unlock(&inode_sync(inumber)->lock) != 0) {
         fprintf(stderr, "Error: failed to unlock inode!\n");
         return FAIL;
     }
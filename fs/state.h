@@ -4,16 +4,25 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "../tecnicofs-api-constants.h"
+#include "pstore.h"
+#include "directory.h"
+#include "filedata.h"
 #include <pthread.h>
 #include <errno.h>
+#include <stdint.h>
 
 
 /* FS root inode number */
 #define FS_ROOT 0
 
 #define FREE_INODE (-1)
-#define INODE_TABLE_SIZE 50
-#define MAX_DIR_ENTRIES 20
+
+/* the inode table grows in chunks so that inode addresses never change */
+#define INODE_CHUNK_SIZE 1024
+#define MAX_INODE_CHUNKS 4096
+
+/* free inodes move between threads in batches of this size */
+#define INODE_BATCH 32
 
 #define SUCCESS 0
 #define FAIL (-1)
@@ -24,41 +33,70 @@
 
 
 /*
- * Contains the name of the entry and respective i-number
- */
-typedef struct dirEntry {
-	char name[MAX_FILE_NAME];
-	int inumber;
-} DirEntry;
-
-/*
- * Data is either text (file) or entries (DirEntry)
+ * Data is either contents (file) or entries (DirTable)
  */
 union Data {
-	char *fileContents; /* for files */
-	DirEntry *dirEntries; /* for directories */
+	FileData *fileContents; /* for files, NULL while they are empty */
+	DirTable *dirEntries; /* for directories */
 };
 
 /*
- * I-node definition
+ * I-node definition. The inode table may live in a persistent store, so the data is reached
+ * through a reference and what only matters while the server runs is kept apart (see inodeSync).
  */
 typedef struct inode_t {    
 	type nodeType;
-	union Data data;
-    pthread_rwlock_t lock;
+	pstoreRef data;  /* FileData (file, 0 while it is empty) or DirTable (directory) */
+    int next_free;  /* next inode in the same free batch, while this one is free */
+    int next_batch;  /* next free batch, while this one is the first of a batch */
 } inode_t;
 
+/*
+ * State of an i-node that starts over every time the server runs.
+ */
+typedef struct inodeSync {
+    pthread_rwlock_t lock;
+    unsigned int generation;  /* changes every time an entry is removed from this directory */
+    unsigned int seq;  /* odd while the inode is being created or deleted */
+} inodeSync;
+
+/*
+ * Free inodes a thread keeps for itself. Magazines are listed, so that their inodes go back to
+ * the shared stack when their thread exits or the table is destroyed.
+ */
+typedef struct inodeMagazine {
+    int inumbers[2 * INODE_BATCH];
+    int count;
+    int listed;
+    struct inodeMagazine *prev, *next;
+} inodeMagazine;
+
+/*
+ * Table that has all inodes, a root of the store. Chunks are allocated on demand.
+ */
+typedef struct inodeTable {
+    int size;  /* number of inodes in the table (always a multiple of INODE_CHUNK_SIZE) */
+    uint64_t free_batches;  /* stack of free inode batches (see state.c) */
+    pstoreRef chunks[MAX_INODE_CHUNKS];
+} inodeTable;
+
 
 void insert_delay(int cycles);
-void inode_table_init();
+int inode_table_init();
 void inode_table_destroy();
 int inode_create(type nType);
+int inode_load(int inumber, type nType, union Data *data);
+void inode_table_loaded();
 int inode_delete(int inumber);
 int inode_get(int inumber, type *nType, union Data *data);
+int inode_get_optimistic(int inumber, type *nType, union Data *data);
 int inode_set_file(int inumber, char *fileContents, int len);
-int dir_reset_entry(int inumber, int sub_inumber);
+long inode_write(int inumber, size_t offset, char *buffer, size_t len);
+long inode_read(int inumber, size_t offset, char *buffer, size_t len);
+int inode_truncate(int inumber, size_t size);
+int dir_reset_entry(int inumber, int sub_inumber, char *sub_name);
+unsigned int inode_generation(int inumber);
 int dir_add_entry(int inumber, int sub_inumber, char *sub_name);
-void inode_print_tree(FILE *fp, int inumber, char *name);
 int lock_read(int inumber);
 int trylock_read(int inumber);
 int lock_write(int inumber);
@@ -0,0 +1,354 @@
+#define _GNU_SOURCE  /* fallocate */
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+#include "operations.h"
+#include "wal.h"
+
+/*
+ * Redo log. Every create, delete and move that succeeds is appended to a buffer while its inodes
+ * are still locked, so changes that depend on each other are recorded in the order they happened.
+ * The buffer is written to the log file by whichever thread first needs its records to be durable,
+ * with a single write and fdatasync for every record appended until then, and the other threads
+ * wait for that write instead of making their own (group commit). Starting the server replays the
+ * log on the tree, from where the last checkpoint left it (see checkpoint.c).
+ *
+ * Records are found by their offset in the file, which never changes: the part of the log a
+ * checkpoint covers is punched out of the file instead of being removed from its start.
+ */
+
+/* file of the log, -1 while there is none or while it is replayed */
+int log_fd = -1;
+
+/* records waiting to be written, and the buffer the thread writing the ones before them uses */
+char *log_buffer = NULL, *log_spare = NULL;
+size_t log_used = 0, log_capacity = 0, log_spare_capacity = 0;
+
+/* identifier of the log, which checkpoints of its tree keep */
+uint64_t log_id = 0;
+
+/* offset in the file where the records appended so far end, and where the durable ones end */
+uint64_t log_appended = 0, log_durable = 0;
+
+/* if a thread is writing the log */
+int log_flushing = 0;
+
+/* protects everything above but the file */
+pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* signaled when a write of the log ends */
+pthread_cond_t log_written = PTHREAD_COND_INITIALIZER;
+
+/* bytes of the log the calling thread's last record ends at */
+__thread uint64_t thread_lsn = 0;
+
+
+/*
+ * Checksum of a record or a checkpoint (FNV-1a), which can be computed in parts.
+ * Input:
+ *  - hash: WAL_CHECKSUM_INIT, or the checksum of the bytes before these
+ *  - bytes: bytes to add
+ *  - size: number of bytes
+ */
+uint32_t wal_checksum(uint32_t hash, const char *bytes, size_t size) {
+    for (size_t i = 0; i < size; i++) hash = (hash ^ (unsigned char) bytes[i]) * 16777619u;
+    return hash;
+}
+
+
+/*
+ * Applies the records of a log to the tree.
+ * Input:
+ *  - bytes: records of the log, after its header
+ *  - size: number of bytes
+ * Returns: number of bytes taken by whole records, where the log must continue
+ */
+static size_t replay(char *bytes, size_t size) {
+    size_t offset = 0;
+    char path_1[MAX_FILE_NAME], path_2[MAX_FILE_NAME];
+    walRecord record;
+
+    while (size - offset >= sizeof(walRecord)) {
+        memcpy(&record, bytes + offset, sizeof(walRecord));
+
+        size_t len = sizeof(walRecord) + record.path_len[0] + record.path_len[1];
+        size_t checked = sizeof(record.checksum);
+
+        if (record.path_len[0] >= MAX_FILE_NAME || record.path_len[1] >= MAX_FILE_NAME || size - offset < len ||
+            wal_checksum(WAL_CHECKSUM_INIT, bytes + offset + checked, len - checked) != record.checksum)
+            break;
+
+        memcpy(path_1, bytes + offset + sizeof(walRecord), record.path_len[0]);
+        path_1[record.path_len[0]] = '\0';
+        memcpy(path_2, bytes + offset + sizeof(walRecord) + record.path_len[0], record.path_len[1]);
+        path_2[record.path_len[1]] = '\0';
+
+        int res = FAIL;
+        switch (record.op) {
+            case WAL_CREATE:
+                res = create(path_1, record.node_type);
+                break;
+            case WAL_DELETE:
+                res = delete(path_1);
+                break;
+            case WAL_MOVE:
+                res = move(path_1, path_2);
+                break;
+        }
+        if (res == FAIL) fprintf(stderr, "Warning: couldn't replay '%c %s %s' from the log\n", record.op, path_1, path_2);
+
+        offset += len;
+    }
+
+    return offset;
+}
+
+
+/*
+ * Opens a log file, creating it if it doesn't exist, and replays it on the tree. Creates, deletes
+ * and moves are logged from then on.
+ * Input:
+ *  - path: path of the file
+ *  - id: identifier of the log the tree was checkpointed from, 0 if there is no checkpoint
+ *  - start: where the records the checkpoint doesn't have start
+ * Returns: SUCCESS or FAIL (if the file can't be read or isn't the log of the checkpoint)
+ */
+int wal_open(char *path, uint64_t id, uint64_t start) {
+    struct stat file_stat;
+    walHeader header = {WAL_MAGIC, WAL_VERSION, 0, id};
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+    if (fd == -1) return FAIL;
+    if (fstat(fd, &file_stat) != 0) goto close_file;
+
+    if (file_stat.st_size == 0) {
+        /* a checkpoint without its log would lose the changes after it */
+        if (id != 0) {
+            fprintf(stderr, "Error: %s is missing, but its checkpoint is not!\n", path);
+            goto close_file;
+        }
+        while (header.id == 0)
+            if (getrandom(&header.id, sizeof(header.id), 0) != sizeof(header.id)) goto close_file;
+        if (write(fd, &header, sizeof(walHeader)) != sizeof(walHeader) || fdatasync(fd) != 0) goto close_file;
+        start = sizeof(walHeader);
+    } else {
+        size_t size = file_stat.st_size;
+        walHeader found;
+
+        if (pread(fd, &found, sizeof(walHeader), 0) != sizeof(walHeader) || found.magic != WAL_MAGIC ||
+            found.version != WAL_VERSION) {
+            fprintf(stderr, "Error: %s is not a tecnicofs log!\n", path);
+            goto close_file;
+        }
+        if ((id != 0 && found.id != id) || start > size) {
+            fprintf(stderr, "Error: %s is not the log its checkpoint was taken from!\n", path);
+            goto close_file;
+        }
+        header.id = found.id;
+        if (start < sizeof(walHeader)) start = sizeof(walHeader);
+
+        /* the records after the checkpoint are read at once */
+        char *bytes = malloc(size - start + 1);
+        if (bytes == NULL) goto close_file;
+        if (pread(fd, bytes, size - start, start) != (ssize_t) (size - start)) {
+            free(bytes);
+            goto close_file;
+        }
+
+        size_t end = start + replay(bytes, size - start);
+        free(bytes);
+
+        /* a crash can cut the last record, which was never acknowledged */
+        if (end < size) {
+            fprintf(stderr, "Warning: %s ends with an incomplete record, which is dropped\n", path);
+            if (ftruncate(fd, end) != 0 || fdatasync(fd) != 0) goto close_file;
+        }
+        start = end;
+    }
+
+    if (lseek(fd, start, SEEK_SET) == -1) goto close_file;
+
+    log_buffer = malloc(WAL_BUFFER_SIZE);
+    log_spare = malloc(WAL_BUFFER_SIZE);
+    if (log_buffer == NULL || log_spare == NULL) {
+        free(log_buffer);
+        free(log_spare);
+        goto close_file;
+    }
+    log_capacity = log_spare_capacity = WAL_BUFFER_SIZE;
+    log_used = 0;
+    log_appended = log_durable = start;
+    log_id = header.id;
+    log_fd = fd;
+    return SUCCESS;
+
+close_file:
+    close(fd);
+    return FAIL;
+}
+
+
+/*
+ * Writes the records waiting in the buffer to the log. The log lock must be held, and is released
+ * while the records are written.
+ */
+static void flush() {
+    char *bytes = log_buffer;
+    size_t size = log_used, capacity = log_capacity;
+    uint64_t end = log_appended;
+
+    /* records appended meanwhile go to the other buffer */
+    log_flushing = 1;
+    log_buffer = log_spare;
+    log_capacity = log_spare_capacity;
+    log_used = 0;
+    pthread_mutex_unlock(&log_lock);
+
+    for (size_t written = 0; written < size; ) {
+        ssize_t res = write(log_fd, bytes + written, size - written);
+        assert__(res > 0, "Error: couldn't write the log!\n")
+        written += res;
+    }
+    assert__(fdatasync(log_fd) == 0, "Error: couldn't sync the log!\n")
+
+    pthread_mutex_lock(&log_lock);
+    log_spare = bytes;
+    log_spare_capacity = capacity;
+    __atomic_store_n(&log_durable, end, __ATOMIC_RELEASE);
+    log_flushing = 0;
+    pthread_cond_broadcast(&log_written);
+}
+
+
+/*
+ * Writes every record to the log and closes it. Nothing may be logged meanwhile.
+ */
+void wal_close() {
+    if (log_fd == -1) return;
+
+    pthread_mutex_lock(&log_lock);
+    while (log_flushing) pthread_cond_wait(&log_written, &log_lock);
+    if (log_used > 0) flush();
+    pthread_mutex_unlock(&log_lock);
+
+    close(log_fd);
+    free(log_buffer);
+    free(log_spare);
+    log_fd = -1;
+    log_buffer = log_spare = NULL;
+}
+
+
+/*
+ * Appends a change to the log, without waiting for it to be written. The inodes the change uses
+ * must still be locked, so that it is recorded before any change that depends on it.
+ * Input:
+ *  - op: one of WAL_*
+ *  - path_1: path the change is made on
+ *  - path_2: new path of a move, NULL otherwise
+ *  - nodeType: type of the node, for creates
+ */
+void wal_log(int op, char *path_1, char *path_2, type nodeType) {
+    if (log_fd == -1) return;
+
+    walRecord record;
+    size_t len_1 = strlen(path_1), len_2 = path_2 != NULL ? strlen(path_2) : 0;
+    size_t size = sizeof(walRecord) + len_1 + len_2;
+    size_t checked = sizeof(record.checksum);
+
+    record.op = op;
+    record.node_type = nodeType;
+    record.path_len[0] = len_1;
+    record.path_len[1] = len_2;
+    record.reserved = 0;
+
+    pthread_mutex_lock(&log_lock);
+
+    /* the buffer only grows while a write takes longer than filling it */
+    if (log_used + size > log_capacity) {
+        size_t capacity = log_capacity * 2;
+        while (log_used + size > capacity) capacity *= 2;
+        char *buffer = realloc(log_buffer, capacity);
+        assert__(buffer != NULL, "Error: couldn't grow the log buffer!\n")
+        log_buffer = buffer;
+        log_capacity = capacity;
+    }
+
+    char *bytes = log_buffer + log_used;
+    memcpy(bytes, &record, sizeof(walRecord));
+    memcpy(bytes + sizeof(walRecord), path_1, len_1);
+    if (len_2 > 0) memcpy(bytes + sizeof(walRecord) + len_1, path_2, len_2);
+    record.checksum = wal_checksum(WAL_CHECKSUM_INIT, bytes + checked, size - checked);
+    memcpy(bytes, &record.checksum, checked);
+
+    log_used += size;
+    log_appended += size;
+    thread_lsn = log_appended;
+
+    pthread_mutex_unlock(&log_lock);
+}
+
+
+/*
+ * Waits until the log is durable up to an offset, writing it if no other thread is.
+ * Input:
+ *  - lsn: offset in the log
+ */
+void wal_sync(uint64_t lsn) {
+    if (log_fd == -1 || lsn <= __atomic_load_n(&log_durable, __ATOMIC_ACQUIRE)) return;
+
+    pthread_mutex_lock(&log_lock);
+    while (log_durable < lsn) {
+        /* the thread that writes takes every record appended so far, its own and everyone else's */
+        if (! log_flushing) flush();
+        else pthread_cond_wait(&log_written, &log_lock);
+    }
+    pthread_mutex_unlock(&log_lock);
+}
+
+
+/*
+ * Waits until every change the calling thread logged is durable. Replies to a change are only
+ * sent after this.
+ */
+void wal_commit() {
+    wal_sync(thread_lsn);
+}
+
+
+/*
+ * Gets where the records appended so far end. Records of the changes that finish later are
+ * after it.
+ */
+uint64_t wal_mark() {
+    pthread_mutex_lock(&log_lock);
+    uint64_t mark = log_appended;
+    pthread_mutex_unlock(&log_lock);
+    return mark;
+}
+
+
+/*
+ * Gets the identifier of the log, 0 if there is none.
+ */
+uint64_t wal_id() {
+    return log_fd != -1 ? log_id : 0;
+}
+
+
+/*
+ * Frees the space of the records before an offset, which a durable checkpoint already has. The
+ * file keeps its size and the offsets of the records after it.
+ * Input:
+ *  - lsn: offset in the log
+ */
+void wal_discard(uint64_t lsn) {
+    off_t start = WAL_PAGE, end = lsn & ~((uint64_t) WAL_PAGE - 1);
+
+    /* filesystems that can't punch holes keep the whole log */
+    if (log_fd != -1 && end > start)
+        fallocate(log_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, start, end - start);
+}
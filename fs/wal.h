@@ -0,0 +1,60 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "state.h"
+
+/* first bytes of a log file, and version of its layout */
+#define WAL_MAGIC 0x3130676f4c736674ULL  /* "tfsLog01" */
+#define WAL_VERSION 2
+
+/* changes a log records, the same letters as the commands that make them */
+#define WAL_CREATE 'c'
+#define WAL_DELETE 'd'
+#define WAL_MOVE 'm'
+
+/* the first page of a log file, which has its header, is never discarded */
+#define WAL_PAGE 4096
+
+/* starting value of a checksum */
+#define WAL_CHECKSUM_INIT 2166136261u
+
+/* size the buffer of records waiting to be written starts with */
+#define WAL_BUFFER_SIZE (64 * 1024)
+
+
+/*
+ * Start of a log file.
+ */
+typedef struct walHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t id;  /* random, tells this log from others (see checkpoint.c) */
+} walHeader;
+
+/*
+ * Header of a record, followed by its paths without '\0'.
+ */
+typedef struct walRecord {
+    uint32_t checksum;  /* of the rest of the record, tells a record cut by a crash from a whole one */
+    uint8_t op;  /* one of WAL_* */
+    uint8_t node_type;  /* type of the node, for creates */
+    uint16_t path_len[2];  /* length of each path, 0 for paths the op doesn't use */
+    uint16_t reserved;
+} walRecord;
+
+
+uint32_t wal_checksum(uint32_t hash, const char *bytes, size_t size);
+int wal_open(char *path, uint64_t id, uint64_t start);
+void wal_close();
+void wal_log(int op, char *path_1, char *path_2, type nodeType);
+void wal_sync(uint64_t lsn);
+void wal_commit();
+uint64_t wal_mark();
+uint64_t wal_id();
+void wal_discard(uint64_t lsn);
+
+
+#endif /* WAL_H */
@@ -1,13 +1,29 @@
+#define _GNU_SOURCE  /* recvmmsg, sendmmsg and ppoll */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
 #include "fs/operations.h"
+#include "fs/wal.h"
+#include "fs/checkpoint.h"
+#include "fs/snapshot.h"
+#include "tecnicofs-protocol.h"
+#include "tecnicofs-ring.h"
+#include "uring.h"
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
 #include <strings.h>
 #include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
 
 #define MAX_INPUT_SIZE 100
 
@@ -17,158 +33,1844 @@ int numberThreads = 0;
 /* server socket file descriptor */
 int server_socket_fd;
 
-/* number of threads executing a client request */
-int in_execution = 0;
+/* maximum number of messages a thread receives per system call. 1 receives them one at a time */
+int mmsg_batch = 1;
 
-/* used to signal when a thread is writing contents in a file */
-int is_printing = 0;
+/* microseconds a thread waits for its batch of messages to fill, 0 doesn't wait */
+long flush_timeout = 0;
 
-/* used to lock when checking if client inserted a print request */
-pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t cond_print = PTHREAD_COND_INITIALIZER;
-pthread_cond_t cond_wait = PTHREAD_COND_INITIALIZER;
+/* number of messages each worker queue holds. 0 has every thread receive its own messages */
+int queue_size = 0;
+
+/* if set, clients connect to the server socket instead of sending it datagrams */
+int connected_mode = 0;
+
+/* epoll instance shared by the threads in connected mode */
+int epoll_fd;
+
+/* microseconds a ring thread polls its ring before sleeping. -1 doesn't take rings */
+long ring_spin = -1;
+
+/* socket where clients hand their rings to the server */
+int ring_socket_fd;
+
+/* socket where clients hand their bulk buffers to the server */
+int bulk_socket_fd;
+
+/* bulk buffers of the clients are found by their tokens in this many lists */
+#define BULK_BUCKETS 256
+
+/* clients with messages in the worker queues are found by their addresses in this many lists */
+#define CLIENT_BUCKETS 256
+
+/* walks of the tree kept for dumps at once. starting another drops the one used least recently */
+#define DUMP_LISTINGS 16
+
+/* bits of a dump cursor that have the offset in its listing, the ones above have the listing's id */
+#define DUMP_OFFSET_BITS 40
+
+/* file the tree is kept in between runs of the server, NULL keeps it in memory only */
+char *store_path = NULL;
+
+/* file creates, deletes and moves are logged to before they are answered, NULL doesn't log them */
+char *log_path = NULL;
+
+/* seconds between checkpoints of the tree while there is a log, 0 only takes one when the server stops */
+long checkpoint_interval = 60;
+
+/* threads hold one of these while they execute a command, so the server can stop between commands */
+#define COMMAND_LOCKS 256
+pthread_mutex_t command_locks[COMMAND_LOCKS];
+
+/* number of threads that ever executed a command */
+int command_threads = 0;
+
+/* lock the calling thread holds while it executes a command, picked the first time it does */
+__thread pthread_mutex_t *command_lock = NULL;
+
+/* if set, threads receive and send through io_uring */
+int uring_mode = 0;
+
+/* size of the submission queue of each thread's io_uring */
+#define URING_ENTRIES 256
+
+/* buffers the kernel receives messages into, per thread */
+#define URING_BUFFERS 64
+
+/* replies being sent at once, per thread */
+#define URING_REPLIES 64
+
+/* marks the completions of the multishot receive */
+#define URING_RECV ((__u64) -1)
+
+/* io_uring the calling thread writes prints through, NULL if it uses stdio */
+__thread uring *print_ring = NULL;
+
+/* events a thread takes from epoll at once */
+#define EPOLL_EVENTS 64
+
+/* messages served from a connection before other connections get their turn */
+#define CONNECTION_BUDGET 16
+
+
+/*
+ * Command received from a client, in either format.
+ */
+typedef struct command_t {
+    char token;  /* operation, the same letter as in text commands */
+    char node_type;  /* 'f' or 'd', for creates */
+    char name_1[MAX_FILE_NAME];
+    char name_2[MAX_FILE_NAME];
+    uint64_t offset;  /* where a read or write starts, or the new size for truncates */
+    uint32_t length;  /* bytes read or written */
+    char *data;  /* bytes of a write, or where the bytes of a read go */
+    uint64_t bulk_token;  /* bulk buffer the bytes are in, 0 if they are in the message */
+    uint64_t cursor;  /* cursor of the chunk after the one a dump takes */
+} command_t;
+
+
+/*
+ * Client with messages waiting in a worker queue or being executed. All of them are in the queue
+ * the client is pinned to, and only one runs at a time, so they run in the order they were sent.
+ */
+typedef struct queuedClient {
+    struct sockaddr_un addr;
+    socklen_t addrlen;
+    int queue;  /* queue its messages go to */
+    int pending;  /* messages queued or being executed, it goes when none are left */
+    struct queuedClient *next;  /* next client in the same list */
+} queuedClient;
+
+/* clients with messages in the worker queues, listed by address */
+queuedClient *queued_clients[CLIENT_BUCKETS];
+
+/* protects each list of clients */
+pthread_mutex_t queued_client_locks[CLIENT_BUCKETS];
+
+
+/*
+ * Message received from a client, waiting in a worker queue.
+ */
+typedef struct message_t {
+    struct sockaddr_un addr;  /* where the reply goes */
+    socklen_t addrlen;
+    queuedClient *client;  /* client that sent it */
+    int len;
+    char data[TFS_MAX_BATCH_REQUEST];
+} message_t;
+
+
+/*
+ * Bounded queue of messages for a worker. The dispatcher pushes messages to it and its worker pops
+ * them, unless another worker with nothing to do steals them first. Only a client with a single
+ * message pending can be stolen, along with the messages it sends next.
+ */
+typedef struct workerQueue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    int head;  /* slot of the oldest message */
+    int count;
+    int sleeping;  /* the worker is waiting for messages */
+    int steal;  /* the worker was woken to steal from other queues */
+    message_t *messages;  /* queue_size slots */
+} workerQueue;
+
+/* queue of each worker */
+workerQueue *worker_queues;
+
+
+/*
+ * State of a client connection. Only one thread serves a connection at a time, since its events are
+ * only rearmed once that thread is done with it.
+ */
+typedef struct connection_t {
+    int fd;
+    int pending;  /* size of a reply the client isn't ready to take yet, 0 if there isn't one */
+    char reply[TFS_MAX_REPLY];
+} connection_t;
+
+/* marks the listening socket in epoll events */
+connection_t listener;
+
+
+/*
+ * Reply being sent through io_uring.
+ */
+typedef struct uringReply {
+    struct msghdr msg;
+    struct iovec iov;
+    struct sockaddr_un addr;
+    char data[TFS_MAX_REPLY];
+} uringReply;
+
+
+/*
+ * Ring of a client, served by a thread of its own.
+ */
+typedef struct ringClient {
+    tfsRing *ring;
+    int fd;  /* connection the ring came through, closed by the client when it is done */
+} ringClient;
+
+
+/*
+ * Bulk buffer of a client, mapped while its connection is open.
+ */
+typedef struct bulkBuffer {
+    uint64_t token;
+    char *data;  /* NULL until the client hands its first buffer */
+    size_t size;
+    int fd;  /* connection the buffer came through */
+    pthread_rwlock_t lock;  /* read locked while a request uses the buffer, write locked to replace it */
+    struct bulkBuffer *next;  /* next buffer with a token in the same list */
+} bulkBuffer;
+
+/* bulk buffers, listed by token */
+bulkBuffer *bulk_buffers[BULK_BUCKETS];
+
+/* protects the lists of bulk buffers */
+pthread_mutex_t bulk_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*
+ * Listing of the tree a client is taking in chunks. Only where the walk of the tree stopped is
+ * kept, and each chunk continues it.
+ */
+typedef struct dumpListing {
+    uint32_t id;  /* 0 if the slot has no listing */
+    treeWalk walk;
+    uint64_t offset;  /* bytes listed so far, which the cursor of the next chunk has */
+    uint64_t last_used;  /* dump_clock when a chunk was last taken */
+    int busy;  /* a thread is taking a chunk of it */
+} dumpListing;
+
+/* listings being dumped */
+dumpListing dump_listings[DUMP_LISTINGS];
+
+/* id of the last listing started, and a counter that orders the uses of the listings */
+uint32_t dump_last_id = 0;
+uint64_t dump_clock = 0;
+
+/* protects the listings */
+pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*
+ * Sets socket address and inits everything.
+ *
+ * Input:
+ *   - path: socket path
+ *   - addr: socket address
+ * Output:
+ *   - size of socket
+ * */
+int set_socket_address_unix(char *path, struct sockaddr_un *addr) {
+
+    if (addr == NULL) return 0;  /* interrupts if address is invalid */
+
+    bzero((char *)addr, sizeof(struct sockaddr_un));  /* clears possible values in addr variable */
+    addr->sun_family = AF_UNIX;  /* sets socket domain as unix */
+    strcpy(addr->sun_path, path);  /* copies path to the socket */
+
+    return SUN_LEN(addr);
+}
+
+
+/*
+ * Decodes a binary request into a command.
+ *
+ * Input:
+ *   - request: bytes received from the client
+ *   - len: number of bytes received
+ *   - header: where the header of the request is copied to
+ *   - command: where the decoded command is stored
+ * Output:
+ *   - size of the request or FAIL (if the request is malformed)
+ * */
+int decode_request(char *request, int len, tfsRequestHeader *header, command_t *command) {
+
+    char *names[TFS_MAX_PATHS] = {command->name_1, command->name_2};
+    int offset = sizeof(tfsRequestHeader);
+
+    if (len < (int) sizeof(tfsRequestHeader)) return FAIL;
+    memcpy(header, request, sizeof(tfsRequestHeader));
+
+    /* paths come right after the header, one after the other */
+    for (int i = 0; i < TFS_MAX_PATHS; i++) {
+        int path_len = header->path_len[i];
+        if (path_len >= MAX_FILE_NAME || offset + path_len > len) return FAIL;
+        memcpy(names[i], request + offset, path_len);
+        names[i][path_len] = '\0';
+        offset += path_len;
+    }
+
+    command->token = header->opcode;
+    command->node_type = header->node_type;
+    command->data = NULL;
+    command->bulk_token = 0;
+
+    switch (command->token) {
+        case TFS_OP_CREATE:
+            return command->node_type == 'f' || command->node_type == 'd' ? offset : FAIL;
+        case TFS_OP_DELETE: case TFS_OP_LOOKUP: case TFS_OP_MOVE: case TFS_OP_PRINT:
+            return offset;
+        case TFS_OP_WRITE: case TFS_OP_READ: case TFS_OP_TRUNCATE: case TFS_OP_DUMP: {
+            tfsDataHeader data_header;
+
+            if (offset + (int) sizeof(tfsDataHeader) > len) return FAIL;
+            memcpy(&data_header, request + offset, sizeof(tfsDataHeader));
+            offset += sizeof(tfsDataHeader);
+
+            command->offset = data_header.offset;
+            command->length = data_header.length;
+
+            /* the bytes of a bulk read, write or dump are in the client's bulk buffer */
+            if (data_header.flags & TFS_DATA_BULK) {
+                if (command->token == TFS_OP_TRUNCATE || data_header.bulk_token == 0) return FAIL;
+                command->bulk_token = data_header.bulk_token;
+                return offset;
+            }
+            if (command->length > TFS_MAX_DATA) return FAIL;
+
+            /* the bytes of a write follow the data header */
+            if (command->token == TFS_OP_WRITE) {
+                if (offset + (int) command->length > len) return FAIL;
+                command->data = request + offset;
+                offset += command->length;
+            }
+            return offset;
+        }
+        default:
+            return FAIL;
+    }
+}
+
+
+/*
+ * Prints the tree to a file, writing it through the calling thread's io_uring.
+ *
+ * Input:
+ *   - path: output file path
+ * Output:
+ *   - SUCCESS or FAIL
+ * */
+static int print_tree_uring(char *path) {
+
+    char *buffer;
+    size_t size, written = 0;
+    struct io_uring_cqe *cqe;
+
+    if (print_tecnicofs_tree_buffer(&buffer, &size) == FAIL) return FAIL;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    assert__(fd != -1, "Error: print_tecnico_tree couldn't open output file!\n")
+
+    /* a write can be short, so it goes on from where the last one stopped */
+    while (written < size) {
+        struct io_uring_sqe *sqe = uring_get_sqe(print_ring);
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = fd;
+        sqe->addr = (unsigned long) (buffer + written);
+        sqe->len = size - written;
+        sqe->off = written;
+
+        uring_submit_and_wait(print_ring, 1);
+        while ((cqe = uring_peek_cqe(print_ring)) == NULL) uring_submit_and_wait(print_ring, 1);
+        int res = cqe->res;
+        uring_cqe_seen(print_ring);
+
+        if (res <= 0) {
+            fprintf(stderr, "Error: couldn't write the tree to %s\n", path);
+            break;
+        }
+        written += res;
+    }
+
+    close(fd);
+    free(buffer);
+    return written == size ? SUCCESS : FAIL;
+}
+
+
+/*
+ * Gets the bulk buffer with a given token, which stays read locked until it is released.
+ *
+ * Input:
+ *   - token: token of the buffer
+ * Output:
+ *   - the buffer or NULL (if there is no such buffer)
+ * */
+static bulkBuffer *bulk_acquire(uint64_t token) {
+
+    bulkBuffer *buffer;
+
+    pthread_mutex_lock(&bulk_lock);
+    for (buffer = bulk_buffers[token % BULK_BUCKETS]; buffer != NULL && buffer->token != token; buffer = buffer->next);
+    /* the buffer can't be removed before the list lock is let go, so it is locked first */
+    if (buffer != NULL) pthread_rwlock_rdlock(&buffer->lock);
+    pthread_mutex_unlock(&bulk_lock);
+
+    return buffer;
+}
+
+
+/*
+ * Executes a read or a write whose bytes are in a bulk buffer, straight from or into its mapping.
+ *
+ * Input:
+ *   - command: command to execute
+ * Output:
+ *   - number of bytes read or written, or FAIL
+ * */
+static long execute_bulk(command_t *command) {
+
+    long output = FAIL;
+    bulkBuffer *buffer = bulk_acquire(command->bulk_token);
+
+    if (buffer == NULL) return FAIL;
+
+    if (buffer->data != NULL && command->length <= buffer->size) {
+        if (command->token == TFS_OP_WRITE)
+            output = write_file(command->name_1, command->offset, buffer->data, command->length);
+        else output = read_file(command->name_1, command->offset, buffer->data, command->length);
+    }
+
+    pthread_rwlock_unlock(&buffer->lock);
+    return output;
+}
+
+
+/*
+ * Starts a listing of the tree, for its chunks to be taken.
+ *
+ * Output:
+ *   - the listing, used until it is released with dump_release, or NULL (if every listing is in use)
+ * */
+static dumpListing *dump_start() {
+
+    dumpListing *listing = NULL;
+
+    pthread_mutex_lock(&dump_lock);
+    /* a client that never takes the last chunk of its listing loses it once newer ones need the room */
+    for (int i = 0; i < DUMP_LISTINGS; i++) {
+        dumpListing *slot = &dump_listings[i];
+        if (! slot->busy && (listing == NULL || slot->id == 0 ||
+                             (listing->id != 0 && slot->last_used < listing->last_used)))
+            listing = slot;
+    }
+
+    if (listing != NULL) {
+        if (listing->id != 0) tree_walk_end(&listing->walk);
+        tree_walk_start(&listing->walk);
+        /* ids fill the bits of a cursor above the offset, and are never 0 */
+        do dump_last_id = (dump_last_id + 1) & ((1u << (64 - DUMP_OFFSET_BITS)) - 1);
+        while (dump_last_id == 0);
+
+        listing->id = dump_last_id;
+        listing->offset = 0;
+        listing->last_used = ++dump_clock;
+        listing->busy = 1;
+    }
+    pthread_mutex_unlock(&dump_lock);
+
+    return listing;
+}
+
+
+/*
+ * Gets the listing a dump cursor is in. Only the cursor of the chunk after the last one taken is
+ * valid, as the walk can't go back.
+ *
+ * Input:
+ *   - cursor: cursor the server gave
+ * Output:
+ *   - the listing, used until it is released with dump_release, or NULL (if it was dropped, or
+ *     another chunk of it is being taken)
+ * */
+static dumpListing *dump_acquire(uint64_t cursor) {
+
+    uint32_t id = cursor >> DUMP_OFFSET_BITS;
+    uint64_t offset = cursor & (((uint64_t) 1 << DUMP_OFFSET_BITS) - 1);
+    dumpListing *listing = NULL;
+
+    pthread_mutex_lock(&dump_lock);
+    for (int i = 0; i < DUMP_LISTINGS && listing == NULL; i++)
+        if (id != 0 && dump_listings[i].id == id && ! dump_listings[i].busy && dump_listings[i].offset == offset)
+            listing = &dump_listings[i];
+    if (listing != NULL) {
+        listing->busy = 1;
+        listing->last_used = ++dump_clock;
+    }
+    pthread_mutex_unlock(&dump_lock);
+
+    return listing;
+}
+
+
+/*
+ * Lets go of a listing, dropping it once its last chunk was taken.
+ *
+ * Input:
+ *   - listing: listing from dump_start or dump_acquire
+ *   - finished: if the last chunk of the listing was taken
+ * */
+static void dump_release(dumpListing *listing, int finished) {
+
+    pthread_mutex_lock(&dump_lock);
+    listing->busy = 0;
+    if (finished) {
+        tree_walk_end(&listing->walk);
+        listing->id = 0;
+    }
+    pthread_mutex_unlock(&dump_lock);
+}
+
+
+/*
+ * Copies the next chunk of a listing of the tree, to the reply or to the bulk buffer, starting a
+ * new listing if the cursor is 0.
+ *
+ * Input:
+ *   - command: command to execute, which gets the cursor of the next chunk
+ * Output:
+ *   - number of bytes copied, or FAIL
+ * */
+static long execute_dump(command_t *command) {
+
+    bulkBuffer *buffer = NULL;
+    char *destination = command->data;
+    long output = FAIL;
+
+    if (command->bulk_token != 0) {
+        if ((buffer = bulk_acquire(command->bulk_token)) == NULL) return FAIL;
+        if (buffer->data == NULL || command->length > buffer->size) {
+            pthread_rwlock_unlock(&buffer->lock);
+            return FAIL;
+        }
+        destination = buffer->data;
+    }
+
+    dumpListing *listing = command->offset == 0 ? dump_start() : dump_acquire(command->offset);
+
+    if (listing != NULL) {
+        int finished;
+        output = tree_walk_next(&listing->walk, destination, command->length, &finished);
+        listing->offset += output;
+
+        /* a listing too long for the offset bits of a cursor can't be continued */
+        if (! finished && listing->offset >> DUMP_OFFSET_BITS) {
+            output = FAIL;
+            finished = 1;
+        }
+        command->cursor = finished ? 0 : ((uint64_t) listing->id << DUMP_OFFSET_BITS) | listing->offset;
+        dump_release(listing, finished);
+    }
+
+    if (buffer != NULL) pthread_rwlock_unlock(&buffer->lock);
+    return output;
+}
+
+
+/*
+ * Executes a command.
+ *
+ * Input:
+ *   - command: command to execute
+ * Output:
+ *   - result of the operation (the inumber found, for lookups)
+ * */
+int execute_command(command_t *command) {
+
+    int output;  /* holds command output after execution */
+    char *name_1 = command->name_1, *name_2 = command->name_2;
+
+    /* the server only stops between commands (see awaitShutdown) */
+    if (command_lock == NULL)
+        command_lock = &command_locks[__atomic_fetch_add(&command_threads, 1, __ATOMIC_RELAXED) % COMMAND_LOCKS];
+    pthread_mutex_lock(command_lock);
+
+    switch (command->token) {
+        case 'c':
+
+            switch (command->node_type) {
+                case 'f':
+                    printf("Create file: %s\n", name_1);
+                    output = create(name_1, T_FILE);
+                    break;
+                case 'd':
+                    printf("Create directory: %s\n", name_1);
+                    output = create(name_1, T_DIRECTORY);
+                    break;
+                default:
+                    fprintf(stderr, "Error: invalid node type\n");
+                    exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'l':
+            output = lookup(name_1);
+            if (output >= 0) printf("Search: %s found\n", name_1);
+            else printf("Search: %s not found\n", name_1);
+            break;
+
+        case 'd':
+            printf("Delete: %s\n", name_1);
+            output = delete(name_1);
+            break;
+
+        case 'm':
+            printf("Move: %s\n", name_1);
+            output = move(name_1, name_2);
+            break;
+
+        case 'w':
+            printf("Write: %s\n", name_1);
+            if (command->bulk_token != 0) output = execute_bulk(command);
+            else output = write_file(name_1, command->offset, command->data, command->length);
+            break;
+
+        case 'r':
+            printf("Read: %s\n", name_1);
+            if (command->bulk_token != 0) output = execute_bulk(command);
+            else output = read_file(name_1, command->offset, command->data, command->length);
+            break;
+
+        case 't':
+            printf("Truncate: %s\n", name_1);
+            output = truncate_file(name_1, command->offset);
+            break;
+
+        case 'P':
+            /* the first chunk of a dump starts a walk of the tree, the others continue it */
+            if (command->offset == 0) printf("Dump\n");
+            output = execute_dump(command);
+            break;
+
+        case 'p':
+            /* prints a snapshot of the tree, other threads keep serving requests meanwhile */
+            printf("Print: %s\n", name_1);
+            output = print_ring != NULL ? print_tree_uring(name_1) : print_tecnicofs_tree(name_1);
+            break;
+
+        default: { /* error */
+            fprintf(stderr, "Error: command to apply\n");
+            exit(EXIT_FAILURE);
+        }
+
+    }
+
+    pthread_mutex_unlock(command_lock);
+    return output;
+}
+
+
+/*
+ * Decodes and executes a binary request.
+ *
+ * Input:
+ *   - request: bytes of the request, possibly followed by other requests
+ *   - len: number of bytes available
+ *   - reply: where the reply to the request is stored
+ *   - data: where the bytes of a read, or the cursor and bytes of a dump, are stored, with room for
+ *           TFS_MAX_DATA_REPLY - sizeof(tfsReply) bytes, or NULL if they can't be answered (in batches)
+ *   - data_size: where the number of bytes stored in data is stored, or NULL along with data
+ * Output:
+ *   - size of the request or FAIL (if the request is malformed)
+ * */
+int execute_request(char *request, int len, tfsReply *reply, char *data, int *data_size) {
+
+    tfsRequestHeader header;  /* header of the request */
+    command_t command;  /* request after being decoded */
+
+    int size = decode_request(request, len, &header, &command);
+    int inline_read = size != FAIL && command.token == TFS_OP_READ && command.bulk_token == 0;
+    int dump = size != FAIL && command.token == TFS_OP_DUMP;
+
+    if (data_size != NULL) *data_size = 0;
+    if (size == FAIL || ((inline_read || dump) && data == NULL)) {
+        /* a malformed request only fails itself */
+        fprintf(stderr, "Error: invalid request\n");
+        reply->request_id = len >= (int) sizeof(tfsRequestHeader) ? header.request_id : 0;
+        reply->status = TFS_STATUS_FAIL;
+        reply->inumber = TFS_STATUS_FAIL;
+        return size;
+    }
+    if (inline_read) command.data = data;
+    if (dump && command.bulk_token == 0) command.data = data + sizeof(tfsDumpReply);
+
+    reply->request_id = header.request_id;
+    reply->inumber = execute_command(&command);
+    reply->status = reply->inumber >= 0 ? TFS_STATUS_SUCCESS : TFS_STATUS_FAIL;
+    if (command.token != TFS_OP_LOOKUP && command.token != TFS_OP_READ && command.token != TFS_OP_WRITE && ! dump)
+        reply->inumber = TFS_STATUS_FAIL;
+
+    /* the bytes of a read that isn't bulk follow the reply, and those of a dump follow its cursor */
+    if (inline_read && reply->status == TFS_STATUS_SUCCESS) *data_size = reply->inumber;
+    if (dump && reply->status == TFS_STATUS_SUCCESS) {
+        tfsDumpReply dump_reply = {command.cursor};
+        memcpy(data, &dump_reply, sizeof(tfsDumpReply));
+        *data_size = sizeof(tfsDumpReply) + (command.bulk_token == 0 ? reply->inumber : 0);
+    }
+
+    return size;
+}
+
+
+/*
+ * Executes every request of a batch, in order, and builds a single reply with all their replies.
+ *
+ * Input:
+ *   - request: bytes of the batch
+ *   - len: number of bytes received
+ *   - reply: where the reply to the batch is stored, with room for TFS_MAX_BATCH replies
+ * Output:
+ *   - size of the reply
+ * */
+int execute_batch(char *request, int len, char *reply) {
+
+    tfsBatchHeader header;  /* header of the batch */
+    tfsBatchReply reply_header;  /* header of the reply */
+    tfsReply *replies = (tfsReply *) (reply + sizeof(tfsBatchReply));
+    int offset = sizeof(tfsBatchHeader);
+
+    if (len < (int) sizeof(tfsBatchHeader)) {
+        fprintf(stderr, "Error: invalid batch\n");
+        header.request_id = 0;
+        header.count = 0;
+    } else memcpy(&header, request, sizeof(tfsBatchHeader));
+
+    if (header.count > TFS_MAX_BATCH) header.count = TFS_MAX_BATCH;
+
+    for (int i = 0; i < header.count; i++) {
+        int size = offset == FAIL ? FAIL : execute_request(request + offset, len - offset, &replies[i], NULL, NULL);
+
+        /* where the next request starts is lost, so the ones left fail too */
+        if (size == FAIL) {
+            offset = FAIL;
+            replies[i].status = TFS_STATUS_FAIL;
+            replies[i].inumber = TFS_STATUS_FAIL;
+        } else offset += size;
+    }
+
+    reply_header.request_id = header.request_id;
+    reply_header.count = header.count;
+    memcpy(reply, &reply_header, sizeof(tfsBatchReply));
+
+    return sizeof(tfsBatchReply) + header.count * sizeof(tfsReply);
+}
+
+
+/*
+ * Executes the request of a message, in any of the formats clients use.
+ *
+ * Input:
+ *   - request: bytes received, with room for TFS_MAX_BATCH_REQUEST bytes
+ *   - len: number of bytes received
+ *   - reply: where the reply is stored, with room for TFS_MAX_REPLY bytes
+ * Output:
+ *   - size of the reply
+ * */
+int execute_message(char *request, int len, char *reply) {
+
+    command_t command;  /* text request after being parsed */
+    char name_2[MAX_INPUT_SIZE] = "";
+
+    if ((unsigned char) request[0] == TFS_MAGIC) {
+        int data_size;
+        execute_request(request, len, (tfsReply *) reply, reply + sizeof(tfsReply), &data_size);
+        return sizeof(tfsReply) + data_size;
+    }
+
+    if ((unsigned char) request[0] == TFS_BATCH_MAGIC) return execute_batch(request, len, reply);
+
+    /* text commands keep their old size limit */
+    if (len > MAX_INPUT_SIZE - 1) len = MAX_INPUT_SIZE - 1;
+    request[len] = '\0';  /* prevents client message from not having a '\0' */
+
+    command.token = '\0';
+    int numTokens = sscanf(request, "%c %s %s", &command.token, command.name_1, name_2);
+    strcpy(command.name_2, name_2);
+    command.node_type = name_2[0];
+
+    /* a malformed command only fails itself, like a malformed binary request; reads, writes,
+     * truncates and dumps only exist in the binary protocol */
+    int valid = numTokens >= 2;
+    switch (command.token) {
+        case 'c':
+            valid = valid && numTokens == 3 && (command.node_type == 'f' || command.node_type == 'd');
+            break;
+        case 'm':
+            valid = valid && numTokens == 3;
+            break;
+        case 'l': case 'd': case 'p':
+            break;
+        default:
+            valid = 0;
+    }
+
+    /* text commands are answered with an int */
+    int output = FAIL;
+    if (! valid) fprintf(stderr, "Error: invalid command in Queue\n");
+    else output = execute_command(&command);
+    memcpy(reply, &output, sizeof(int));
+    return sizeof(int);
+}
+
+
+/*
+ * Applies commands received from clients
+ */
+void applyCommands() {
+
+    struct sockaddr_un client_addr;  /* client socket address */
+    int c;  /* holds number of bytes read */
+
+    socklen_t addrlen;  /* size of client socket address */
+
+    char request[TFS_MAX_BATCH_REQUEST];  /* holds request that is going to be executed */
+    char reply[TFS_MAX_REPLY];  /* holds reply to the request */
+
+    /* loop until file has reached it's end */
+    while (1) {
+
+        /* recvfrom shrinks it to the size of the address it got */
+        addrlen = sizeof(struct sockaddr_un);
+
+        /* receives message and gets number of bytes read */
+        c = recvfrom(server_socket_fd, request, sizeof(request), 0,
+                     (struct sockaddr *) &client_addr, &addrlen);
+
+        if (c <= 0) continue;  /* if inputs is invalid, continues */
+
+        int size = execute_message(request, c, reply);
+
+        /* sends reply back to client, once the change it made is in the log */
+        wal_commit();
+        sendto(server_socket_fd, reply, size, 0, (struct sockaddr *) &client_addr, addrlen);
+    }
+}
+
+
+/*
+ * Arms a multishot receive, which keeps receiving messages into the thread's buffers until it
+ * stops.
+ *
+ * Input:
+ *   - ring: io_uring of the thread
+ *   - msg: layout of the received messages
+ * */
+static void uring_arm_receive(uring *ring, struct msghdr *msg) {
+
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = server_socket_fd;
+    sqe->addr = (unsigned long) msg;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = URING_RECV;
+}
+
+
+/*
+ * Applies commands received from clients, receiving and sending through io_uring. Messages are
+ * received by a multishot receive into buffers registered with the kernel, and replies are sent
+ * without waiting for them. Falls back to applyCommands if the kernel can't do it.
+ */
+void applyCommandsUring() {
+
+    uring ring, file_ring;
+    uringBuffers buffers;
+    struct msghdr recv_msg;  /* layout of received messages: only the address and the payload */
+    struct io_uring_cqe *cqe;
+    int received = 0;  /* if any message was received, so the kernel supports multishot receives */
+
+    size_t buffer_size = sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_un) + TFS_MAX_BATCH_REQUEST;
+
+    if (uring_init(&ring, URING_ENTRIES) == FAIL) {
+        fprintf(stderr, "Error: io_uring isn't available, using recvfrom\n");
+        applyCommands();
+        return;
+    }
+    if (uring_buffers_init(&ring, &buffers, URING_BUFFERS, buffer_size, 0) == FAIL) {
+        fprintf(stderr, "Error: io_uring buffer rings aren't available, using recvfrom\n");
+        uring_destroy(&ring);
+        applyCommands();
+        return;
+    }
+
+    /* prints are written through a ring of their own, so their completions don't mix with these */
+    if (uring_init(&file_ring, 4) == SUCCESS) print_ring = &file_ring;
+
+    uringReply *replies = malloc(URING_REPLIES * sizeof(uringReply));
+    int free_replies[URING_REPLIES], n_free = URING_REPLIES;
+    assert__(replies != NULL, "Error: couldn't allocate replies!\n")
+    for (int i = 0; i < URING_REPLIES; i++) free_replies[i] = i;
+
+    memset(&recv_msg, 0, sizeof(recv_msg));
+    recv_msg.msg_namelen = sizeof(struct sockaddr_un);
+    uring_arm_receive(&ring, &recv_msg);
+
+    while (1) {
+        int rearm = 0;
+
+        /* the replies about to be submitted wait for the changes they answer to be in the log */
+        wal_commit();
+        uring_submit_and_wait(&ring, 1);
+
+        while ((cqe = uring_peek_cqe(&ring)) != NULL) {
+            __u64 user_data = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            uring_cqe_seen(&ring);
+
+            /* a reply was sent */
+            if (user_data != URING_RECV) {
+                /* the client's queue is full. the kernel isn't told when a datagram socket without a
+                   peer can send again, so this one waits for the client in sendmsg */
+                if (res == -EAGAIN) res = sendmsg(server_socket_fd, &replies[user_data].msg, 0);
+                if (res < 0) fprintf(stderr, "Error: couldn't send reply!\n");
+                free_replies[n_free++] = user_data;
+                continue;
+            }
+
+            if (! (flags & IORING_CQE_F_MORE)) rearm = 1;
+
+            if (res < 0) {
+                if (res == -EINVAL && ! received) {
+                    fprintf(stderr, "Error: io_uring multishot receives aren't available, using recvfrom\n");
+                    if (print_ring != NULL) uring_destroy(&file_ring);
+                    print_ring = NULL;
+                    uring_buffers_destroy(&ring, &buffers);
+                    uring_destroy(&ring);
+                    free(replies);
+                    applyCommands();
+                    return;
+                }
+                continue;  /* ran out of buffers, the receive is armed again below */
+            }
+            if (! (flags & IORING_CQE_F_BUFFER)) continue;
+            received = 1;
+
+            unsigned id = flags >> IORING_CQE_BUFFER_SHIFT;
+            char *buffer = uring_buffer(&buffers, id);
+            struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *) buffer;
+            char *payload = buffer + sizeof(struct io_uring_recvmsg_out) + recv_msg.msg_namelen;
+            int len = out->payloadlen < TFS_MAX_BATCH_REQUEST ? (int) out->payloadlen : (int) TFS_MAX_BATCH_REQUEST;
+
+            if (len > 0) {
+                uringReply local, *reply = n_free > 0 ? &replies[free_replies[--n_free]] : &local;
+
+                reply->iov.iov_base = reply->data;
+                reply->iov.iov_len = execute_message(payload, len, reply->data);
+                memset(&reply->msg, 0, sizeof(struct msghdr));
+                memcpy(&reply->addr, buffer + sizeof(struct io_uring_recvmsg_out), sizeof(struct sockaddr_un));
+                reply->msg.msg_name = &reply->addr;
+                reply->msg.msg_namelen = out->namelen < sizeof(struct sockaddr_un) ? out->namelen : sizeof(struct sockaddr_un);
+                reply->msg.msg_iov = &reply->iov;
+                reply->msg.msg_iovlen = 1;
+
+                struct io_uring_sqe *sqe = reply != &local ? uring_get_sqe(&ring) : NULL;
+                if (sqe != NULL) {
+                    sqe->opcode = IORING_OP_SENDMSG;
+                    sqe->fd = server_socket_fd;
+                    sqe->addr = (unsigned long) &reply->msg;
+                    sqe->msg_flags = MSG_DONTWAIT;
+                    sqe->user_data = reply - replies;
+                } else {
+                    /* every reply slot or submission entry is taken, so this one is sent right away */
+                    wal_commit();
+                    sendmsg(server_socket_fd, &reply->msg, 0);
+                    if (reply != &local) free_replies[n_free++] = reply - replies;
+                }
+            }
+
+            uring_buffer_recycle(&buffers, id);
+        }
+
+        if (rearm) uring_arm_receive(&ring, &recv_msg);
+    }
+}
+
+
+/*
+ * Waits until the socket has messages to read or the time left runs out.
+ *
+ * Input:
+ *   - deadline: time until which it waits
+ * Output:
+ *   - SUCCESS if there are messages to read or FAIL
+ * */
+static int wait_for_messages(struct timespec *deadline) {
+
+    struct timespec now, left;
+    struct pollfd server_poll = {server_socket_fd, POLLIN, 0};
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    left.tv_sec = deadline->tv_sec - now.tv_sec;
+    left.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+    if (left.tv_nsec < 0) {
+        left.tv_sec--;
+        left.tv_nsec += 1000000000L;
+    }
+    if (left.tv_sec < 0) return FAIL;
+
+    return ppoll(&server_poll, 1, &left, NULL) > 0 ? SUCCESS : FAIL;
+}
+
+
+/*
+ * Applies commands received from clients, draining up to mmsg_batch messages per system call and
+ * sending all their replies at once.
+ */
+void applyCommandsBatched() {
+
+    struct mmsghdr *requests = calloc(mmsg_batch, sizeof(struct mmsghdr));  /* messages received */
+    struct mmsghdr *replies = calloc(mmsg_batch, sizeof(struct mmsghdr));  /* replies to them */
+    struct iovec *iovecs = calloc(2 * mmsg_batch, sizeof(struct iovec));
+    struct sockaddr_un *client_addrs = calloc(mmsg_batch, sizeof(struct sockaddr_un));
+    char *request_buffers = malloc(mmsg_batch * TFS_MAX_BATCH_REQUEST);
+    char *reply_buffers = malloc(mmsg_batch * TFS_MAX_REPLY);
+
+    assert__(requests != NULL && replies != NULL && iovecs != NULL && client_addrs != NULL &&
+             request_buffers != NULL && reply_buffers != NULL, "Error: couldn't allocate message buffers!\n")
+
+    for (int i = 0; i < mmsg_batch; i++) {
+        iovecs[i].iov_base = request_buffers + i * TFS_MAX_BATCH_REQUEST;
+        iovecs[i].iov_len = TFS_MAX_BATCH_REQUEST;
+        requests[i].msg_hdr.msg_iov = &iovecs[i];
+        requests[i].msg_hdr.msg_iovlen = 1;
+        requests[i].msg_hdr.msg_name = &client_addrs[i];
+
+        iovecs[mmsg_batch + i].iov_base = reply_buffers + i * TFS_MAX_REPLY;
+        replies[i].msg_hdr.msg_iov = &iovecs[mmsg_batch + i];
+        replies[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while (1) {
+
+        /* recvmmsg shrinks them to the size of the address it got */
+        for (int i = 0; i < mmsg_batch; i++) requests[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_un);
+
+        /* blocks until there is a message, then takes every other one already waiting */
+        int n = recvmmsg(server_socket_fd, requests, mmsg_batch, MSG_WAITFORONE, NULL);
+        if (n <= 0) continue;
+
+        /* waits up to the flush timeout for the batch to fill */
+        if (n < mmsg_batch && flush_timeout > 0) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec += flush_timeout / 1000000;
+            deadline.tv_nsec += (flush_timeout % 1000000) * 1000;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+
+            while (n < mmsg_batch && wait_for_messages(&deadline) == SUCCESS) {
+                int more = recvmmsg(server_socket_fd, requests + n, mmsg_batch - n, MSG_DONTWAIT, NULL);
+                if (more > 0) n += more;
+            }
+        }
+
+        int r = 0;  /* number of replies */
+        for (int i = 0; i < n; i++) {
+            if (requests[i].msg_len == 0) continue;  /* if inputs is invalid, continues */
+
+            /* replies go back to the address their message came from */
+            iovecs[mmsg_batch + r].iov_len = execute_message(iovecs[i].iov_base, requests[i].msg_len,
+                                                             iovecs[mmsg_batch + r].iov_base);
+            replies[r].msg_hdr.msg_name = &client_addrs[i];
+            replies[r].msg_hdr.msg_namelen = requests[i].msg_hdr.msg_namelen;
+            r++;
+        }
+
+        /* sends every reply, retrying the ones a partial send left behind. the changes of the whole
+         * batch are written to the log at once */
+        wal_commit();
+        for (int sent = 0; sent < r; ) {
+            int m = sendmmsg(server_socket_fd, replies + sent, r - sent, 0);
+            if (m <= 0) {
+                fprintf(stderr, "Error: couldn't send replies!\n");
+                break;
+            }
+            sent += m;
+        }
+    }
+}
+
+
+/*
+ * Finds the worker queue a message goes to. Messages under the same top level directory go to the
+ * same worker, so the inodes they use stay in the caches of that worker's core.
+ *
+ * Input:
+ *   - message: message received
+ * Output:
+ *   - index of the worker queue
+ * */
+static int route_message(message_t *message) {
+
+    char *path = message->data;
+    int path_len = message->len;
+    char top[MAX_FILE_NAME];  /* top level component of the first path */
+    int i = 0;
+
+    /* finds the first path of the message */
+    if ((unsigned char) path[0] == TFS_BATCH_MAGIC && path_len >= (int) sizeof(tfsBatchHeader)) {
+        path += sizeof(tfsBatchHeader);
+        path_len -= sizeof(tfsBatchHeader);
+    }
+    if ((unsigned char) path[0] == TFS_MAGIC && path_len >= (int) sizeof(tfsRequestHeader)) {
+        tfsRequestHeader header;
+        memcpy(&header, path, sizeof(tfsRequestHeader));
+        path += sizeof(tfsRequestHeader);
+        path_len -= sizeof(tfsRequestHeader);
+        if (header.path_len[0] < path_len) path_len = header.path_len[0];
+    } else {
+        /* text commands: the path follows the command letter */
+        while (path_len > 0 && *path != ' ') path++, path_len--;
+        while (path_len > 0 && *path == ' ') path++, path_len--;
+    }
+
+    while (path_len > 0 && *path == '/') path++, path_len--;
+    while (i < path_len && i < MAX_FILE_NAME - 1 && path[i] != '/' && path[i] != ' ' && path[i] != '\0') {
+        top[i] = path[i];
+        i++;
+    }
+    top[i] = '\0';
+
+    return dir_name_hash(top) % numberThreads;
+}
+
+
+/*
+ * Finds the list of clients a client address is in.
+ *
+ * Input:
+ *   - addr: address of the client
+ *   - addrlen: size of the address
+ * Output:
+ *   - index of the list
+ * */
+static int client_bucket(struct sockaddr_un *addr, socklen_t addrlen) {
+
+    unsigned char *bytes = (unsigned char *) addr;
+    unsigned int hash = 2166136261u;
+
+    for (socklen_t i = 0; i < addrlen; i++) hash = (hash ^ bytes[i]) * 16777619u;
+    return hash % CLIENT_BUCKETS;
+}
+
+
+/*
+ * Finds the worker queue a message goes to. While its client has other messages pending it goes to
+ * the queue they are in, otherwise it is routed by its path.
+ *
+ * Input:
+ *   - message: message received, whose client is set
+ * Output:
+ *   - index of the worker queue
+ * */
+static int client_pin(message_t *message) {
+
+    int bucket = client_bucket(&message->addr, message->addrlen);
+    queuedClient *client;
+
+    pthread_mutex_lock(&queued_client_locks[bucket]);
+
+    for (client = queued_clients[bucket]; client != NULL; client = client->next)
+        if (client->addrlen == message->addrlen && memcmp(&client->addr, &message->addr, message->addrlen) == 0) break;
+
+    if (client == NULL) {
+        client = malloc(sizeof(queuedClient));
+        assert__(client != NULL, "Error: couldn't allocate a queued client!\n")
+        memcpy(&client->addr, &message->addr, message->addrlen);
+        client->addrlen = message->addrlen;
+        client->queue = route_message(message);
+        client->pending = 0;
+        client->next = queued_clients[bucket];
+        queued_clients[bucket] = client;
+    }
+    client->pending++;
+    message->client = client;
+    int queue = client->queue;
+
+    pthread_mutex_unlock(&queued_client_locks[bucket]);
+    return queue;
+}
+
+
+/*
+ * Counts a message of a client as executed, dropping the client once it has none pending.
+ *
+ * Input:
+ *   - client: client that sent the message
+ * */
+static void client_done(queuedClient *client) {
+
+    int bucket = client_bucket(&client->addr, client->addrlen);
+
+    pthread_mutex_lock(&queued_client_locks[bucket]);
+    if (--client->pending == 0) {
+        queuedClient **link = &queued_clients[bucket];
+        while (*link != client) link = &(*link)->next;
+        *link = client->next;
+        free(client);
+    }
+    pthread_mutex_unlock(&queued_client_locks[bucket]);
+}
+
+
+/*
+ * Adds a message to a worker queue, waiting while the queue is full.
+ *
+ * Input:
+ *   - queue: queue where the message is added
+ *   - message: message that is added
+ * Output:
+ *   - number of messages in the queue before this one
+ * */
+static int queue_push(workerQueue *queue, message_t *message) {
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue_size) pthread_cond_wait(&queue->not_full, &queue->lock);
+
+    message_t *slot = &queue->messages[(queue->head + queue->count) % queue_size];
+    slot->addr = message->addr;
+    slot->addrlen = message->addrlen;
+    slot->client = message->client;
+    slot->len = message->len;
+    memcpy(slot->data, message->data, message->len);
+
+    /* stealers peek at the count without the lock */
+    int count = queue->count;
+    __atomic_store_n(&queue->count, count + 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+
+    return count;
+}
+
+
+/*
+ * Takes the oldest message of a worker queue.
+ *
+ * Input:
+ *   - queue: queue the message is taken from
+ *   - message: where the message is copied to
+ *   - steal: index of the queue of the worker stealing the message, or -1 if it is the queue's own
+ *            worker. a stealer gives up instead of waiting for the lock of the queue
+ * Output:
+ *   - SUCCESS or FAIL (if there was no message to take)
+ * */
+static int queue_pop(workerQueue *queue, message_t *message, int steal) {
+
+    if (steal >= 0) {
+        if (__atomic_load_n(&queue->count, __ATOMIC_RELAXED) == 0) return FAIL;
+        if (pthread_mutex_trylock(&queue->lock) != 0) return FAIL;
+    } else pthread_mutex_lock(&queue->lock);
+
+    if (queue->count == 0) {
+        pthread_mutex_unlock(&queue->lock);
+        return FAIL;
+    }
+
+    message_t *slot = &queue->messages[queue->head];
+
+    /* a client with more messages pending stays with this worker, so they don't run out of order.
+     * one that has only this message moves to the stealer along with the messages it sends next */
+    if (steal >= 0) {
+        int bucket = client_bucket(&slot->addr, slot->addrlen);
+        pthread_mutex_lock(&queued_client_locks[bucket]);
+        int alone = slot->client->pending == 1;
+        if (alone) slot->client->queue = steal;
+        pthread_mutex_unlock(&queued_client_locks[bucket]);
+
+        if (! alone) {
+            pthread_mutex_unlock(&queue->lock);
+            return FAIL;
+        }
+    }
+
+    message->addr = slot->addr;
+    message->addrlen = slot->addrlen;
+    message->client = slot->client;
+    message->len = slot->len;
+    memcpy(message->data, slot->data, slot->len);
+
+    queue->head = (queue->head + 1) % queue_size;
+    __atomic_store_n(&queue->count, queue->count - 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+
+    return SUCCESS;
+}
 
 
 /*
- * Sets socket address and inits everything.
+ * Wakes a worker waiting for messages so that it steals from the queues of busy workers.
  *
  * Input:
- *   - path: socket path
- *   - addr: socket address
- * Output:
- *   - size of socket
+ *   - busy: index of the queue that has messages waiting
  * */
-int set_socket_address_unix(char *path, struct sockaddr_un *addr) {
+static void wake_stealer(int busy) {
 
-    if (addr == NULL) return 0;  /* interrupts if address is invalid */
+    for (int i = 1; i < numberThreads; i++) {
+        workerQueue *queue = &worker_queues[(busy + i) % numberThreads];
+        if (! __atomic_load_n(&queue->sleeping, __ATOMIC_RELAXED)) continue;
 
-    bzero((char *)addr, sizeof(struct sockaddr_un));  /* clears possible values in addr variable */
-    addr->sun_family = AF_UNIX;  /* sets socket domain as unix */
-    strcpy(addr->sun_path, path);  /* copies path to the socket */
+        pthread_mutex_lock(&queue->lock);
+        if (queue->sleeping) {
+            queue->steal = 1;
+            pthread_cond_signal(&queue->not_empty);
+            pthread_mutex_unlock(&queue->lock);
+            return;
+        }
+        pthread_mutex_unlock(&queue->lock);
+    }
+}
 
-    return SUN_LEN(addr);
+
+/*
+ * Receives messages and hands each one to the queue of the worker it is routed to.
+ */
+void dispatchMessages() {
+
+    struct mmsghdr *requests = calloc(mmsg_batch, sizeof(struct mmsghdr));  /* messages received */
+    struct iovec *iovecs = calloc(mmsg_batch, sizeof(struct iovec));
+    message_t *messages = malloc(mmsg_batch * sizeof(message_t));
+
+    assert__(requests != NULL && iovecs != NULL && messages != NULL, "Error: couldn't allocate message buffers!\n")
+
+    for (int i = 0; i < mmsg_batch; i++) {
+        iovecs[i].iov_base = messages[i].data;
+        iovecs[i].iov_len = TFS_MAX_BATCH_REQUEST;
+        requests[i].msg_hdr.msg_iov = &iovecs[i];
+        requests[i].msg_hdr.msg_iovlen = 1;
+        requests[i].msg_hdr.msg_name = &messages[i].addr;
+    }
+
+    while (1) {
+
+        /* recvmmsg shrinks them to the size of the address it got */
+        for (int i = 0; i < mmsg_batch; i++) requests[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_un);
+
+        /* blocks until there is a message, then takes every other one already waiting */
+        int n = recvmmsg(server_socket_fd, requests, mmsg_batch, MSG_WAITFORONE, NULL);
+
+        for (int i = 0; i < n; i++) {
+            if (requests[i].msg_len == 0) continue;  /* if inputs is invalid, continues */
+
+            messages[i].addrlen = requests[i].msg_hdr.msg_namelen;
+            messages[i].len = requests[i].msg_len;
+
+            int worker = client_pin(&messages[i]);
+
+            /* the worker is busy, so an idle one can take over its queue */
+            if (queue_push(&worker_queues[worker], &messages[i]) > 0) wake_stealer(worker);
+        }
+    }
 }
 
 
 /*
- * Applies commands from input file
+ * Executes the messages of a worker queue, and those of other queues when its own is empty.
+ *
+ * Input:
+ *   - worker: index of the worker
+ * */
+void applyQueuedCommands(int worker) {
+
+    workerQueue *queue = &worker_queues[worker];
+    message_t *message = malloc(sizeof(message_t));  /* message being executed */
+    char reply[TFS_MAX_REPLY];  /* holds reply to the message */
+
+    assert__(message != NULL, "Error: couldn't allocate message buffer!\n")
+
+    while (1) {
+        int found = queue_pop(queue, message, -1) == SUCCESS;
+
+        for (int i = 1; ! found && i < numberThreads; i++)
+            found = queue_pop(&worker_queues[(worker + i) % numberThreads], message, worker) == SUCCESS;
+
+        if (found) {
+            int size = execute_message(message->data, message->len, reply);
+
+            /* sends reply back to client, once the change it made is in the log */
+            wal_commit();
+            sendto(server_socket_fd, reply, size, 0, (struct sockaddr *) &message->addr, message->addrlen);
+            client_done(message->client);
+            continue;
+        }
+
+        /* waits for a message of its own or to be told to steal */
+        pthread_mutex_lock(&queue->lock);
+        __atomic_store_n(&queue->sleeping, 1, __ATOMIC_RELAXED);
+        while (queue->count == 0 && ! queue->steal) pthread_cond_wait(&queue->not_empty, &queue->lock);
+        __atomic_store_n(&queue->sleeping, 0, __ATOMIC_RELAXED);
+        queue->steal = 0;
+        pthread_mutex_unlock(&queue->lock);
+    }
+}
+
+
+/*
+ * Rearms the events of a connection, so that the next one is taken by any thread.
+ *
+ * Input:
+ *   - connection: connection whose events are rearmed
+ *   - events: events the connection waits for
+ * */
+static void connection_rearm(connection_t *connection, uint32_t events) {
+    struct epoll_event event = {events | EPOLLONESHOT, {.ptr = connection}};
+    assert__(epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection->fd, &event) == 0, "Error: couldn't rearm a connection!\n")
+}
+
+
+/*
+ * Accepts every connection waiting in the listening socket.
  */
-void applyCommands() {
+static void accept_connections() {
+
+    int fd;
+
+    while ((fd = accept4(server_socket_fd, NULL, NULL, SOCK_NONBLOCK)) != -1) {
+        connection_t *connection = malloc(sizeof(connection_t));
+        if (connection == NULL) {
+            fprintf(stderr, "Error: couldn't allocate a connection!\n");
+            close(fd);
+            continue;
+        }
+        connection->fd = fd;
+        connection->pending = 0;
+
+        struct epoll_event event = {EPOLLIN | EPOLLONESHOT, {.ptr = connection}};
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            fprintf(stderr, "Error: couldn't watch a connection!\n");
+            close(fd);
+            free(connection);
+        }
+    }
+
+    connection_rearm(&listener, EPOLLIN);
+}
+
+
+/*
+ * Serves the requests a client sent through its connection. Requests can be pipelined, and are
+ * answered in order. A client that doesn't take its replies has its requests left unread until it
+ * does.
+ *
+ * Input:
+ *   - connection: connection with events
+ *   - request: buffer with room for TFS_MAX_BATCH_REQUEST bytes
+ * */
+static void serve_connection(connection_t *connection, char *request) {
 
-    struct sockaddr_un client_addr;  /* client socket address */
     int c;  /* holds number of bytes read */
 
-    socklen_t addrlen = sizeof(struct sockaddr_un);  /* gets standard size of socket address */
+    /* the reply that was left behind goes first */
+    if (connection->pending > 0) {
+        if (send(connection->fd, connection->reply, connection->pending, MSG_NOSIGNAL) < 0) {
+            if (errno == EAGAIN) {
+                connection_rearm(connection, EPOLLOUT);
+                return;
+            }
+            goto close_connection;
+        }
+        connection->pending = 0;
+    }
 
-    char command[MAX_INPUT_SIZE];  /* holds command that is going to be executed */
+    for (int i = 0; i < CONNECTION_BUDGET; i++) {
+        c = recv(connection->fd, request, TFS_MAX_BATCH_REQUEST, 0);
+        if (c == 0) goto close_connection;  /* client closed the connection */
+        if (c < 0) {
+            if (errno == EAGAIN) break;
+            goto close_connection;
+        }
 
-    int output[1];  /* holds command output after execution. uses an array for simplicity */
+        int size = execute_message(request, c, connection->reply);
+
+        /* sends reply back to client, once the change it made is in the log */
+        wal_commit();
+        if (send(connection->fd, connection->reply, size, MSG_NOSIGNAL) < 0) {
+            if (errno == EAGAIN) {
+                connection->pending = size;
+                connection_rearm(connection, EPOLLOUT);
+                return;
+            }
+            goto close_connection;
+        }
+    }
+
+    connection_rearm(connection, EPOLLIN);
+    return;
+
+close_connection:
+    close(connection->fd);
+    free(connection);
+}
+
+
+/*
+ * Serves every connection that has events, with the other threads.
+ */
+void applyConnectedCommands() {
+
+    struct epoll_event events[EPOLL_EVENTS];
+    char request[TFS_MAX_BATCH_REQUEST];  /* holds request that is going to be executed */
 
-    /* loop until file has reached it's end */
     while (1) {
+        int n = epoll_wait(epoll_fd, events, EPOLL_EVENTS, -1);
 
-        /* receives message and gets number of bytes read */
-        c = recvfrom(server_socket_fd, command, sizeof(command) - 1, 0,
-                     (struct sockaddr *) &client_addr, &addrlen);
+        for (int i = 0; i < n; i++) {
+            connection_t *connection = events[i].data.ptr;
+            if (connection == &listener) accept_connections();
+            else serve_connection(connection, request);
+        }
+    }
+}
 
-        if (c <= 0) continue;  /* if inputs is invalid, continues */
 
-        command[c] = '\0';  /* prevents client message from not having a '\0' */
+/*
+ * Checks if the client of a ring closed its connection.
+ *
+ * Input:
+ *   - client: client of the ring
+ * Output:
+ *   - 1 if the client is gone, 0 otherwise
+ * */
+static int ring_client_gone(ringClient *client) {
+    struct pollfd client_poll = {client->fd, POLLIN, 0};
+
+    /* the client doesn't send anything after the ring, so any event means the connection closed */
+    return poll(&client_poll, 1, 0) != 0;
+}
+
 
-        char token;
-        char name_2[MAX_INPUT_SIZE];
-        char name_1[MAX_INPUT_SIZE];
-        int numTokens = sscanf(command, "%c %s %s", &token, name_1, name_2);
-        if (numTokens < 2) {
-            fprintf(stderr, "Error: invalid command in Queue\n");
-            exit(EXIT_FAILURE);
+/*
+ * Executes the messages a client puts in its ring until the client goes away.
+ *
+ * Input:
+ *   - ptr: client of the ring
+ * */
+void *serveRing(void *ptr) {
+
+    ringClient *client = ptr;
+    tfsRing *ring = client->ring;
+    char request[TFS_MAX_BATCH_REQUEST];  /* holds request that is going to be executed */
+    uint32_t head = ring->sq_head, tail = ring->cq_tail;
+
+    while (1) {
+
+        if (__atomic_load_n(&ring->sq_tail, __ATOMIC_ACQUIRE) == head) {
+            if (tfs_ring_wait(&ring->sq_tail, head, &ring->server_waiting, ring_spin) == TFS_STATUS_FAIL &&
+                ring_client_gone(client))
+                break;
+            continue;
         }
 
-        assert__(pthread_mutex_lock(&lock) == 0, "Error: applyCommands failed to lock!\n")
+        /* the message is copied, since the client could change it while it executes */
+        tfsRingRequest *slot = &ring->sq[head % TFS_RING_ENTRIES];
+        uint32_t len = slot->len < TFS_MAX_BATCH_REQUEST ? slot->len : TFS_MAX_BATCH_REQUEST;
+        memcpy(request, slot->data, len);
+        __atomic_store_n(&ring->sq_head, ++head, __ATOMIC_RELEASE);
+
+        tfsRingReply *reply = &ring->cq[tail % TFS_RING_ENTRIES];
+        reply->len = len > 0 ? execute_message(request, len, reply->data) : 0;
+        wal_commit();
+
+        __atomic_store_n(&ring->cq_tail, ++tail, __ATOMIC_RELEASE);
+        tfs_ring_wake(&ring->cq_tail, &ring->client_waiting);
+    }
+
+    munmap(ring, sizeof(tfsRing));
+    close(client->fd);
+    free(client);
+    return NULL;
+}
+
+
+/*
+ * Takes a ring a client sent through its connection, starting a thread that serves it.
+ *
+ * Input:
+ *   - fd: connection of the client
+ * Output:
+ *   - SUCCESS or FAIL
+ * */
+static int take_ring(int fd) {
+
+    char byte;
+    struct iovec iov = {&byte, 1};
+    union {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg = {0};
+    struct stat ring_stat;
+    pthread_t thread_id;
+    int ring_fd;
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
 
-        /* when we detect a 'p' command, this variable is set to 1 and thus, all subsequent threads
-         * will wait in here until the command is concluded before proceeding */
-        while (is_printing)
-            pthread_cond_wait(&cond_print, &lock);
+    /* the ring comes as a file descriptor */
+    if (recvmsg(fd, &msg, 0) <= 0) return FAIL;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) return FAIL;
+    memcpy(&ring_fd, CMSG_DATA(cmsg), sizeof(int));
 
-        /* when a 'p' command is detected, we need to inform the other threads that we have this
-         * pending command and after that, we wait until all threads finish their execution */
-        if (token == 'p') {
-            is_printing++;
-            while(in_execution > 0)
-                pthread_cond_wait(&cond_wait, &lock);
+    /* the ring must not shrink while it is mapped, since the server would fault on it */
+    int seals = fcntl(ring_fd, F_GET_SEALS);
+    if (seals == -1 || ! (seals & F_SEAL_SHRINK) || fstat(ring_fd, &ring_stat) != 0 ||
+        ring_stat.st_size < (off_t) sizeof(tfsRing)) {
+        close(ring_fd);
+        return FAIL;
+    }
+
+    tfsRing *ring = mmap(NULL, sizeof(tfsRing), PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, 0);
+    close(ring_fd);
+    if (ring == MAP_FAILED) return FAIL;
+
+    ringClient *client = malloc(sizeof(ringClient));
+    if (client == NULL) {
+        munmap(ring, sizeof(tfsRing));
+        return FAIL;
+    }
+    client->ring = ring;
+    client->fd = fd;
+    ring->spin_us = ring_spin;
+
+    if (pthread_create(&thread_id, NULL, serveRing, client) != 0) {
+        munmap(ring, sizeof(tfsRing));
+        free(client);
+        return FAIL;
+    }
+    pthread_detach(thread_id);
+
+    return SUCCESS;
+}
+
+
+/*
+ * Accepts the clients that hand their rings to the server.
+ *
+ * Input:
+ *   - ptr: unused
+ * */
+void *acceptRings(void *ptr) {
+
+    (void) ptr;
+
+    while (1) {
+        int fd = accept(ring_socket_fd, NULL, NULL);
+        if (fd == -1) continue;
+
+        /* tells the client whether it can use its ring */
+        int status = take_ring(fd) == SUCCESS ? TFS_STATUS_SUCCESS : TFS_STATUS_FAIL;
+        send(fd, &status, sizeof(int), MSG_NOSIGNAL);
+        if (status == TFS_STATUS_FAIL) close(fd);
+    }
+}
+
+
+/*
+ * Maps the bulk buffer a client sent through its connection, in place of the one it had.
+ *
+ * Input:
+ *   - buffer: bulk buffer of the client
+ *   - status: where TFS_STATUS_SUCCESS or TFS_STATUS_FAIL (if the buffer can't be used) is stored
+ * Output:
+ *   - SUCCESS or FAIL (if the client closed its connection)
+ * */
+static int take_bulk(bulkBuffer *buffer, int *status) {
+
+    tfsBulkHandoff handoff;
+    struct iovec iov = {&handoff, sizeof(tfsBulkHandoff)};
+    union {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg = {0};
+    struct stat bulk_stat;
+    int bulk_fd;
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    /* the buffer comes as a file descriptor */
+    int c = recvmsg(buffer->fd, &msg, MSG_CMSG_CLOEXEC);
+    if (c <= 0) return FAIL;
+    *status = TFS_STATUS_FAIL;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) return SUCCESS;
+    memcpy(&bulk_fd, CMSG_DATA(cmsg), sizeof(int));
+
+    /* the buffer must not shrink while it is mapped, since the server would fault on it */
+    int seals = fcntl(bulk_fd, F_GET_SEALS);
+    if (c != sizeof(tfsBulkHandoff) || handoff.token == 0 || seals == -1 || ! (seals & F_SEAL_SHRINK) ||
+        fstat(bulk_fd, &bulk_stat) != 0 || bulk_stat.st_size <= 0) {
+        close(bulk_fd);
+        return SUCCESS;
+    }
+
+    char *data = mmap(NULL, bulk_stat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, bulk_fd, 0);
+    close(bulk_fd);
+    if (data == MAP_FAILED) return SUCCESS;
+
+    /* the first buffer of a client decides its token, which must not be taken. it is looked for and
+     * listed under the same lock, so two clients can't both take a token */
+    if (buffer->data == NULL) {
+        bulkBuffer *other;
+
+        pthread_mutex_lock(&bulk_lock);
+        for (other = bulk_buffers[handoff.token % BULK_BUCKETS]; other != NULL && other->token != handoff.token;
+             other = other->next);
+        if (other == NULL) {
+            buffer->token = handoff.token;
+            buffer->next = bulk_buffers[buffer->token % BULK_BUCKETS];
+            bulk_buffers[buffer->token % BULK_BUCKETS] = buffer;
         }
+        pthread_mutex_unlock(&bulk_lock);
 
-        in_execution++;  /* signals that we have one more thread in execution */
+        if (other != NULL) {
+            munmap(data, bulk_stat.st_size);
+            return SUCCESS;
+        }
+    }
 
-        assert__(pthread_mutex_unlock(&lock) == 0, "Error: applyCommands failed to unlock!\n")
+    /* requests using the old buffer finish before it is replaced */
+    pthread_rwlock_wrlock(&buffer->lock);
+    if (buffer->data != NULL) munmap(buffer->data, buffer->size);
+    buffer->data = data;
+    buffer->size = bulk_stat.st_size;
+    pthread_rwlock_unlock(&buffer->lock);
 
-        switch (token) {
-            case 'c':
+    *status = TFS_STATUS_SUCCESS;
+    return SUCCESS;
+}
 
-                switch (name_2[0]) {
-                    case 'f':
-                        printf("Create file: %s\n", name_1);
-                        output[0] = create(name_1, T_FILE);
-                        break;
-                    case 'd':
-                        printf("Create directory: %s\n", name_1);
-                        output[0] = create(name_1, T_DIRECTORY);
-                        break;
-                    default:
-                        fprintf(stderr, "Error: invalid node type\n");
-                        exit(EXIT_FAILURE);
-                }
-                break;
 
-            case 'l':
-                output[0] = lookup(name_1);
-                if (output[0] >= 0) printf("Search: %s found\n", name_1);
-                else printf("Search: %s not found\n", name_1);
-                break;
+/*
+ * Takes the bulk buffers a client hands through its connection until the client goes away.
+ *
+ * Input:
+ *   - ptr: bulk buffer of the client
+ * */
+void *serveBulk(void *ptr) {
 
-            case 'd':
-                printf("Delete: %s\n", name_1);
-                output[0] = delete(name_1);
-                break;
+    bulkBuffer *buffer = ptr;
+    int status;
 
-            case 'm':
-                printf("Move: %s\n", name_1);
-                output[0] = move(name_1, name_2);
-                break;
+    /* tells the client whether it can use each buffer */
+    while (take_bulk(buffer, &status) == SUCCESS) send(buffer->fd, &status, sizeof(int), MSG_NOSIGNAL);
 
-            case 'p':
-                printf("Print: %s\n", name_1);
-                output[0] = print_tecnicofs_tree(name_1);
+    /* nobody finds the buffer once it is out of its list, and nobody is using it after the lock */
+    pthread_mutex_lock(&bulk_lock);
+    for (bulkBuffer **prev = &bulk_buffers[buffer->token % BULK_BUCKETS]; *prev != NULL; prev = &(*prev)->next)
+        if (*prev == buffer) {
+            *prev = buffer->next;
+            break;
+        }
+    pthread_mutex_unlock(&bulk_lock);
+    pthread_rwlock_wrlock(&buffer->lock);
+    pthread_rwlock_unlock(&buffer->lock);
 
-                assert__(pthread_mutex_lock(&lock) == 0, "Error: applyCommands failed to lock!\n")
-                /* printing has finished and signals other threads of this event */
-                is_printing--; pthread_cond_broadcast(&cond_print);
-                assert__(pthread_mutex_unlock(&lock) == 0, "Error: applyCommands failed to unlock!\n")
-                break;
+    if (buffer->data != NULL) munmap(buffer->data, buffer->size);
+    pthread_rwlock_destroy(&buffer->lock);
+    close(buffer->fd);
+    free(buffer);
+    return NULL;
+}
 
-            default: { /* error */
-                fprintf(stderr, "Error: command to apply\n");
-                exit(EXIT_FAILURE);
-            }
 
+/*
+ * Accepts the clients that hand their bulk buffers to the server, each served by a thread of its own.
+ *
+ * Input:
+ *   - ptr: unused
+ * */
+void *acceptBulk(void *ptr) {
+
+    pthread_t thread_id;
+
+    (void) ptr;
+
+    while (1) {
+        int fd = accept(bulk_socket_fd, NULL, NULL);
+        if (fd == -1) continue;
+
+        bulkBuffer *buffer = calloc(1, sizeof(bulkBuffer));
+        if (buffer == NULL) {
+            close(fd);
+            continue;
+        }
+        buffer->fd = fd;
+        pthread_rwlock_init(&buffer->lock, NULL);
+
+        if (pthread_create(&thread_id, NULL, serveBulk, buffer) != 0) {
+            pthread_rwlock_destroy(&buffer->lock);
+            free(buffer);
+            close(fd);
+            continue;
         }
+        pthread_detach(thread_id);
+    }
+}
+
+
+/*
+ * Waits for SIGINT or SIGTERM and stops the server between commands, so that the tree is whole
+ * when the file system is destroyed and a persistent store is written back.
+ *
+ * Input:
+ *   - ptr: signals that stop the server, blocked in every thread
+ * */
+void *awaitShutdown(void *ptr) {
+
+    int sig;
+
+    while (sigwait(ptr, &sig) != 0);
+
+    /* threads that are executing commands finish them, and then nobody executes any other */
+    for (int i = 0; i < COMMAND_LOCKS; i++) pthread_mutex_lock(&command_locks[i]);
+
+    destroy_fs();
+    exit(EXIT_SUCCESS);
+}
 
-        /* sends report back to client */
-        sendto(server_socket_fd, output, sizeof(output), 0, (struct sockaddr *) &client_addr, addrlen);
 
-        assert__(pthread_mutex_lock(&lock) == 0, "Error: applyCommands failed to lock!\n")
-        in_execution--;
-        pthread_cond_signal(&cond_wait);
-        assert__(pthread_mutex_unlock(&lock) == 0, "Error: applyCommands failed to unlock!\n")
+/*
+ * Takes a checkpoint of the tree every checkpoint_interval seconds, so that restarting doesn't
+ * replay the whole log.
+ * */
+void *takeCheckpoints(void *ptr) {
+
+    (void) ptr;
 
+    while (1) {
+        sleep(checkpoint_interval);
+        checkpoint_take();
     }
+    return NULL;
 }
 
 
 /* auxiliary function used to redirect a thread to the applyCommands function */
 void *applyCommand_thread(void* ptr) {
-    applyCommands();
+    if (connected_mode) applyConnectedCommands();
+    else if (uring_mode) applyCommandsUring();
+    else if (queue_size > 0) applyQueuedCommands((long) ptr);
+    else if (mmsg_batch > 1) applyCommandsBatched();
+    else applyCommands();
     return NULL;
 }
 
@@ -180,8 +1882,69 @@ int main(int argc, char* argv[]) {
     struct sockaddr_un server_addr;  /* server socket address */
     socklen_t addrlen;  /* size of server socket */
 
+    int opt;  /* option being parsed */
+
+    sigset_t shutdown_signals;  /* signals that stop the server */
+    pthread_t shutdown_thread;
+
+    /* options can come before or after the other inputs */
+    while ((opt = getopt(argc, argv, "b:t:q:cr:us:l:k:p:")) != -1) {
+        switch (opt) {
+            case 'b':
+                mmsg_batch = atoi(optarg);
+                assert__(mmsg_batch > 0 && mmsg_batch <= UIO_MAXIOV, "Error: invalid batch size.\n")
+                break;
+            case 't':
+                flush_timeout = atol(optarg);
+                assert__(flush_timeout >= 0, "Error: invalid flush timeout.\n")
+                break;
+            case 'q':
+                queue_size = atoi(optarg);
+                assert__(queue_size >= 0, "Error: invalid queue size.\n")
+                break;
+            case 'c':
+                connected_mode = 1;
+                break;
+            case 'u':
+                uring_mode = 1;
+                break;
+            case 'r':
+                ring_spin = atol(optarg);
+                assert__(ring_spin >= 0, "Error: invalid ring spin time.\n")
+                break;
+            case 's':
+                store_path = optarg;
+                break;
+            case 'l':
+                log_path = optarg;
+                break;
+            case 'k':
+                checkpoint_interval = atol(optarg);
+                assert__(checkpoint_interval >= 0, "Error: invalid checkpoint interval.\n")
+                break;
+            case 'p':
+                print_threads = atoi(optarg);
+                assert__(print_threads >= 0, "Error: invalid number of print threads.\n")
+                break;
+            default:
+                fprintf(stderr, "Usage: %s numthreads socketname [-b batch_size] [-t flush_timeout_us] [-q queue_size] [-c] [-r ring_spin_us] [-u] [-s store_file] [-l log_file] [-k checkpoint_interval_s] [-p print_threads]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    argv += optind - 1;
+
     /* checks if the user inserted the correct amount of inputs */
-    assert__(argc == 3, "Error: need 3 inputs.\n")
+    assert__(argc - optind == 2, "Error: need 3 inputs.\n")
+
+    /* a store already keeps every change, and replaying the log on it would make them twice */
+    assert__(store_path == NULL || log_path == NULL, "Error: a store and a log can't be used together.\n")
+
+    /* every thread is created with the signals that stop the server blocked, only awaitShutdown takes them */
+    sigemptyset(&shutdown_signals);
+    sigaddset(&shutdown_signals, SIGINT);
+    sigaddset(&shutdown_signals, SIGTERM);
+    assert__(pthread_sigmask(SIG_BLOCK, &shutdown_signals, NULL) == 0, "Error: couldn't block signals!\n")
+    for (int i = 0; i < COMMAND_LOCKS; i++) pthread_mutex_init(&command_locks[i], NULL);
 
     /* holds info about each thread id */
     numberThreads = atoi(argv[1]);
@@ -192,7 +1955,8 @@ int main(int argc, char* argv[]) {
     char* server_socket_name = argv[2];
 
     /* creates server side socket */
-    assert__((sock_fd = socket(AF_UNIX, SOCK_DGRAM, 0)) != -1, "Error: couldn't create server socket!\n")
+    assert__((sock_fd = socket(AF_UNIX, connected_mode ? SOCK_SEQPACKET | SOCK_NONBLOCK : SOCK_DGRAM, 0)) != -1,
+             "Error: couldn't create server socket!\n")
 
     /* removes possible previous links */
     unlink(server_socket_name);
@@ -206,18 +1970,97 @@ int main(int argc, char* argv[]) {
     /* saves server socket file descriptor in a global variable so that other functions can access it */
     server_socket_fd = sock_fd;
 
-    /* init filesystem */
-    init_fs();
+    /* in connected mode, clients connect to the server socket and every thread waits for their events */
+    if (connected_mode) {
+        assert__(listen(sock_fd, SOMAXCONN) == 0, "Error: couldn't listen on server socket!\n")
+        assert__((epoll_fd = epoll_create1(0)) != -1, "Error: couldn't create epoll instance!\n")
+
+        listener.fd = sock_fd;
+        struct epoll_event event = {EPOLLIN | EPOLLONESHOT, {.ptr = &listener}};
+        assert__(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock_fd, &event) == 0, "Error: couldn't watch server socket!\n")
+
+        /* connections have their own workers, so there are no queues */
+        queue_size = 0;
+    }
+
+    /* every thread receives its own messages through its io_uring */
+    if (uring_mode) queue_size = 0;
+
+    /* init filesystem, from the store or the log if there is one */
+    init_fs(store_path, log_path);
+    assert__(pthread_create(&shutdown_thread, NULL, awaitShutdown, &shutdown_signals) == 0, "Error: couldn't create a thread!\n")
+
+    /* checkpoints are taken while the other threads keep serving requests */
+    if (log_path != NULL && checkpoint_interval > 0) {
+        pthread_t checkpoint_thread;
+        assert__(pthread_create(&checkpoint_thread, NULL, takeCheckpoints, NULL) == 0, "Error: couldn't create a thread!\n")
+    }
+
+    /* clients that run on this machine can also send their messages through shared memory rings */
+    if (ring_spin >= 0) {
+        char ring_socket_name[sizeof(server_addr.sun_path)];
+        struct sockaddr_un ring_addr;
+        pthread_t ring_thread;
+
+        assert__(strlen(server_socket_name) + strlen(TFS_RING_SUFFIX) < sizeof(ring_socket_name),
+                 "Error: server socket name is too long for rings!\n")
+        strcpy(ring_socket_name, server_socket_name);
+        strcat(ring_socket_name, TFS_RING_SUFFIX);
+
+        assert__((ring_socket_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) != -1, "Error: couldn't create ring socket!\n")
+        unlink(ring_socket_name);
+        addrlen = set_socket_address_unix(ring_socket_name, &ring_addr);
+        assert__(bind(ring_socket_fd, (struct sockaddr *) &ring_addr, addrlen) != -1, "Error: couldn't bind ring socket!\n")
+        assert__(listen(ring_socket_fd, SOMAXCONN) == 0, "Error: couldn't listen on ring socket!\n")
+        assert__(pthread_create(&ring_thread, NULL, acceptRings, NULL) == 0, "Error: couldn't create a thread!\n")
+    }
+
+    /* clients on this machine hand large reads and writes through bulk buffers */
+    {
+        char bulk_socket_name[sizeof(server_addr.sun_path)];
+        struct sockaddr_un bulk_addr;
+        pthread_t bulk_thread;
+
+        assert__(strlen(server_socket_name) + strlen(TFS_BULK_SUFFIX) < sizeof(bulk_socket_name),
+                 "Error: server socket name is too long for bulk buffers!\n")
+        strcpy(bulk_socket_name, server_socket_name);
+        strcat(bulk_socket_name, TFS_BULK_SUFFIX);
+
+        assert__((bulk_socket_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) != -1, "Error: couldn't create bulk socket!\n")
+        unlink(bulk_socket_name);
+        addrlen = set_socket_address_unix(bulk_socket_name, &bulk_addr);
+        assert__(bind(bulk_socket_fd, (struct sockaddr *) &bulk_addr, addrlen) != -1, "Error: couldn't bind bulk socket!\n")
+        assert__(listen(bulk_socket_fd, SOMAXCONN) == 0, "Error: couldn't listen on bulk socket!\n")
+        assert__(pthread_create(&bulk_thread, NULL, acceptBulk, NULL) == 0, "Error: couldn't create a thread!\n")
+    }
+
+    /* creates a queue for each worker */
+    if (queue_size > 0) {
+        worker_queues = calloc(numberThreads, sizeof(workerQueue));
+        assert__(worker_queues != NULL, "Error: couldn't allocate worker queues!\n")
+
+        for (int i = 0; i < numberThreads; i++) {
+            worker_queues[i].messages = malloc(queue_size * sizeof(message_t));
+            assert__(worker_queues[i].messages != NULL, "Error: couldn't allocate worker queues!\n")
+            pthread_mutex_init(&worker_queues[i].lock, NULL);
+            pthread_cond_init(&worker_queues[i].not_empty, NULL);
+            pthread_cond_init(&worker_queues[i].not_full, NULL);
+        }
+        for (int i = 0; i < CLIENT_BUCKETS; i++) pthread_mutex_init(&queued_client_locks[i], NULL);
+    }
 
     /* creates all the requested threads. if it fails, reports an error */
     for (int i = 0; i < numberThreads; i++)
-        assert__(pthread_create(&thread_ids[i], NULL, applyCommand_thread, NULL) == 0, "Error: couldn't create a thread!\n")
+        assert__(pthread_create(&thread_ids[i], NULL, applyCommand_thread, (void *) (long) i) == 0, "Error: couldn't create a thread!\n")
+
+    /* with worker queues, this thread receives the messages and hands them to the workers */
+    if (queue_size > 0) dispatchMessages();
 
     /* since our threads will never end, using pthread_join here will create an 'infinite loop' thus
      * keeping our server online without consuming much resources compared to using while(1) */
     pthread_join(thread_ids[0], NULL);
 
-    /* since server never ends, this part will never be run. releases allocated memory */
+    /* the server only stops through awaitShutdown, so this part will never be run. releases allocated memory */
     destroy_fs();
 
     exit(EXIT_SUCCESS);
@@ -0,0 +1,153 @@
+#ifndef TECNICOFS_PROTOCOL_H
+#define TECNICOFS_PROTOCOL_H
+
+#include <stdint.h>
+#include "tecnicofs-api-constants.h"
+
+/*
+ * Binary protocol between clients and the server. A request is a header followed by its paths,
+ * without '\0', and is answered with a reply carrying the same request id. Integers are in host
+ * byte order, since both ends are on the same machine.
+ *
+ * Requests can also be sent in batches: a batch header followed by the requests, one after the
+ * other, which the server executes in order. The reply is a batch reply header followed by the
+ * replies, in the same order.
+ *
+ * Reads, writes and truncates have a data header after their path, followed by the bytes of a
+ * write. The reply to a read is followed by the bytes read.
+ *
+ * Larger reads and writes go through a bulk buffer instead: a sealed memfd the client hands to the
+ * server once, through a seqpacket socket listening on the server path with TFS_BULK_SUFFIX, along
+ * with a random token. A request with TFS_DATA_BULK names the buffer by its token and the server
+ * reads the bytes of a write from it, or stores the bytes of a read in it, starting at its
+ * beginning. A client hands a larger buffer through the same connection when it needs one, and
+ * closes the connection when it is done.
+ *
+ * Dumps stream a listing of the tree to the client, the same text a print writes to a file, in
+ * chunks. A dump request has a data header like a read, whose offset is a cursor: 0 starts a new
+ * listing, and any other value is the one the server gave with the chunk before. The reply is
+ * followed by the cursor of the next chunk, 0 after the last one, and then by the bytes of the
+ * chunk unless they are bulk. Each chunk continues a walk of the tree as it is then, so entries
+ * added or removed during a dump may or may not be listed. The server keeps a walk until its
+ * last chunk is taken, or until it needs the room for newer ones, after which its cursors fail.
+ *
+ * Datagrams that don't start with TFS_MAGIC or TFS_BATCH_MAGIC are text commands ("c /a d"), which
+ * are still accepted and answered with a single int.
+ */
+
+/* first byte of every binary request. text commands always start with a letter */
+#define TFS_MAGIC 0xF5
+
+/* first byte of every batch */
+#define TFS_BATCH_MAGIC 0xF6
+
+/* opcodes are the letters of the text commands */
+#define TFS_OP_CREATE 'c'
+#define TFS_OP_DELETE 'd'
+#define TFS_OP_LOOKUP 'l'
+#define TFS_OP_MOVE 'm'
+#define TFS_OP_PRINT 'p'
+#define TFS_OP_WRITE 'w'
+#define TFS_OP_READ 'r'
+#define TFS_OP_TRUNCATE 't'
+#define TFS_OP_DUMP 'P'
+
+/* status of a reply */
+#define TFS_STATUS_SUCCESS 0
+#define TFS_STATUS_FAIL (-1)
+
+/* a request has at most two paths (move), each one shorter than MAX_FILE_NAME */
+#define TFS_MAX_PATHS 2
+#define TFS_MAX_REQUEST (sizeof(tfsRequestHeader) + TFS_MAX_PATHS * (MAX_FILE_NAME - 1))
+
+/* a batch has at most this many requests */
+#define TFS_MAX_BATCH 64
+#define TFS_MAX_BATCH_REQUEST (sizeof(tfsBatchHeader) + TFS_MAX_BATCH * TFS_MAX_REQUEST)
+#define TFS_MAX_BATCH_REPLY (sizeof(tfsBatchReply) + TFS_MAX_BATCH * sizeof(tfsReply))
+
+/* a read or a write carries at most this many bytes, larger ones are split by the client. its
+ * request is never larger than a batch */
+#define TFS_MAX_DATA 4096
+#define TFS_MAX_DATA_REQUEST (sizeof(tfsRequestHeader) + MAX_FILE_NAME - 1 + sizeof(tfsDataHeader) + TFS_MAX_DATA)
+
+/* reads and writes of at least this many bytes go through the bulk buffer, if there is one */
+#define TFS_BULK_THRESHOLD (64 * 1024)
+
+/* a server takes bulk buffers on its socket path followed by this */
+#define TFS_BULK_SUFFIX ".bulk"
+
+/* flags of a data header */
+#define TFS_DATA_BULK 1  /* the bytes are in the bulk buffer */
+
+/* largest reply of any kind */
+#define TFS_MAX_DATA_REPLY (sizeof(tfsReply) + sizeof(tfsDumpReply) + TFS_MAX_DATA)
+#define TFS_MAX_REPLY (TFS_MAX_BATCH_REPLY > TFS_MAX_DATA_REPLY ? TFS_MAX_BATCH_REPLY : TFS_MAX_DATA_REPLY)
+
+
+/*
+ * Header of a request.
+ */
+typedef struct tfsRequestHeader {
+    uint8_t magic;  /* always TFS_MAGIC */
+    uint8_t opcode;
+    uint8_t node_type;  /* 'f' or 'd' for creates, 0 otherwise */
+    uint8_t reserved;
+    uint32_t request_id;
+    uint16_t path_len[TFS_MAX_PATHS];  /* length of each path, 0 for paths the opcode doesn't use */
+} tfsRequestHeader;
+
+/*
+ * Follows the path of a read, write or truncate, and the header of a dump.
+ */
+typedef struct tfsDataHeader {
+    uint64_t offset;  /* where the read or write starts, the new size of the file for truncates, or
+                         the cursor of a dump */
+    uint32_t length;  /* number of bytes read or written, at most TFS_MAX_DATA unless they are bulk */
+    uint32_t flags;
+    uint64_t bulk_token;  /* token of the bulk buffer, with TFS_DATA_BULK */
+} tfsDataHeader;
+
+/*
+ * Sent with the memfd of a bulk buffer, which is answered with an int status.
+ */
+typedef struct tfsBulkHandoff {
+    uint64_t token;
+} tfsBulkHandoff;
+
+/*
+ * Reply to a request.
+ */
+typedef struct tfsReply {
+    uint32_t request_id;
+    int32_t status;  /* TFS_STATUS_SUCCESS or TFS_STATUS_FAIL */
+    int32_t inumber;  /* inumber found by a lookup, bytes read or written by reads and writes, bytes
+                         of the chunk of a dump, TFS_STATUS_FAIL for other opcodes */
+} tfsReply;
+
+/*
+ * Follows the reply to a dump.
+ */
+typedef struct tfsDumpReply {
+    uint64_t cursor;  /* cursor of the next chunk, 0 if this one ends the listing */
+} tfsDumpReply;
+
+/*
+ * Header of a batch.
+ */
+typedef struct tfsBatchHeader {
+    uint8_t magic;  /* always TFS_BATCH_MAGIC */
+    uint8_t reserved;
+    uint16_t count;  /* number of requests, at most TFS_MAX_BATCH */
+    uint32_t request_id;
+} tfsBatchHeader;
+
+/*
+ * Header of the reply to a batch.
+ */
+typedef struct tfsBatchReply {
+    uint32_t request_id;
+    uint32_t count;  /* number of replies that follow */
+} tfsBatchReply;
+
+
+#endif /* TECNICOFS_PROTOCOL_H */
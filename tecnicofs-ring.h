@@ -0,0 +1,130 @@
+#ifndef TECNICOFS_RING_H
+#define TECNICOFS_RING_H
+
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "tecnicofs-protocol.h"
+
+/*
+ * Shared memory transport. A client maps a memfd with a tfsRing and hands it to the server through
+ * a seqpacket socket listening on the server path with TFS_RING_SUFFIX. From then on the client puts
+ * messages in the submission queue and takes replies from the completion queue, in the same
+ * formats as the socket transport, without system calls while the other side is polling.
+ *
+ * A side that has nothing to do polls for spin_us microseconds and then sleeps on a futex, after
+ * setting its waiting flag so that the other side knows it must be woken.
+ *
+ * A client never has more than TFS_RING_ENTRIES messages without their replies taken, so the server
+ * always finds room for a reply.
+ */
+
+/* a server that takes rings listens for them on its socket path followed by this */
+#define TFS_RING_SUFFIX ".ring"
+
+/* number of slots in each queue of a ring */
+#define TFS_RING_ENTRIES 64
+
+/* milliseconds a side sleeps before checking if the other side is gone */
+#define TFS_RING_CHECK_MS 100
+
+/* hint to the cpu that it is polling */
+#if defined(__x86_64__) || defined(__i386__)
+#define TFS_RING_PAUSE() __builtin_ia32_pause()
+#else
+#define TFS_RING_PAUSE()
+#endif
+
+
+/*
+ * Message in the submission queue.
+ */
+typedef struct tfsRingRequest {
+    uint32_t len;
+    char data[TFS_MAX_BATCH_REQUEST];
+} tfsRingRequest;
+
+/*
+ * Reply in the completion queue.
+ */
+typedef struct tfsRingReply {
+    uint32_t len;
+    char data[TFS_MAX_REPLY];
+} tfsRingReply;
+
+/*
+ * Shared memory ring. Counters only grow, slot i of a queue being used by counter values i modulo
+ * TFS_RING_ENTRIES. Fields written by each side are kept in separate cache lines.
+ */
+typedef struct tfsRing {
+    /* written by the client */
+    uint32_t sq_tail __attribute__((aligned(64)));
+    uint32_t cq_head;
+    uint32_t client_waiting;  /* the client sleeps until cq_tail changes */
+
+    /* written by the server */
+    uint32_t sq_head __attribute__((aligned(64)));
+    uint32_t cq_tail;
+    uint32_t server_waiting;  /* the server sleeps until sq_tail changes */
+    uint32_t spin_us;  /* set by the server when it takes the ring */
+
+    tfsRingRequest sq[TFS_RING_ENTRIES] __attribute__((aligned(64)));
+    tfsRingReply cq[TFS_RING_ENTRIES];
+} tfsRing;
+
+
+/*
+ * Waits until a counter of a ring changes, polling it for a while before sleeping.
+ *
+ * Input:
+ *   - counter: counter that is waited on
+ *   - value: value the counter had
+ *   - waiting: flag of the calling side, set while it sleeps
+ *   - spin_us: microseconds spent polling before sleeping
+ * Output:
+ *   - TFS_STATUS_SUCCESS if the counter changed or TFS_STATUS_FAIL if it didn't after a while
+ * */
+static inline int tfs_ring_wait(uint32_t *counter, uint32_t value, uint32_t *waiting, long spin_us) {
+
+    struct timespec start, now;
+    struct timespec timeout = {0, TFS_RING_CHECK_MS * 1000000L};
+
+    if (spin_us > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        do {
+            for (int i = 0; i < 64; i++) {
+                if (__atomic_load_n(counter, __ATOMIC_ACQUIRE) != value) return TFS_STATUS_SUCCESS;
+                TFS_RING_PAUSE();
+            }
+            clock_gettime(CLOCK_MONOTONIC, &now);
+        } while ((now.tv_sec - start.tv_sec) * 1000000L + (now.tv_nsec - start.tv_nsec) / 1000 < spin_us);
+    }
+
+    /* the other side checks the flag after changing the counter, so one of them sees the other */
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(counter, __ATOMIC_SEQ_CST) == value)
+        syscall(SYS_futex, counter, FUTEX_WAIT, value, &timeout, NULL, 0);
+    __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+
+    return __atomic_load_n(counter, __ATOMIC_ACQUIRE) != value ? TFS_STATUS_SUCCESS : TFS_STATUS_FAIL;
+}
+
+
+/*
+ * Wakes the other side of a ring if it is sleeping on a counter that was just changed.
+ *
+ * Input:
+ *   - counter: counter that changed
+ *   - waiting: flag of the other side
+ * */
+static inline void tfs_ring_wake(uint32_t *counter, uint32_t *waiting) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_RELAXED))
+        syscall(SYS_futex, counter, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+
+#endif /* TECNICOFS_RING_H */
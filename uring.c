@@ -0,0 +1,240 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "fs/state.h"
+#include "uring.h"
+
+/*
+ * io_uring without liburing. The kernel shares the submission and completion queues through
+ * mappings of the ring's file descriptor, and io_uring_enter submits entries and waits for
+ * completions.
+ */
+
+
+/*
+ * Creates a ring.
+ * Input:
+ *  - ring: ring to create
+ *  - entries: size of the submission queue, a power of two
+ * Returns: SUCCESS or FAIL (if the kernel doesn't support io_uring)
+ */
+int uring_init(uring *ring, unsigned entries) {
+
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(uring));
+    memset(&params, 0, sizeof(params));
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) return FAIL;
+
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_SQ_RING);
+    ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                      IORING_OFF_SQES);
+
+    if (ring->sq_ptr == MAP_FAILED || ring->cq_ptr == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        uring_destroy(ring);
+        return FAIL;
+    }
+
+    ring->sq_head = (unsigned *) ((char *) ring->sq_ptr + params.sq_off.head);
+    ring->sq_tail = (unsigned *) ((char *) ring->sq_ptr + params.sq_off.tail);
+    ring->sq_mask = (unsigned *) ((char *) ring->sq_ptr + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) ((char *) ring->sq_ptr + params.sq_off.array);
+
+    ring->cq_head = (unsigned *) ((char *) ring->cq_ptr + params.cq_off.head);
+    ring->cq_tail = (unsigned *) ((char *) ring->cq_ptr + params.cq_off.tail);
+    ring->cq_mask = (unsigned *) ((char *) ring->cq_ptr + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_ptr + params.cq_off.cqes);
+
+    return SUCCESS;
+}
+
+
+/*
+ * Releases a ring.
+ * Input:
+ *  - ring: ring to release
+ */
+void uring_destroy(uring *ring) {
+    if (ring->sq_ptr != NULL && ring->sq_ptr != MAP_FAILED) munmap(ring->sq_ptr, ring->sq_size);
+    if (ring->cq_ptr != NULL && ring->cq_ptr != MAP_FAILED) munmap(ring->cq_ptr, ring->cq_size);
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+    if (ring->fd >= 0) close(ring->fd);
+    ring->fd = -1;
+}
+
+
+/*
+ * Gets a free submission queue entry, cleared.
+ * Input:
+ *  - ring: ring
+ * Returns: the entry or NULL if the submission queue is full
+ */
+struct io_uring_sqe *uring_get_sqe(uring *ring) {
+
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sq_tail + ring->sq_pending;
+
+    if (tail - head > *ring->sq_mask) return NULL;
+
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sq_array[index] = index;
+    ring->sq_pending++;
+
+    return sqe;
+}
+
+
+/*
+ * Gives the filled entries to the kernel and waits for completions.
+ * Input:
+ *  - ring: ring
+ *  - wait_nr: number of completions to wait for
+ * Returns: SUCCESS or FAIL
+ */
+int uring_submit_and_wait(uring *ring, unsigned wait_nr) {
+
+    unsigned submit = ring->sq_pending;
+
+    /* the entries must be written before the kernel sees the new tail */
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + submit, __ATOMIC_RELEASE);
+    ring->sq_pending = 0;
+
+    int res = syscall(__NR_io_uring_enter, ring->fd, submit, wait_nr, wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0,
+                      NULL, 0);
+
+    return res < 0 && errno != EINTR && errno != EBUSY ? FAIL : SUCCESS;
+}
+
+
+/*
+ * Gets the oldest completion.
+ * Input:
+ *  - ring: ring
+ * Returns: the completion or NULL if there isn't one
+ */
+struct io_uring_cqe *uring_peek_cqe(uring *ring) {
+
+    unsigned head = *ring->cq_head;
+
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) return NULL;
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+
+/*
+ * Lets the kernel reuse the oldest completion.
+ * Input:
+ *  - ring: ring
+ */
+void uring_cqe_seen(uring *ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Registers a ring of buffers the kernel picks from for entries with IOSQE_BUFFER_SELECT.
+ * Input:
+ *  - ring: ring
+ *  - buffers: buffers to create
+ *  - entries: number of buffers, a power of two
+ *  - buffer_size: size of each buffer
+ *  - group: id of the buffer group
+ * Returns: SUCCESS or FAIL (if the kernel doesn't support buffer rings)
+ */
+int uring_buffers_init(uring *ring, uringBuffers *buffers, unsigned entries, size_t buffer_size, int group) {
+
+    struct io_uring_buf_reg reg;
+    size_t ring_size = entries * sizeof(struct io_uring_buf);
+
+    buffers->entries = entries;
+    buffers->buffer_size = buffer_size;
+    buffers->group = group;
+    buffers->tail = 0;
+
+    buffers->ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers->ring == MAP_FAILED) return FAIL;
+
+    buffers->data = malloc(entries * buffer_size);
+    if (buffers->data == NULL) {
+        munmap(buffers->ring, ring_size);
+        return FAIL;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long) buffers->ring;
+    reg.ring_entries = entries;
+    reg.bgid = group;
+
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        free(buffers->data);
+        munmap(buffers->ring, ring_size);
+        return FAIL;
+    }
+
+    for (unsigned id = 0; id < entries; id++) uring_buffer_recycle(buffers, id);
+
+    return SUCCESS;
+}
+
+
+/*
+ * Unregisters and releases a ring of buffers.
+ * Input:
+ *  - ring: ring
+ *  - buffers: buffers to release
+ */
+void uring_buffers_destroy(uring *ring, uringBuffers *buffers) {
+
+    struct io_uring_buf_reg reg;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = buffers->group;
+    syscall(__NR_io_uring_register, ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+
+    free(buffers->data);
+    munmap(buffers->ring, buffers->entries * sizeof(struct io_uring_buf));
+}
+
+
+/*
+ * Gets a buffer of a buffer ring.
+ * Input:
+ *  - buffers: buffer ring
+ *  - id: id of the buffer, as given in a completion
+ * Returns: the buffer
+ */
+char *uring_buffer(uringBuffers *buffers, unsigned id) {
+    return buffers->data + id * buffers->buffer_size;
+}
+
+
+/*
+ * Gives a buffer back to the kernel.
+ * Input:
+ *  - buffers: buffer ring
+ *  - id: id of the buffer
+ */
+void uring_buffer_recycle(uringBuffers *buffers, unsigned id) {
+
+    struct io_uring_buf *buf = &buffers->ring->bufs[buffers->tail & (buffers->entries - 1)];
+
+    buf->addr = (unsigned long) uring_buffer(buffers, id);
+    buf->len = buffers->buffer_size;
+    buf->bid = id;
+
+    __atomic_store_n(&buffers->ring->tail, ++buffers->tail, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,60 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+/*
+ * Minimal io_uring wrapper over the raw system calls.
+ */
+typedef struct uring {
+    int fd;
+
+    /* submission queue */
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_pending;  /* entries filled but not yet given to the kernel */
+    struct io_uring_sqe *sqes;
+
+    /* completion queue */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* mappings */
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+} uring;
+
+/*
+ * Ring of buffers the kernel picks from when receiving.
+ */
+typedef struct uringBuffers {
+    struct io_uring_buf_ring *ring;
+    unsigned entries;
+    unsigned tail;
+    char *data;
+    size_t buffer_size;
+    int group;
+} uringBuffers;
+
+
+int uring_init(uring *ring, unsigned entries);
+void uring_destroy(uring *ring);
+struct io_uring_sqe *uring_get_sqe(uring *ring);
+int uring_submit_and_wait(uring *ring, unsigned wait_nr);
+struct io_uring_cqe *uring_peek_cqe(uring *ring);
+void uring_cqe_seen(uring *ring);
+int uring_buffers_init(uring *ring, uringBuffers *buffers, unsigned entries, size_t buffer_size, int group);
+void uring_buffers_destroy(uring *ring, uringBuffers *buffers);
+char *uring_buffer(uringBuffers *buffers, unsigned id);
+void uring_buffer_recycle(uringBuffers *buffers, unsigned id);
+
+
+#endif /* URING_H */